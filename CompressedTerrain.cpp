@@ -0,0 +1,603 @@
+#include "CompressedTerrain.h"
+#include "error.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+using namespace std;
+
+namespace {
+    const char kMagic[8] = { 'T', 'E', 'R', 'R', 'A', 'I', 'N', 'Z' };
+    const uint32_t kVersion = 1;
+
+    /* Token kinds, in the low two bits of each token. */
+    const uint64_t kDeltaToken  = 0;
+    const uint64_t kRepeatToken = 1;
+    const uint64_t kNaNToken    = 2;
+    const uint64_t kRawToken    = 3;
+
+    /* Quantums tried when none is given, largest first, and how many of the cells may be
+     * left over as raw doubles before a quantum is passed over.
+     */
+    const double kQuantumChoices[] = { 1, 0.5, 0.25, 0.125, 0.1, 0.05, 0.01, 0.001 };
+    const double kMaxEscapeFraction = 0.01;
+
+    /* Codes are kept below 2^52 so that they and their deltas never overflow a token. */
+    const double kMaxCode = 4503599627370496.0;
+
+    uint64_t zigZag(int64_t value) {
+        return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+    }
+
+    int64_t unZigZag(uint64_t value) {
+        return int64_t(value >> 1) ^ -int64_t(value & 1);
+    }
+
+    void putVarint(vector<unsigned char>& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        out.push_back(value);
+    }
+
+    uint64_t getVarint(const vector<unsigned char>& in, size_t& pos) {
+        uint64_t result = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos == in.size()) error("Compressed terrain data ends partway through a row.");
+            unsigned char byte = in[pos++];
+            result |= uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return result;
+        }
+        error("Compressed terrain data contains a malformed token.");
+    }
+
+    void putRaw(vector<unsigned char>& out, uint64_t bits, int numBytes) {
+        for (int i = 0; i < numBytes; i++) {
+            out.push_back(bits >> (8 * i));
+        }
+    }
+
+    uint64_t getRaw(const unsigned char* in, int numBytes) {
+        uint64_t bits = 0;
+        for (int i = 0; i < numBytes; i++) {
+            bits |= uint64_t(in[i]) << (8 * i);
+        }
+        return bits;
+    }
+
+    uint64_t bitsOf(double value) {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof bits);
+        return bits;
+    }
+
+    double doubleFrom(uint64_t bits) {
+        double value;
+        memcpy(&value, &bits, sizeof value);
+        return value;
+    }
+
+    /* Whether a height is a whole number of steps, and if so, how many. The check is the
+     * same multiplication the decoder does, so a height that passes comes back exactly.
+     */
+    bool codeFor(double height, double quantum, int64_t& code) {
+        double scaled = height / quantum;
+        if (!(fabs(scaled) < kMaxCode)) return false;
+        code = llround(scaled);
+        return double(code) * quantum == height;
+    }
+
+    /* The largest quantum that leaves few enough raw cells, or failing that, the one that
+     * leaves the fewest.
+     */
+    double quantumFor(const Grid<double>& heights) {
+        int64_t numCells = 0;
+        for (int row = 0; row < heights.numRows(); row++) {
+            for (int col = 0; col < heights.numCols(); col++) {
+                if (!isnan(heights[row][col])) numCells++;
+            }
+        }
+        int64_t allowed = int64_t(numCells * kMaxEscapeFraction);
+
+        double best = kQuantumChoices[0];
+        int64_t fewest = numeric_limits<int64_t>::max();
+        for (double quantum: kQuantumChoices) {
+            int64_t escapes = 0;
+            for (int row = 0; row < heights.numRows() && escapes < fewest; row++) {
+                for (int col = 0; col < heights.numCols(); col++) {
+                    int64_t code;
+                    double height = heights[row][col];
+                    if (!isnan(height) && !codeFor(height, quantum, code)) escapes++;
+                }
+            }
+            if (escapes <= allowed) return quantum;
+            if (escapes < fewest) {
+                fewest = escapes;
+                best = quantum;
+            }
+        }
+        return best;
+    }
+
+    void encodeRow(const double* line, int numCols, double quantum,
+                   int64_t& anchor, vector<unsigned char>& out) {
+        int64_t prev = anchor;
+        int64_t code;
+        for (int col = 0; col < numCols; ) {
+            int end = col + 1;
+            if (isnan(line[col])) {
+                while (end < numCols && isnan(line[end])) end++;
+                putVarint(out, (uint64_t(end - col) << 2) | kNaNToken);
+            } else if (!codeFor(line[col], quantum, code)) {
+                while (end < numCols && !isnan(line[end]) && !codeFor(line[end], quantum, code)) end++;
+                putVarint(out, (uint64_t(end - col) << 2) | kRawToken);
+                for (int i = col; i < end; i++) {
+                    putRaw(out, bitsOf(line[i]), sizeof(double));
+                }
+            } else {
+                if (col == 0) anchor = code;
+                if (code == prev) {
+                    while (end < numCols && codeFor(line[end], quantum, code) && code == prev) end++;
+                    putVarint(out, (uint64_t(end - col) << 2) | kRepeatToken);
+                } else {
+                    putVarint(out, (zigZag(code - prev) << 2) | kDeltaToken);
+                    prev = code;
+                }
+            }
+            col = end;
+        }
+    }
+
+    /* Cuts a row into runs of cells water can pass through, as [start, end) pairs, and
+     * notes which runs hold a water source.
+     */
+    void runsIn(const double* line, const vector<char>& isSource, double height,
+                vector<int>& starts, vector<int>& ends, vector<char>& wet) {
+        starts.clear();
+        ends.clear();
+        wet.clear();
+
+        int numCols = isSource.size();
+        for (int col = 0; col < numCols; col++) {
+            if (!(line[col] <= height || isSource[col])) continue;
+
+            bool hasSource = false;
+            starts.push_back(col);
+            for (; col < numCols && (line[col] <= height || isSource[col]); col++) {
+                hasSource |= isSource[col];
+            }
+            ends.push_back(col);
+            wet.push_back(hasSource);
+        }
+    }
+
+    int findRoot(vector<int>& parent, int run) {
+        while (parent[run] != run) {
+            parent[run] = parent[parent[run]];
+            run = parent[run];
+        }
+        return run;
+    }
+}
+
+CompressedTerrain::CompressedTerrain(const Grid<double>& heights, const Vector<GridLocation>& sources,
+                                     double quantum)
+    : rows(heights.numRows()), cols(heights.numCols()), sources(sources) {
+    if (quantum == 0) quantum = quantumFor(heights);
+    if (!(quantum > 0) || isinf(quantum)) {
+        error("Quantum must be positive and finite.");
+    }
+    step = quantum;
+
+    int64_t anchor = 0;
+    for (int row = 0; row < rows && cols > 0; row++) {
+        encodeRow(&heights[row][0], cols, step, anchor, data);
+    }
+    data.shrink_to_fit();
+}
+
+/* The header is written a byte at a time so that files read the same everywhere:
+ *
+ *     "TERRAINZ", version, rows, cols, numSources (all uint32), quantum (double),
+ *     the sources as varint (row, col) pairs, the length of the data (uint64), the data.
+ *
+ * Everything is little-endian.
+ */
+void CompressedTerrain::save(const string& filename) const {
+    vector<unsigned char> header(begin(kMagic), end(kMagic));
+    putRaw(header, kVersion, 4);
+    putRaw(header, rows, 4);
+    putRaw(header, cols, 4);
+    putRaw(header, sources.size(), 4);
+    putRaw(header, bitsOf(step), 8);
+    for (GridLocation source: sources) {
+        putVarint(header, source.row);
+        putVarint(header, source.col);
+    }
+    putRaw(header, data.size(), 8);
+
+    ofstream out(filename, ios::binary);
+    out.write(reinterpret_cast<const char*>(header.data()), header.size());
+    out.write(reinterpret_cast<const char*>(data.data()), data.size());
+    if (!out) error("Cannot write file " + filename);
+}
+
+/* Every row is decoded once up front, so that a file that loads is one that can be read
+ * all the way through.
+ */
+CompressedTerrain CompressedTerrain::load(const string& filename) {
+    ifstream in(filename, ios::binary);
+    if (!in) error("Cannot open file " + filename);
+    vector<unsigned char> bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+    const size_t kFixedBytes = sizeof kMagic + 4 * 4 + 8;
+    if (bytes.size() < kFixedBytes || !equal(begin(kMagic), end(kMagic), bytes.begin())) {
+        error(filename + " is not a compressed terrain file.");
+    }
+    if (getRaw(&bytes[8], 4) != kVersion) {
+        error(filename + " is from an unsupported version of the compressed terrain format.");
+    }
+
+    CompressedTerrain result;
+    uint64_t numRows = getRaw(&bytes[12], 4);
+    uint64_t numCols = getRaw(&bytes[16], 4);
+    uint64_t numSources = getRaw(&bytes[20], 4);
+    result.step = doubleFrom(getRaw(&bytes[24], 8));
+    if (numRows > uint64_t(numeric_limits<int>::max()) || numCols > uint64_t(numeric_limits<int>::max()) ||
+        !(result.step > 0) || isinf(result.step)) {
+        error(filename + " has a malformed header.");
+    }
+    result.rows = numRows;
+    result.cols = numCols;
+
+    size_t pos = kFixedBytes;
+    try {
+        for (uint64_t i = 0; i < numSources; i++) {
+            uint64_t row = getVarint(bytes, pos);
+            uint64_t col = getVarint(bytes, pos);
+            if (row >= numRows || col >= numCols) error(filename + " has a water source out of bounds.");
+            result.sources.add({ int(row), int(col) });
+        }
+    } catch (const ErrorException&) {
+        error(filename + " has malformed water sources.");
+    }
+
+    if (bytes.size() - pos < 8 || getRaw(&bytes[pos], 8) != bytes.size() - pos - 8) {
+        error(filename + " is the wrong size.");
+    }
+    result.data.assign(bytes.begin() + pos + 8, bytes.end());
+
+    CompressedRowReader reader(result);
+    while (reader.hasNextRow()) {
+        reader.nextRow();
+    }
+    return result;
+}
+
+int CompressedTerrain::numRows() const {
+    return rows;
+}
+
+int CompressedTerrain::numCols() const {
+    return cols;
+}
+
+bool CompressedTerrain::isEmpty() const {
+    return rows == 0 || cols == 0;
+}
+
+const Vector<GridLocation>& CompressedTerrain::waterSources() const {
+    return sources;
+}
+
+double CompressedTerrain::quantum() const {
+    return step;
+}
+
+size_t CompressedTerrain::compressedBytes() const {
+    return data.size();
+}
+
+Grid<double> CompressedTerrain::decompress() const {
+    Grid<double> result(rows, cols);
+    CompressedRowReader reader(*this);
+    for (int row = 0; row < rows && cols > 0; row++) {
+        const double* line = reader.nextRow();
+        copy(line, line + cols, &result[row][0]);
+    }
+    return result;
+}
+
+CompressedRowReader::CompressedRowReader(const CompressedTerrain& terrain)
+    : terrain(terrain), heights(terrain.cols) {
+
+}
+
+bool CompressedRowReader::hasNextRow() const {
+    return row < terrain.rows;
+}
+
+const double* CompressedRowReader::nextRow() {
+    if (!hasNextRow()) error("Read past the last row of a compressed terrain.");
+
+    const vector<unsigned char>& data = terrain.data;
+    double quantum = terrain.step;
+    int numCols = terrain.cols;
+
+    int64_t prev = anchor;
+    for (int col = 0; col < numCols; ) {
+        uint64_t token = getVarint(data, next);
+        uint64_t payload = token >> 2;
+        uint64_t kind = token & 3;
+
+        if (kind == kDeltaToken) {
+            /* Wrapping arithmetic, so that bad data can't overflow. */
+            prev = int64_t(uint64_t(prev) + uint64_t(unZigZag(payload)));
+            if (col == 0) anchor = prev;
+            heights[col++] = double(prev) * quantum;
+            continue;
+        }
+
+        if (payload == 0 || payload > uint64_t(numCols - col)) {
+            error("Compressed terrain data has a run that doesn't fit in its row.");
+        }
+        int end = col + int(payload);
+        if (kind == kRepeatToken) {
+            fill(heights.begin() + col, heights.begin() + end, double(prev) * quantum);
+        } else if (kind == kNaNToken) {
+            fill(heights.begin() + col, heights.begin() + end, numeric_limits<double>::quiet_NaN());
+        } else {
+            if ((data.size() - next) / sizeof(double) < payload) {
+                error("Compressed terrain data ends partway through a row.");
+            }
+            for (; col < end; col++, next += sizeof(double)) {
+                heights[col] = doubleFrom(getRaw(&data[next], sizeof(double)));
+            }
+        }
+        col = end;
+    }
+
+    row++;
+    if (!hasNextRow() && next != data.size()) {
+        error("Compressed terrain data has bytes left over after the last row.");
+    }
+    return heights.data();
+}
+
+FloodMask floodedMaskIn(const CompressedTerrain& terrain,
+                        const Vector<GridLocation>& sources,
+                        double height) {
+    int numRows = terrain.numRows(), numCols = terrain.numCols();
+    FloodMask result(numRows, numCols);
+    if (terrain.isEmpty()) return result;
+
+    vector<GridLocation> byRow(sources.begin(), sources.end());
+    sort(byRow.begin(), byRow.end(), [](GridLocation lhs, GridLocation rhs) {
+        return lhs.row < rhs.row;
+    });
+
+    vector<char> isSource(numCols);
+    vector<int> starts, ends;
+    vector<char> wet;
+
+    /* Calls the given function with each row's runs, with the sources marked. */
+    auto forEachRow = [&](const function<void (int)>& visit) {
+        CompressedRowReader reader(terrain);
+        size_t next = 0;
+        for (int row = 0; row < numRows; row++) {
+            size_t first = next;
+            for (; next < byRow.size() && byRow[next].row == row; next++) {
+                isSource[byRow[next].col] = true;
+            }
+            runsIn(reader.nextRow(), isSource, height, starts, ends, wet);
+            for (size_t i = first; i < next; i++) {
+                isSource[byRow[i].col] = false;
+            }
+            visit(row);
+        }
+    };
+
+    /* Pass one: join each run to the runs it touches in the row above. Run ids go up
+     * from zero in the order the runs are found.
+     */
+    vector<int> parent;
+    vector<char> rootWet;
+    vector<int> aboveStarts, aboveEnds, aboveIds, ids;
+    forEachRow([&](int) {
+        ids.clear();
+        for (size_t i = 0; i < starts.size(); i++) {
+            ids.push_back(parent.size());
+            parent.push_back(parent.size());
+            rootWet.push_back(wet[i]);
+        }
+
+        for (size_t i = 0, j = 0; i < starts.size() && j < aboveStarts.size(); ) {
+            if (starts[i] < aboveEnds[j] && aboveStarts[j] < ends[i]) {
+                int lhs = findRoot(parent, ids[i]), rhs = findRoot(parent, aboveIds[j]);
+                if (lhs != rhs) {
+                    parent[max(lhs, rhs)] = min(lhs, rhs);
+                    rootWet[min(lhs, rhs)] |= rootWet[max(lhs, rhs)];
+                }
+            }
+            if (ends[i] < aboveEnds[j]) i++;
+            else j++;
+        }
+
+        swap(aboveStarts, starts);
+        swap(aboveEnds, ends);
+        swap(aboveIds, ids);
+    });
+
+    /* Pass two: the same runs come out in the same order, so their ids can be counted off. */
+    int id = 0;
+    forEachRow([&](int row) {
+        for (size_t i = 0; i < starts.size(); i++, id++) {
+            if (rootWet[findRoot(parent, id)]) result.setRange(row, starts[i], ends[i]);
+        }
+    });
+    return result;
+}
+
+/***** Test Cases Below This Point *****/
+#include "GUI/SimpleTest.h"
+#include "RisingTides.h"
+#include <cstdio>
+#include <random>
+
+namespace {
+    /* NaN never equals itself, so the grids are compared bit for bit. */
+    bool sameHeights(const Grid<double>& lhs, const Grid<double>& rhs) {
+        if (lhs.numRows() != rhs.numRows() || lhs.numCols() != rhs.numCols()) return false;
+        for (int row = 0; row < lhs.numRows(); row++) {
+            for (int col = 0; col < lhs.numCols(); col++) {
+                if (bitsOf(lhs[row][col]) != bitsOf(rhs[row][col])) return false;
+            }
+        }
+        return true;
+    }
+
+    /* A bumpy terrain with flat stretches, some NaN cells, and heights to the centimeter. */
+    Grid<double> randomCompressibleTerrain(int rows, int cols, int seed) {
+        mt19937 generator(seed);
+        uniform_int_distribution<int> steps(-3, 3);
+        uniform_int_distribution<int> percent(0, 99);
+
+        Grid<double> result(rows, cols);
+        for (int row = 0; row < rows; row++) {
+            int level = row % 7;
+            for (int col = 0; col < cols; col++) {
+                int roll = percent(generator);
+                if (roll < 30) level += steps(generator);
+                result[row][col] = roll < 3? numeric_limits<double>::quiet_NaN() : level * 0.25;
+            }
+        }
+        return result;
+    }
+}
+
+STUDENT_TEST("CompressedTerrain gives back exactly the heights it was given.") {
+    double nan = numeric_limits<double>::quiet_NaN();
+    Grid<double> world = {
+        {   0,   0,   0,    0,   0,   nan, nan },
+        {   1,   2,   3, 1e15,  -7,  0.125, 1.0/3 },
+        { nan,   5,   5,    5,   5,     5,  -2 },
+        { 1e300, -1e300, 4.5, 4.5, 0.1, 0.1, 0.1 }
+    };
+
+    CompressedTerrain compressed(world, { { 0, 0 } });
+    EXPECT_EQUAL(compressed.numRows(), 4);
+    EXPECT_EQUAL(compressed.numCols(), 7);
+    EXPECT(sameHeights(compressed.decompress(), world));
+
+    for (double quantum: { 1.0, 0.5, 0.001 }) {
+        EXPECT(sameHeights(CompressedTerrain(world, {}, quantum).decompress(), world));
+    }
+
+    EXPECT(CompressedTerrain(Grid<double>(), {}).decompress().isEmpty());
+    EXPECT_EQUAL(CompressedTerrain(Grid<double>(0, 5), {}).decompress().numCols(), 5);
+    EXPECT_ERROR(CompressedTerrain(world, {}, -1));
+}
+
+STUDENT_TEST("CompressedTerrain packs smooth terrains into much less than a double per cell.") {
+    Grid<double> world = randomCompressibleTerrain(200, 300, 1);
+    CompressedTerrain compressed(world, {});
+
+    EXPECT_EQUAL(compressed.quantum(), 0.25);
+    EXPECT(compressed.compressedBytes() * 4 < sizeof(double) * 200 * 300);
+    EXPECT(sameHeights(compressed.decompress(), world));
+
+    Grid<double> sea(100, 1000, -5.0);
+    EXPECT(CompressedTerrain(sea, {}).compressedBytes() < 500);
+}
+
+STUDENT_TEST("CompressedRowReader hands back rows in order and stops at the end.") {
+    Grid<double> world = randomCompressibleTerrain(5, 9, 2);
+    CompressedTerrain compressed(world, {});
+
+    CompressedRowReader reader(compressed);
+    for (int row = 0; row < 5; row++) {
+        EXPECT(reader.hasNextRow());
+        const double* line = reader.nextRow();
+        for (int col = 0; col < 9; col++) {
+            EXPECT_EQUAL(bitsOf(line[col]), bitsOf(world[row][col]));
+        }
+    }
+    EXPECT(!reader.hasNextRow());
+    EXPECT_ERROR(reader.nextRow());
+}
+
+STUDENT_TEST("floodedMaskIn over a compressed terrain matches floodedRegionsIn.") {
+    for (int seed = 0; seed < 4; seed++) {
+        Grid<double> world = randomCompressibleTerrain(43, 71, seed);
+        Vector<GridLocation> sources = { { 0, 0 }, { 21, 35 }, { 42, 70 }, { 21, 35 }, { 10, 3 } };
+        world[10][3] = 100;  // A source above any water level.
+        world[0][0] = numeric_limits<double>::quiet_NaN();
+
+        CompressedTerrain compressed(world, sources);
+        for (double height = -2.0; height <= 3.0; height += 0.5) {
+            EXPECT_EQUAL(floodedMaskIn(compressed, sources, height),
+                         FloodMask(floodedRegionsIn(world, sources, height)));
+        }
+        EXPECT_EQUAL(floodedMaskIn(compressed, {}, 1000).count(), 0);
+    }
+
+    /* A spiral, so that runs have to be joined through many rows. */
+    Grid<double> spiral = {
+        { 0, 0, 0, 0, 0, 0 },
+        { 9, 9, 9, 9, 9, 0 },
+        { 0, 0, 0, 0, 9, 0 },
+        { 0, 9, 9, 0, 9, 0 },
+        { 0, 9, 9, 9, 9, 0 },
+        { 0, 0, 0, 0, 0, 0 }
+    };
+    CompressedTerrain compressed(spiral, {});
+    EXPECT_EQUAL(floodedMaskIn(compressed, { { 3, 3 } }, 1),
+                 FloodMask(floodedRegionsIn(spiral, { { 3, 3 } }, 1)));
+}
+
+STUDENT_TEST("CompressedTerrain round-trips through a file.") {
+    const string filename = "compressed-terrain-test.terrainz";
+    Grid<double> world = randomCompressibleTerrain(30, 20, 3);
+    Vector<GridLocation> sources = { { 0, 0 }, { 29, 19 } };
+
+    CompressedTerrain(world, sources).save(filename);
+    CompressedTerrain loaded = CompressedTerrain::load(filename);
+    EXPECT(sameHeights(loaded.decompress(), world));
+    EXPECT_EQUAL(loaded.waterSources(), sources);
+    EXPECT_EQUAL(loaded.quantum(), 0.25);
+
+    remove(filename.c_str());
+}
+
+STUDENT_TEST("Malformed compressed terrain files are reported with error().") {
+    const string filename = "compressed-terrain-test.terrainz";
+    Grid<double> world = randomCompressibleTerrain(10, 10, 4);
+    CompressedTerrain(world, { { 5, 5 } }).save(filename);
+
+    ifstream in(filename, ios::binary);
+    string good((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    in.close();
+
+    auto loadWith = [&](const string& contents) {
+        ofstream(filename, ios::binary) << contents;
+        CompressedTerrain::load(filename);
+    };
+
+    EXPECT_ERROR(loadWith(""));
+    EXPECT_ERROR(loadWith("TERRAINB" + good.substr(8)));
+    EXPECT_ERROR(loadWith(good.substr(0, good.size() - 1)));
+    EXPECT_ERROR(loadWith(good + "x"));
+
+    /* The header claims one more column than the rows hold. */
+    string wider = good;
+    wider[16] = 11;
+    EXPECT_ERROR(loadWith(wider));
+
+    loadWith(good);
+    remove(filename.c_str());
+    EXPECT_ERROR(CompressedTerrain::load(filename));
+}
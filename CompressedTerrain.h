@@ -0,0 +1,116 @@
+/***************************************************************
+ * File: CompressedTerrain.h
+ *
+ * A compact encoding for terrains, for keeping huge terrains
+ * small on disk and over the network, and a flood that reads the
+ * encoding a row at a time instead of decompressing it first.
+ */
+#pragma once
+
+#include "FloodMask.h"
+#include "grid.h"
+#include "vector.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* File suffix for compressed terrains. */
+const std::string kCompressedTerrainSuffix = ".terrainz";
+
+/* Type representing a terrain compressed row by row. Heights are turned into integer
+ * multiples of a fixed step (the quantum), and each row is stored as a string of tokens,
+ * each of them a varint whose low two bits say what it is:
+ *
+ *   - a delta, zig-zag encoded: the cell is this many steps up or down from the cell to
+ *     its left (or, in the first column, from the first cell of the row above);
+ *   - a run: the next k cells are the same height as the cell before them, which is how
+ *     flat areas like the sea come out to a byte or two per run;
+ *   - a run of NaN cells;
+ *   - k raw doubles, for heights that aren't a whole number of steps.
+ *
+ * Nothing is lost: every height comes back exactly as it went in, except that negative
+ * zero comes back as zero. The quantum is picked automatically from a few round numbers
+ * unless one is given; terrains stored to the meter or the centimeter take a byte or so
+ * per cell, and flat ones much less.
+ *
+ * Files that are malformed, and data that doesn't decode to the right number of cells,
+ * are reported with error().
+ */
+class CompressedTerrain {
+public:
+    /* Creates an empty terrain. */
+    CompressedTerrain() = default;
+
+    /* Compresses the given terrain. A quantum of 0 means "pick one." */
+    CompressedTerrain(const Grid<double>& heights, const Vector<GridLocation>& sources,
+                      double quantum = 0);
+
+    /* Reads and writes .terrainz files. */
+    static CompressedTerrain load(const std::string& filename);
+    void save(const std::string& filename) const;
+
+    int numRows() const;
+    int numCols() const;
+    bool isEmpty() const;
+
+    const Vector<GridLocation>& waterSources() const;
+
+    /* Size of one step between heights, in meters. */
+    double quantum() const;
+
+    /* Size of the encoded rows, in bytes. */
+    std::size_t compressedBytes() const;
+
+    /* Decodes the whole terrain. */
+    Grid<double> decompress() const;
+
+private:
+    friend class CompressedRowReader;
+
+    int rows = 0, cols = 0;
+    double step = 1;
+    Vector<GridLocation> sources;
+    std::vector<unsigned char> data; // All of the rows, one after the other.
+};
+
+/* Type that decodes a CompressedTerrain one row at a time, in order, holding nothing but
+ * the row it's on. The terrain has to outlive the reader.
+ */
+class CompressedRowReader {
+public:
+    explicit CompressedRowReader(const CompressedTerrain& terrain);
+
+    bool hasNextRow() const;
+
+    /* Decodes the next row and returns its numCols() heights. They stay valid until the
+     * next call. Reading past the last row is reported with error().
+     */
+    const double* nextRow();
+
+private:
+    const CompressedTerrain& terrain;
+    std::size_t next = 0;      // Offset of the next token.
+    int row = 0;               // Index of the next row.
+    std::int64_t anchor = 0;   // Code the next row's first cell is predicted from.
+    std::vector<double> heights;
+};
+
+/**
+ * Same as floodedRegionsIn, but over a compressed terrain, which is decoded a row at a
+ * time and never held in memory all at once.
+ *
+ * This reads the terrain twice. The first time through, each row is cut into runs of
+ * cells that water can pass through (cells at or below the water, and water sources),
+ * and runs that touch runs in the row above are joined with a union-find. The second
+ * time through, the runs come out in the same order, and the ones joined to a water
+ * source are flooded. Besides the result, that only takes an int for every run.
+ *
+ * @param terrain The compressed terrain.
+ * @param sources Locations of all the water sources, which you can assume are all in bounds.
+ * @param height The water height, in meters.
+ * @return Which cells are flooded.
+ */
+FloodMask floodedMaskIn(const CompressedTerrain& terrain,
+                        const Vector<GridLocation>& sources,
+                        double height);
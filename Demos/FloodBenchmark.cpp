@@ -0,0 +1,446 @@
+#include "FloodBenchmark.h"
+#include "RisingTides.h"
+#include "CompressedTerrain.h"
+#include "FloodWorkspace.h"
+#include "MergeTree.h"
+#include "StripedFlood.h"
+#include "TerrainPyramid.h"
+#include "TiledFlood.h"
+#include "GUI/Timer.h"
+#include "error.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <sstream>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+using namespace std;
+
+namespace {
+    /* Scratch files for the tiled engine. */
+    const string kTiledTerrainFile = "FloodBenchmark.tiles";
+    const string kTiledMaskFile    = "FloodBenchmark.mask";
+
+    /* Processes the striped engine splits the terrain between. */
+    const int kStripedWorkers = 4;
+
+    /* Range of heights in the fractal terrain. */
+    const double kFractalHeight = 1000.0;
+    const int    kFractalOctaves = 6;
+
+    /* How long it takes to run the given function once. */
+    template <typename Function> double secondsFor(Function function) {
+        Timing::Timer timer;
+        timer.start();
+        function();
+        timer.stop();
+        return timer.elapsed();
+    }
+
+    /* Best time out of several runs, which filters out most of the noise from whatever
+     * else the machine is doing.
+     */
+    template <typename Function> double bestSecondsFor(int repetitions, Function function) {
+        double best = numeric_limits<double>::infinity();
+        for (int i = 0; i < max(repetitions, 1); i++) {
+            best = min(best, secondsFor(function));
+        }
+        return best;
+    }
+
+    int64_t countFlooded(const Grid<bool>& flooded) {
+        int64_t result = 0;
+        for (bool isFlooded: flooded) {
+            if (isFlooded) result++;
+        }
+        return result;
+    }
+
+    /* The given fraction of the way through the terrain's heights, in sorted order. */
+    double quantileOf(const Grid<double>& terrain, double fraction) {
+        vector<double> heights(terrain.begin(), terrain.end());
+        size_t index = min(heights.size() - 1, size_t(fraction * heights.size()));
+        nth_element(heights.begin(), heights.begin() + index, heights.end());
+        return heights[index];
+    }
+
+    /* Escapes a string for use inside a JSON string literal. */
+    string jsonEscape(const string& text) {
+        string result;
+        for (char ch: text) {
+            if (ch == '"' || ch == '\\') result += '\\';
+            result += ch;
+        }
+        return result;
+    }
+}
+
+/* Sums several octaves of value noise: random heights on a coarse lattice, blended
+ * bilinearly between lattice points, with each octave twice as fine and half as tall
+ * as the one before.
+ */
+FloodWorkload fractalWorkload(int numRows, int numCols, int seed) {
+    mt19937 generator(seed);
+    uniform_real_distribution<double> noise(0.0, 1.0);
+
+    FloodWorkload result;
+    result.name = "fractal";
+    result.loadSeconds = secondsFor([&] {
+        result.terrain.resize(numRows, numCols);
+
+        double amplitude = kFractalHeight / 2;
+        int spacing = max(1, max(numRows, numCols) / 4);
+        for (int octave = 0; octave < kFractalOctaves; octave++) {
+            int latticeRows = numRows / spacing + 2;
+            int latticeCols = numCols / spacing + 2;
+            Grid<double> lattice(latticeRows, latticeCols);
+            for (int r = 0; r < latticeRows; r++) {
+                for (int c = 0; c < latticeCols; c++) {
+                    lattice[r][c] = noise(generator);
+                }
+            }
+
+            for (int row = 0; row < numRows; row++) {
+                int    r  = row / spacing;
+                double dr = double(row % spacing) / spacing;
+                for (int col = 0; col < numCols; col++) {
+                    int    c  = col / spacing;
+                    double dc = double(col % spacing) / spacing;
+
+                    double top    = lattice[r][c]     * (1 - dc) + lattice[r][c + 1]     * dc;
+                    double bottom = lattice[r + 1][c] * (1 - dc) + lattice[r + 1][c + 1] * dc;
+                    result.terrain[row][col] += amplitude * (top * (1 - dr) + bottom * dr);
+                }
+            }
+
+            amplitude /= 2;
+            spacing = max(1, spacing / 2);
+        }
+    });
+
+    result.sources = { { 0, 0 }, { numRows / 2, numCols / 2 } };
+    result.heights = {
+        quantileOf(result.terrain, 0.1),
+        quantileOf(result.terrain, 0.5),
+        quantileOf(result.terrain, 0.9)
+    };
+    return result;
+}
+
+/* Carves the corridor by walking around the edge of a rectangle, then shrinking the
+ * rectangle by two cells on each side (leaving a wall between laps) and going around
+ * again, with a one-cell gap linking each lap to the next.
+ */
+FloodWorkload spiralMazeWorkload(int numRows, int numCols) {
+    FloodWorkload result;
+    result.name = "spiral maze";
+    result.loadSeconds = secondsFor([&] {
+        result.terrain.resize(numRows, numCols);
+        result.terrain.fill(1.0);
+
+        int top = 0, bottom = numRows - 1, left = 0, right = numCols - 1;
+        while (top <= bottom && left <= right) {
+            for (int col = left; col <= right; col++) result.terrain[top][col] = 0.0;
+            for (int row = top; row <= bottom; row++) result.terrain[row][right] = 0.0;
+            if (top < bottom) {
+                for (int col = right; col >= left; col--) result.terrain[bottom][col] = 0.0;
+            }
+            if (left < right) {
+                for (int row = bottom; row >= top + 2; row--) result.terrain[row][left] = 0.0;
+                if (top + 2 <= bottom && left + 1 <= right) result.terrain[top + 2][left + 1] = 0.0;
+            }
+
+            top += 2;
+            bottom -= 2;
+            left += 2;
+            right -= 2;
+        }
+    });
+
+    result.sources = { { 0, 0 } };
+    result.heights = { 0.5 };
+    return result;
+}
+
+FloodWorkload checkerboardWorkload(int numRows, int numCols) {
+    FloodWorkload result;
+    result.name = "checkerboard";
+    result.loadSeconds = secondsFor([&] {
+        result.terrain.resize(numRows, numCols);
+        for (int row = 0; row < numRows; row++) {
+            for (int col = 0; col < numCols; col++) {
+                result.terrain[row][col] = (row + col) % 2;
+            }
+        }
+    });
+
+    result.sources = { { 0, 0 }, { numRows / 2, numCols / 2 } };
+    result.heights = { 0.5, 1.0 };
+    return result;
+}
+
+FloodWorkload allFloodedWorkload(int numRows, int numCols) {
+    FloodWorkload result;
+    result.name = "all flooded";
+    result.loadSeconds = secondsFor([&] {
+        result.terrain.resize(numRows, numCols);
+    });
+
+    result.sources = { { numRows / 2, numCols / 2 } };
+    result.heights = { 0.0 };
+    return result;
+}
+
+FloodWorkload noneFloodedWorkload(int numRows, int numCols) {
+    FloodWorkload result;
+    result.name = "none flooded";
+    result.loadSeconds = secondsFor([&] {
+        result.terrain.resize(numRows, numCols);
+        result.terrain.fill(1.0);
+    });
+
+    result.sources = { { numRows / 2, numCols / 2 } };
+    result.heights = { 0.0 };
+    return result;
+}
+
+Vector<FloodWorkload> syntheticWorkloads(int numRows, int numCols) {
+    return {
+        fractalWorkload(numRows, numCols, 137),
+        spiralMazeWorkload(numRows, numCols),
+        checkerboardWorkload(numRows, numCols),
+        allFloodedWorkload(numRows, numCols),
+        noneFloodedWorkload(numRows, numCols)
+    };
+}
+
+/* Engines that preprocess the terrain do so once up front, since that work is shared across
+ * every height. Each flood is then timed on its own, and its result checked against the
+ * breadth-first search.
+ */
+Vector<FloodBenchmarkResult> runFloodBenchmark(const FloodWorkload& workload, int repetitions) {
+    const Grid<double>& terrain = workload.terrain;
+    const Vector<GridLocation>& sources = workload.sources;
+    double numCells = double(terrain.numRows()) * terrain.numCols();
+
+    Vector<FloodBenchmarkResult> results;
+    auto record = [&](const string& engine, double height, int64_t flooded,
+                      double prepareSeconds, double floodSeconds) {
+        results.add({
+            workload.name, engine, terrain.numRows(), terrain.numCols(), height, flooded,
+            workload.loadSeconds, prepareSeconds, floodSeconds,
+            floodSeconds > 0? numCells / floodSeconds : 0
+        });
+    };
+
+    PaddedTerrain padded;
+    double paddedSeconds = secondsFor([&] {
+        padded = PaddedTerrain(terrain);
+    });
+
+    Grid<double> floodHeights;
+    double floodHeightsSeconds = secondsFor([&] {
+        floodHeights = floodHeightsIn(terrain, sources);
+    });
+
+    /* Terrains with too many distinct heights can't be quantized, and skip that engine. */
+    QuantizedTerrain quantized;
+    bool quantizes = QuantizedTerrain::fits(terrain);
+    double quantizedSeconds = secondsFor([&] {
+        if (quantizes) quantized = QuantizedTerrain(terrain);
+    });
+
+    TerrainPyramid pyramid;
+    double pyramidSeconds = secondsFor([&] {
+        pyramid = TerrainPyramid(terrain);
+    });
+
+    CompressedTerrain compressed;
+    double compressedSeconds = secondsFor([&] {
+        compressed = CompressedTerrain(terrain, sources);
+    });
+
+    double tiledSeconds = secondsFor([&] {
+        TiledTerrain::write(kTiledTerrainFile, terrain);
+    });
+
+    MergeTree mergeTree;
+    double mergeTreeSeconds = secondsFor([&] {
+        mergeTree = MergeTree(terrain, sources);
+    });
+
+    /* Floods every height in one call. That can't be timed height by height, so each
+     * height is charged an even share of the whole batch.
+     */
+    Vector<Grid<bool>> batched;
+    double batchedSeconds = bestSecondsFor(repetitions, [&] {
+        batched = floodedRegionsForHeights(terrain, sources, workload.heights);
+    }) / max(workload.heights.size(), 1);
+
+    /* Shared across heights, the way a batch job would use it. */
+    FloodWorkspace workspace;
+
+    {
+        TiledTerrain tiled(kTiledTerrainFile);
+        for (int i = 0; i < workload.heights.size(); i++) {
+            double height = workload.heights[i];
+            Grid<bool> expected;
+            double seconds = bestSecondsFor(repetitions, [&] {
+                expected = floodedRegionsIn(terrain, sources, height);
+            });
+            int64_t flooded = countFlooded(expected);
+            record("breadth-first", height, flooded, 0, seconds);
+
+            auto check = [&](const string& engine, const Grid<bool>& actual) {
+                if (actual != expected) {
+                    error("Flood engine " + engine + " disagrees with breadth-first search on " + workload.name + ".");
+                }
+            };
+
+            Grid<bool> parallel;
+            seconds = bestSecondsFor(repetitions, [&] {
+                parallel = floodedRegionsInParallel(terrain, sources, height);
+            });
+            check("parallel", parallel);
+            record("parallel", height, flooded, 0, seconds);
+
+            Grid<bool> scanline;
+            seconds = bestSecondsFor(repetitions, [&] {
+                scanline = floodedRegionsByScanline(terrain, sources, height);
+            });
+            check("scanline", scanline);
+            record("scanline", height, flooded, 0, seconds);
+
+#ifndef _WIN32
+            /* Includes the cost of forking the workers, which is part of every flood. */
+            Grid<bool> striped;
+            seconds = bestSecondsFor(repetitions, [&] {
+                striped = floodedRegionsInStripes(terrain, sources, height, kStripedWorkers);
+            });
+            check("striped", striped);
+            record("striped", height, flooded, 0, seconds);
+#endif
+
+            check("batched heights", batched[i]);
+            record("batched heights", height, flooded, 0, batchedSeconds);
+
+            Grid<bool> paddedResult;
+            seconds = bestSecondsFor(repetitions, [&] {
+                paddedResult = floodedRegionsIn(padded, sources, height);
+            });
+            check("padded", paddedResult);
+            record("padded", height, flooded, paddedSeconds, seconds);
+
+            if (quantizes) {
+                Grid<bool> quantizedResult;
+                seconds = bestSecondsFor(repetitions, [&] {
+                    quantizedResult = floodedRegionsIn(quantized, sources, height);
+                });
+                check("quantized", quantizedResult);
+                record("quantized", height, flooded, quantizedSeconds, seconds);
+            }
+
+            seconds = bestSecondsFor(repetitions, [&] {
+                workspace.flood(terrain, sources, height);
+            });
+            check("workspace", workspace.flood(terrain, sources, height));
+            record("workspace", height, flooded, 0, seconds);
+
+            FloodMask threshold;
+            seconds = bestSecondsFor(repetitions, [&] {
+                threshold = floodedMaskAt(floodHeights, height);
+            });
+            check("flood heights", threshold.toGrid());
+            record("flood heights", height, flooded, floodHeightsSeconds, seconds);
+
+            /* The merge tree answers per cell, so its flood is one query for every cell. */
+            Grid<bool> mergeTreeResult(terrain.numRows(), terrain.numCols());
+            seconds = bestSecondsFor(repetitions, [&] {
+                for (int row = 0; row < terrain.numRows(); row++) {
+                    for (int col = 0; col < terrain.numCols(); col++) {
+                        mergeTreeResult[row][col] = mergeTree.isFloodedAt(row, col, height);
+                    }
+                }
+            });
+            check("merge tree", mergeTreeResult);
+            if (mergeTree.floodedAreaAt(height) != flooded) {
+                error("Flood engine merge tree miscounts the flooded area on " + workload.name + ".");
+            }
+            record("merge tree", height, flooded, mergeTreeSeconds, seconds);
+
+            FloodMask compressedResult;
+            seconds = bestSecondsFor(repetitions, [&] {
+                compressedResult = floodedMaskIn(compressed, sources, height);
+            });
+            check("compressed", compressedResult.toGrid());
+            record("compressed", height, flooded, compressedSeconds, seconds);
+
+            Grid<TileStatus> tiles;
+            seconds = bestSecondsFor(repetitions, [&] {
+                tiles = progressiveFlood(pyramid, sources, height);
+            });
+            Grid<bool> pyramidResult(tiles.numRows(), tiles.numCols());
+            for (int row = 0; row < tiles.numRows(); row++) {
+                for (int col = 0; col < tiles.numCols(); col++) {
+                    pyramidResult[row][col] = tiles[row][col] == TileStatus::WET;
+                }
+            }
+            check("pyramid", pyramidResult);
+            record("pyramid", height, flooded, pyramidSeconds, seconds);
+
+            /* Each run's mask has to be closed before the next run recreates its file. */
+            unique_ptr<TiledFloodMask> mask;
+            seconds = bestSecondsFor(repetitions, [&] {
+                mask.reset();
+                mask.reset(new TiledFloodMask(floodedRegionsIn(tiled, sources, height, kTiledMaskFile)));
+            });
+            check("tiled", mask->toGrid());
+            mask.reset();
+            record("tiled", height, flooded, tiledSeconds, seconds);
+        }
+    }
+
+    remove(kTiledTerrainFile.c_str());
+    remove(kTiledMaskFile.c_str());
+    return results;
+}
+
+int64_t peakResidentKilobytes() {
+#ifdef _WIN32
+    return -1;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // Bytes on macOS, kilobytes everywhere else.
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+string toJSON(const FloodBenchmarkResult& result) {
+    ostringstream out;
+    out.precision(9);
+    out << "{\"workload\":\"" << jsonEscape(result.workload) << "\""
+        << ",\"engine\":\""   << jsonEscape(result.engine)   << "\""
+        << ",\"rows\":"            << result.numRows
+        << ",\"cols\":"            << result.numCols
+        << ",\"height\":"          << result.height
+        << ",\"flooded\":"         << result.flooded
+        << ",\"loadSeconds\":"     << result.loadSeconds
+        << ",\"prepareSeconds\":"  << result.prepareSeconds
+        << ",\"floodSeconds\":"    << result.floodSeconds
+        << ",\"cellsPerSecond\":"  << result.cellsPerSecond
+        << "}";
+    return out.str();
+}
+
+string peakResidentJSON() {
+    ostringstream out;
+    out << "{\"wholeRunPeakRSSKB\":" << peakResidentKilobytes() << "}";
+    return out.str();
+}
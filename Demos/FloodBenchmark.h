@@ -0,0 +1,77 @@
+/* Benchmarks for the flood engines, over both real and generated terrains. */
+#ifndef FloodBenchmark_Included
+#define FloodBenchmark_Included
+
+#include "grid.h"
+#include "vector.h"
+#include <cstdint>
+#include <string>
+
+/* Type representing one thing to benchmark: a terrain, its sources, and the water
+ * heights to flood it at.
+ */
+struct FloodWorkload {
+    std::string name;
+    Grid<double> terrain;
+    Vector<GridLocation> sources;
+    Vector<double> heights;
+    double loadSeconds = 0; // Time spent reading or generating the terrain.
+};
+
+/* Generated worst cases. Each comes with water heights chosen to exercise it.
+ *
+ *   fractal:      Rolling terrain built from several octaves of noise, flooded at a range
+ *                 of heights so that the shoreline is long and ragged.
+ *   spiral maze:  A single corridor spiralling in from the corner, so the flood has the
+ *                 longest path possible and the frontier is one cell wide the whole way.
+ *   checkerboard: Alternating low and high cells. Below the high cells, water can't go
+ *                 anywhere (it can't flow diagonally); above them, everything floods.
+ *   all flooded:  Flat terrain entirely under water.
+ *   none flooded: Flat terrain entirely above water, so only the sources flood.
+ */
+FloodWorkload fractalWorkload(int numRows, int numCols, int seed);
+FloodWorkload spiralMazeWorkload(int numRows, int numCols);
+FloodWorkload checkerboardWorkload(int numRows, int numCols);
+FloodWorkload allFloodedWorkload(int numRows, int numCols);
+FloodWorkload noneFloodedWorkload(int numRows, int numCols);
+
+/* All the generated workloads at the given size. */
+Vector<FloodWorkload> syntheticWorkloads(int numRows, int numCols);
+
+/* Result of running one flood engine at one water height. Engines that need to
+ * preprocess the terrain (convert it, precompute flood heights, write it to disk)
+ * report that separately from the time for the flood itself.
+ */
+struct FloodBenchmarkResult {
+    std::string workload;
+    std::string engine;
+    int numRows, numCols;
+    double height;
+    std::int64_t flooded;        // Number of cells under water.
+    double loadSeconds;          // Reading or generating the terrain.
+    double prepareSeconds;       // One-time preprocessing by the engine.
+    double floodSeconds;         // Best of several runs of the flood.
+    double cellsPerSecond;       // Terrain cells divided by floodSeconds.
+};
+
+/* Runs every flood engine over the workload at each of its heights, checking that they
+ * all agree, and returns one result per engine per height. Disagreements are reported
+ * with error().
+ */
+Vector<FloodBenchmarkResult> runFloodBenchmark(const FloodWorkload& workload, int repetitions = 3);
+
+/* Peak resident set size of this process, in kilobytes, or -1 if it can't be found.
+ * This is a peak over the whole life of the process, so it can't be pinned on whichever
+ * engine happened to run last; report it once, for the run as a whole.
+ */
+std::int64_t peakResidentKilobytes();
+
+/* Formats a result as one line of JSON. */
+std::string toJSON(const FloodBenchmarkResult& result);
+
+/* Formats the whole run's peak resident set size as one line of JSON, to follow the
+ * results.
+ */
+std::string peakResidentJSON();
+
+#endif
@@ -0,0 +1,135 @@
+#include "FloodBenchmark.h"
+#include "TerrainLoader.h"
+#include "TerrainFormat.h"
+#include "CompressedTerrain.h"
+#include "DownloadCache.h"
+#include "GUI/MiniGUI.h"
+#include "GUI/Timer.h"
+#include "ginteractors.h"
+#include "filelib.h"
+#include "strlib.h"
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+using namespace std;
+using namespace MiniGUI;
+
+namespace {
+    /* Where to look for terrains, and where to write the results. */
+    const string kBasePath   = "res/terrains/";
+    const string kFileSuffix = ".terrain";
+    const string kOutputFile = "bench_output.txt";
+
+    /* Water heights, in meters, to flood the bundled terrains at. */
+    const Vector<double> kTerrainHeights = { 0.0, 10.0, 100.0 };
+
+    /* Size of the generated terrains. */
+    const int kSyntheticSize = 1000;
+
+    const int kNamePadLength   = 24;
+    const int kEnginePadLength = 14;
+
+    /* Runs every engine over every bundled terrain and every generated one. A summary goes
+     * to the given stream, and the full results go to kOutputFile as one JSON object per line.
+     */
+    void runAllBenchmarks(ostream& out) {
+        ofstream json(kOutputFile);
+        if (!json) error("Cannot open " + kOutputFile + " for writing.");
+
+        auto run = [&](const FloodWorkload& workload) {
+            out << workload.name << " (" << workload.terrain.numRows() << " x "
+                << workload.terrain.numCols() << ")" << endl;
+
+            for (const FloodBenchmarkResult& result: runFloodBenchmark(workload)) {
+                json << toJSON(result) << endl;
+                out << "  " << setw(kEnginePadLength) << left << result.engine
+                    << " height " << setw(8) << result.height
+                    << setw(10) << right << fixed << setprecision(2) << result.floodSeconds * 1000 << " ms  "
+                    << setw(8) << setprecision(1) << result.cellsPerSecond / 1e6 << " Mcells/s"
+                    << defaultfloat << left << endl;
+            }
+        };
+
+        for (const string& file: listDirectory(kBasePath)) {
+            if (!endsWith(file, kFileSuffix) && !endsWith(file, kBinaryTerrainSuffix) &&
+                !endsWith(file, kCompressedTerrainSuffix)) continue;
+
+            out << setw(kNamePadLength) << left << ("Loading " + file + "...") << flush;
+            try {
+                FloodWorkload workload;
+                workload.name = file;
+                workload.heights = kTerrainHeights;
+
+                Timing::Timer timer;
+                timer.start();
+                Terrain terrain = loadTerrainFile(kBasePath + file);
+                timer.stop();
+
+                workload.terrain = terrain.heights;
+                workload.sources = terrain.waterSources;
+                workload.loadSeconds = timer.elapsed();
+                out << " done in " << fixed << setprecision(1) << workload.loadSeconds * 1000
+                    << " ms." << defaultfloat << endl;
+
+                run(workload);
+            } catch (const DownloadError& e) {
+                out << " couldn't download it (error " << e.errorCode() << "); skipping." << endl;
+            }
+        }
+
+        for (const FloodWorkload& workload: syntheticWorkloads(kSyntheticSize, kSyntheticSize)) {
+            run(workload);
+        }
+
+        /* The process's peak memory use only ever goes up, so it says nothing about any
+         * one engine; report it once for the whole run.
+         */
+        json << peakResidentJSON() << endl;
+        int64_t peakKB = peakResidentKilobytes();
+        if (peakKB >= 0) {
+            out << endl << "Peak memory use over the whole run: " << peakKB / 1024 << " MB." << endl;
+        }
+
+        out << endl << "Results written to " << kOutputFile << "." << endl;
+    }
+
+    class FloodBenchmarkGUI: public ProblemHandler {
+    public:
+        FloodBenchmarkGUI(GWindow& window);
+
+        void actionPerformed(GObservable* source) override;
+
+    private:
+        Temporary<GColorConsole> console;
+        Temporary<GButton>       runButton;
+    };
+
+    FloodBenchmarkGUI::FloodBenchmarkGUI(GWindow& window) : ProblemHandler(window) {
+        console   = make_temporary<GColorConsole>(window, "CENTER");
+        runButton = make_temporary<GButton>(window, "SOUTH", "Run Benchmarks");
+    }
+
+    void FloodBenchmarkGUI::actionPerformed(GObservable* source) {
+        if (source == runButton) {
+            runButton->setEnabled(false);
+            setDemoOptionsEnabled(false);
+
+            try {
+                runAllBenchmarks(*console);
+            } catch (const exception& e) {
+                *console << endl << "Error: " << e.what() << endl;
+            }
+
+            setDemoOptionsEnabled(true);
+            runButton->setEnabled(true);
+        }
+    }
+}
+
+GRAPHICS_HANDLER("Flood Benchmarks", GWindow& window) {
+    return make_shared<FloodBenchmarkGUI>(window);
+}
+
+CONSOLE_HANDLER("Flood Benchmarks") {
+    runAllBenchmarks(cout);
+}
@@ -1,12 +1,24 @@
 RUN_TESTS_MENU_OPTION()
 
 MENU_ORDER("RosettaStoneGUI.cpp",
-           "RisingTidesGUI.cpp")
+           "RisingTidesGUI.cpp",
+           "FloodBenchmarkGUI.cpp")
 
 WINDOW_TITLE("Fun With Collections")
 
 TEST_ORDER("RosettaStone.cpp",
-           "RisingTides.cpp")
+           "RisingTides.cpp",
+           "FloodMask.cpp",
+           "TiledFlood.cpp",
+           "MergeTree.cpp",
+           "FloodSession.cpp",
+           "TerrainPyramid.cpp",
+           "FloodWorkspace.cpp",
+           "StripedFlood.cpp",
+           "CompressedTerrain.cpp",
+           "TerrainLoader.cpp",
+           "TerrainFormat.cpp",
+           "TerrainCache.cpp")
 
 TEST_BARRIER("RosettaStoneGUI.cpp", "RosettaStone.cpp")
 TEST_BARRIER("RisingTidesGUI.cpp",  "RisingTides.cpp")
@@ -1,15 +1,23 @@
 #include "RisingTides.h"
+#include "FloodSession.h"
+#include "TerrainPyramid.h"
 #include "GUI/MiniGUI.h"
 #include "GUI/Color.h"
 #include "DownloadCache.h"
+#include "TerrainLoader.h"
+#include "TerrainCache.h"
+#include "TerrainFormat.h"
+#include "CompressedTerrain.h"
 #include "gwindow.h"
 #include "ginteractors.h"
 #include "gobjects.h"
 #include "gcontainer.h"
 #include "filelib.h"
 #include "gthread.h"
+#include "gtimer.h"
 #include <istream>
 #include <fstream>
+#include <memory>
 #include <vector>
 #include <unordered_set>
 using namespace std;
@@ -27,14 +35,19 @@ namespace {
     const string kFloodButtonText    = "Go!";
 
     const string kRenderingText      = "Rendering the result...";
-    const string kDownloadingMessage = "Downloading the terrain from Stanford's servers...";
     const string kBadNumberText      = "Please enter a real number.";
     const string kRunningCodeText    = " (running your code...)";
 
-    const string kLoadingText        = "Loading the landscape...";
+    const string kSurveyingText      = "Surveying the landscape...";
+    const string kPreviewText        = "Previewing the flood at 1/";
+    const string kLoadingText        = "Loading the landscape... ";
+    const string kCancelledText      = "Stopped loading ";
 
-    /* Error message to display when failing to read a terrain. */
-    const string kMalformedDataFileMessage = "Oops! Something went wrong reading that data file. If this is a terrain file you designed, double-check the syntax of the file. Otherwise, this isn't your fault.";
+    /* How often to check on a terrain that's loading, in milliseconds. */
+    const double kLoadPollInterval = 100;
+
+    /* A terrain that's loading is redrawn each time about this fraction more of it is in. */
+    const double kLoadRedrawFraction = 0.1;
 
     /* Where to look for files. */
     const string kBasePath = "res/terrains/";
@@ -115,14 +128,34 @@ namespace {
      * way to push the image to the backend, but doesn't support resizing (TODO: validate this).
      * We therefore dump it to a file and reload it later as a GImage, which does support resizing.
      */
-    void renderToFile(const Grid<double>& heights, const Grid<bool>& underwater) {
-        double lowest  = *min_element(heights.begin(), heights.end());
-        double highest = *max_element(heights.begin(), heights.end());
+    void renderToFile(const Grid<double>& heights, const FloodMask& underwater) {
+        double lowest  = numeric_limits<double>::infinity();
+        double highest = -numeric_limits<double>::infinity();
+        for (double height: heights) {
+            lowest  = fmin(lowest,  height);
+            highest = fmax(highest, height);
+        }
 
+        /* The mask is scanned a word (64 cells) at a time so that runs of open water can
+         * be filled in without looking at the individual cells.
+         */
         Grid<int> pixels(heights.numRows(), heights.numCols());
         for (int row = 0; row < heights.numRows(); row++) {
-            for (int col = 0; col < heights.numCols(); col++) {
-                pixels[row][col] = colorFor(heights[row][col], underwater[row][col], lowest, highest);
+            const uint64_t* words = underwater.rowWords(row);
+            for (int word = 0; word < underwater.wordsPerRow(); word++) {
+                int firstCol = word * 64;
+                int lastCol  = min(firstCol + 64, heights.numCols());
+
+                if (words[word] == ~uint64_t(0)) {
+                    for (int col = firstCol; col < lastCol; col++) {
+                        pixels[row][col] = kUnderwaterColor;
+                    }
+                } else {
+                    for (int col = firstCol; col < lastCol; col++) {
+                        bool isUnderwater = (words[word] >> (col - firstCol)) & 1;
+                        pixels[row][col] = colorFor(heights[row][col], isUnderwater, lowest, highest);
+                    }
+                }
             }
         }
 
@@ -133,99 +166,103 @@ namespace {
         });
     }
 
-    /* Generates a semi-humorous message to pass the time as everything computes. */
-    string floodMessage() {
-        switch (rand() % 4) {
-            case 0:  return "Forecasting the flood";
-            case 1:  return "Watering the world";
-            case 2:  return "Deploying the deluge";
-            default: return "Simulating the surge";
-        }
-    }
-
-    /* Type: Terrain
-     * ----------------------------------------------------------------------------------
-     * Type representing a terrain as a Grid<double> subdivided into individual cells,
-     * each with an associated height, along with a list of sources from which the water
-     * floods out.
-     *
-     * The GridLocation type is a simple struct that contains just a row and a column.
-     * It's used as a way of tracking a position in the Grid as a single object.
+    /* Draws the first rowsLoaded rows of a terrain that's still loading to the output file.
+     * The rows that aren't in yet are left the background color, and the colors are scaled
+     * to the rows that are, so they can shift a little as more come in.
      */
-    struct Terrain {
-        Grid<double> heights;              // Height of each point on the map, in meters.
-        Vector<GridLocation> waterSources; // Which locations, if any, are water sources.
-    };
-
-    /* Loads a terrain from a data file. */
-    Terrain loadTerrain(istream& input, GLabel* statusLine) {
-        /* The first line of the input is either a URL to download or the string "local."
-         * If it's a remote download, we need to fetch the file first.
-         */
-        string url;
-        if (!getline(input, url)) {
-            error(kMalformedDataFileMessage);
+    void renderRowsToFile(const Grid<double>& heights, int rowsLoaded) {
+        double lowest  = numeric_limits<double>::infinity();
+        double highest = -numeric_limits<double>::infinity();
+        for (int row = 0; row < rowsLoaded; row++) {
+            for (int col = 0; col < heights.numCols(); col++) {
+                lowest  = fmin(lowest,  heights[row][col]);
+                highest = fmax(highest, heights[row][col]);
+            }
         }
 
-        if (url != "local") {
-            auto data = webContentsOf(url, ".terrain", [&] (DownloadStatus status) {
-                if (status == DownloadStatus::DOWNLOADING) {
-                    statusLine->setText(kDownloadingMessage);
-                } else if (status == DownloadStatus::FINISHED) {
-                    statusLine->setText(" ");
-                }
-            });
-
-            /* Go download that data instead. */
-            return loadTerrain(*data, statusLine);
+        Grid<int> pixels(heights.numRows(), heights.numCols(), kBackgroundColor.toRGB());
+        for (int row = 0; row < rowsLoaded; row++) {
+            for (int col = 0; col < heights.numCols(); col++) {
+                double height = heights[row][col];
+                pixels[row][col] = colorFor(isnan(height)? lowest : height, false, lowest, highest);
+            }
         }
 
-        statusLine->setText(kLoadingText);
-
-        int numRows, numCols;
-        if (input >> numRows >> numCols, !input) {
-            error(kMalformedDataFileMessage);
-        }
+        GThread::runOnQtGuiThread([&] {
+            GBufferedImage image;
+            image.fromGrid(pixels);
+            image.save(kOutputFile);
+        });
+    }
 
-        int numSources;
-        if (input >> numSources, !input) {
-            error(kMalformedDataFileMessage);
-        }
+    /* Averages two pixel colors, channel by channel. */
+    int blend(int lhs, int rhs) {
+        return GBufferedImage::createRgbPixel((((lhs >> 16) & 0xFF) + ((rhs >> 16) & 0xFF)) / 2,
+                                              (((lhs >>  8) & 0xFF) + ((rhs >>  8) & 0xFF)) / 2,
+                                              (( lhs        & 0xFF) + ( rhs        & 0xFF)) / 2);
+    }
 
-        /* Read the flooding sources. */
-        Terrain result;
-        for (int i = 0; i < numSources; i++) {
-            int row, col;
-            if (input >> row >> col, !input) {
-                error(kMalformedDataFileMessage);
+    /* Draws one level of a progressive flood to the output file, one pixel per tile. Land is
+     * colored by the lowest cell in the tile, and tiles that might or might not be flooded are
+     * drawn halfway between land and water.
+     */
+    void renderLevelToFile(const TerrainPyramid& pyramid, int level, const Grid<TileStatus>& tiles) {
+        double lowest  = numeric_limits<double>::infinity();
+        double highest = -numeric_limits<double>::infinity();
+        for (int row = 0; row < tiles.numRows(); row++) {
+            for (int col = 0; col < tiles.numCols(); col++) {
+                lowest  = fmin(lowest,  pyramid.lowest(level, row, col));
+                highest = fmax(highest, pyramid.lowest(level, row, col));
             }
-
-            result.waterSources.add({ row, col });
         }
 
-        /* Read the height data. */
-        result.heights.resize(numRows, numCols);
-        for (int row = 0; row < result.heights.numRows(); row++) {
-            for (int col = 0; col < result.heights.numCols(); col++) {
-                if (input >> result.heights[row][col], !input) {
-                    error(kMalformedDataFileMessage);
+        Grid<int> pixels(tiles.numRows(), tiles.numCols());
+        for (int row = 0; row < tiles.numRows(); row++) {
+            for (int col = 0; col < tiles.numCols(); col++) {
+                double height = pyramid.lowest(level, row, col);
+                int land = colorFor(isnan(height)? lowest : height, false, lowest, highest);
+
+                if (tiles[row][col] == TileStatus::WET) {
+                    pixels[row][col] = kUnderwaterColor;
+                } else if (tiles[row][col] == TileStatus::MIXED) {
+                    pixels[row][col] = blend(land, kUnderwaterColor);
+                } else {
+                    pixels[row][col] = land;
                 }
             }
         }
 
-        char leftover;
-        if (input >> leftover) {
-            error(kMalformedDataFileMessage);
+        GThread::runOnQtGuiThread([&] {
+            GBufferedImage image;
+            image.fromGrid(pixels);
+            image.save(kOutputFile);
+        });
+    }
+
+    /* Generates a semi-humorous message to pass the time as everything computes. */
+    string floodMessage() {
+        switch (rand() % 4) {
+            case 0:  return "Forecasting the flood";
+            case 1:  return "Watering the world";
+            case 2:  return "Deploying the deluge";
+            default: return "Simulating the surge";
         }
+    }
 
-        return result;
+    /* Terrains that have been loaded before. It's shared by every FindWaterLevel, so
+     * coming back to this demo from another one doesn't start it over.
+     */
+    TerrainCache& terrainCache() {
+        static TerrainCache cache;
+        return cache;
     }
 
     /* Returns all sample problems found in the example directory. */
     vector<string> sampleProblems() {
         vector<string> result;
         for (const auto& file: listDirectory(kBasePath)) {
-            if (endsWith(file, kFileSuffix)) {
+            if (endsWith(file, kFileSuffix) || endsWith(file, kBinaryTerrainSuffix) ||
+                endsWith(file, kCompressedTerrainSuffix)) {
                 result.push_back(file);
             }
         }
@@ -243,9 +280,17 @@ namespace {
         /* File extension. */
         static std::string fileExtension();
 
+        /* Stops checking on loads. The timer itself is leaked, since the library has a race
+         * between stopping a timer and destroying it.
+         */
+        ~FindWaterLevel();
+
         /* Respond to action events. */
         void actionPerformed(GObservable* source) override;
 
+        /* Check on the terrain that's loading. */
+        void timerFired() override;
+
     protected:
         /* Draw the current state of things. */
         void repaint() override;
@@ -270,18 +315,43 @@ namespace {
         /* Status reporting. */
         GLabel*     statusLine;
 
-        /* The floodplain and what's currently under water. */
-        Terrain plain;
-        Grid<bool> underwater;
+        /* The floodplain, and what's currently under water. The session is set up once
+         * per terrain, and holds the only copy of its heights. After that, changing the
+         * water height only touches the cells that flood or dry out.
+         */
+        FloodSession flood;
 
         /* Name of the current terrain. */
         string currTerrain = kNotSelected;
 
+        /* The terrain being loaded in the background, if any, and its name. While it loads,
+         * the timer goes off every so often to show how far along it is.
+         */
+        unique_ptr<TerrainLoad> loading;
+        string loadingTerrain;
+        bool clearHeightWhenLoaded = false;
+        GTimer* loadTimer;
+
+        /* How many rows of the loading terrain are in the output file. */
+        int rowsRendered = 0;
+
         /* Runs a flood simulation. */
         void runFlood(double height);
 
-        /* Sets which terrain is currently active. */
+        /* Shows the flood at each coarse level of the pyramid in turn. */
+        void previewFlood(const TerrainPyramid& pyramid, const Vector<GridLocation>& sources, double height);
+
+        /* Sets which terrain is currently active. Terrains load in the background, and
+         * become active once finishLoading runs.
+         */
         void setActiveTerrain(const string& terrainFile, bool clearHeight);
+        void finishLoading();
+
+        /* Drops the terrain that's loading, if any. */
+        void cancelLoading();
+
+        /* Turns the controls that need a loaded terrain on or off. */
+        void setFloodControlsEnabled(bool enabled);
     };
 
     FindWaterLevel::FindWaterLevel(GWindow& window) : ProblemHandler(window) {
@@ -311,29 +381,48 @@ namespace {
 
         container= Temporary<GContainer>(rawContainer, window, "SOUTH");
 
+        loadTimer = new GTimer(kLoadPollInterval);
+
         setActiveTerrain(kNotSelected, true);
     }
 
+    FindWaterLevel::~FindWaterLevel() {
+        loadTimer->stop();
+    }
+
     /* Runs a flood starting from the given height. */
     void FindWaterLevel::runFlood(double height) {
         statusLine->setText(floodMessage() + kRunningCodeText);
-        underwater = floodedRegionsIn(plain.heights, plain.waterSources, height);
+        FloodStats stats;
+        flood.setHeight(height, stats);
 
         /* Stash the rendered image to disk. */
         statusLine->setText(kRenderingText);
-        renderToFile(plain.heights, underwater);
-        statusLine->setText(" ");
+        renderToFile(flood.terrain(), flood.flooded());
+        statusLine->setText(to_string(flood.numFlooded()) + " cells under water. " + toString(stats));
 
         requestRepaint();
     }
 
+    /* The finest level is skipped, since the full flood is about to replace it anyway. */
+    void FindWaterLevel::previewFlood(const TerrainPyramid& pyramid, const Vector<GridLocation>& sources, double height) {
+        if (pyramid.numLevels() < 2) return;
+
+        progressiveFlood(pyramid, sources, height, [&](int level, const Grid<TileStatus>& tiles) {
+            statusLine->setText(kPreviewText + to_string(1 << level) + " resolution...");
+            renderLevelToFile(pyramid, level, tiles);
+            requestRepaint();
+            draw();
+        }, 1);
+    }
+
     /* Renders the result of the flood. */
     void FindWaterLevel::repaint() {
         /* Clear the display. */
         clearDisplay(window(), kBackgroundColor);
 
-        /* If the world is empty, don't draw anything. */
-        if (plain.heights.isEmpty()) return;
+        /* If there's no terrain and nothing has loaded yet, don't draw anything. */
+        if (currTerrain == kNotSelected && rowsRendered == 0) return;
 
         GImage image(kOutputFile);
 
@@ -360,63 +449,148 @@ namespace {
     }
 
     void FindWaterLevel::actionPerformed(GObservable* source) {
-        if (source == heightField || source == solveButton) {
+        if (source == terrainChooser) {
+            /* Picking something else means the terrain that's loading isn't wanted. */
+            if (loading && terrainChooser->getSelectedItem() != loadingTerrain) {
+                cancelLoading();
+            }
+        } else if (source == heightField || source == solveButton) {
             double height;
             bool heightValid = true;
 
             try {
                 height = stringToReal(heightField->getText());
+                if (isnan(height)) error("Water height can't be NaN.");
             } catch (const exception& e) {
                 statusLine->setText(kBadNumberText);
                 heightValid = false;
             }
 
             if (heightValid) {
-                container->setEnabled(false);
                 if (currTerrain != terrainChooser->getSelectedItem()) {
                     setActiveTerrain(terrainChooser->getSelectedItem(), false);
                 } else if (terrainChooser->getSelectedItem() != kNotSelected) {
+                    container->setEnabled(false);
                     runFlood(height);
+                    container->setEnabled(true);
                 }
-                container->setEnabled(true);
             }
         } else if (source == loadButton) {
             setActiveTerrain(terrainChooser->getSelectedItem(), true);
         }
     }
 
+    /* Only the terrain chooser and the load button stay usable while a terrain loads, so
+     * that another terrain can be picked instead.
+     */
+    void FindWaterLevel::setFloodControlsEnabled(bool enabled) {
+        heightField->setEnabled(enabled);
+        solveButton->setEnabled(enabled);
+        setDemoOptionsEnabled(enabled);
+    }
+
     void FindWaterLevel::setActiveTerrain(const string& terrainFile, bool clearHeight) {
-        if (terrainFile == kNotSelected) {
-            plain.heights.clear();
-            plain.waterSources.clear();
-            currTerrain = kNotSelected;
-        } else {
-            setDemoOptionsEnabled(false);
-            container->setEnabled(false);
-            try {
-                ifstream input(kBasePath + terrainFile);
-                if (!input) error("Cannot open file " + kBasePath + terrainFile);
-                plain = loadTerrain(input, statusLine);
-                if (clearHeight) heightField->setText("0.0");
-                currTerrain = terrainFile;
+        cancelLoading();
 
-                double height = 0.0;
-                try {
-                    height = stringToReal(heightField->getText());
-                } catch (const exception &) {
+        flood = FloodSession();
+        currTerrain = kNotSelected;
+
+        if (terrainFile != kNotSelected) {
+            setFloodControlsEnabled(false);
+            statusLine->setText(kLoadingText + "0%");
+
+            loading.reset(new TerrainLoad(kBasePath + terrainFile, &terrainCache()));
+            loadingTerrain = terrainFile;
+            clearHeightWhenLoaded = clearHeight;
+            loadTimer->start();
+        }
+        requestRepaint();
+    }
+
+    void FindWaterLevel::cancelLoading() {
+        if (!loading) return;
+
+        loadTimer->stop();
+        loading.reset();
+        rowsRendered = 0;
+
+        statusLine->setText(kCancelledText + loadingTerrain + ".");
+        setFloodControlsEnabled(true);
+        requestRepaint();
+    }
+
+    /* Shows how far along the load is, and draws what's in so far every time a good chunk
+     * more of it arrives.
+     */
+    void FindWaterLevel::timerFired() {
+        if (!loading) return;
+        if (loading->isDone()) {
+            finishLoading();
+            return;
+        }
+
+        if (!loading->headerLoaded()) {
+            statusLine->setText(loading->status());
+            return;
+        }
+        statusLine->setText(kLoadingText + to_string(int(loading->progress() * 100)) + "%");
+
+        const Grid<double>& heights = loading->terrain().heights;
+        int rowsLoaded = loading->rowsLoaded();
+        int redrawRows = max(1, int(heights.numRows() * kLoadRedrawFraction));
+        if (heights.numCols() > 0 && rowsLoaded - rowsRendered >= redrawRows) {
+            renderRowsToFile(heights, rowsLoaded);
+            rowsRendered = rowsLoaded;
+            requestRepaint();
+        }
+    }
+
+    void FindWaterLevel::finishLoading() {
+        loadTimer->stop();
+        unique_ptr<TerrainLoad> loaded = move(loading);
+        rowsRendered = 0;
+
+        /* Whatever stopped the load (a failed download, a malformed or damaged file) comes
+         * back out of result(), and leaves us with no terrain selected.
+         */
+        bool failed = true;
+        string problem;
+        container->setEnabled(false);
+        try {
+            Terrain plain = loaded->result();
+
+            if (clearHeightWhenLoaded) heightField->setText("0.0");
+            currTerrain = loadingTerrain;
+
+            double height = 0.0;
+            try {
+                height = stringToReal(heightField->getText());
+            } catch (const exception &) {
 
-                }
-                runFlood(height);
-            } catch (const DownloadError& e) {
-                if (e.errorCode() < 0) {
-                    statusLine->setText(kVisualizationErrorString);
-                } else {
-                    statusLine->setText(kRemoteDownloadErrorString);
-                }
             }
-            container->setEnabled(true);
-            setDemoOptionsEnabled(true);
+            if (isnan(height)) height = 0.0;
+
+            previewFlood(TerrainPyramid(plain.heights), plain.waterSources, height);
+
+            statusLine->setText(kSurveyingText);
+            flood = FloodSession(move(plain.heights), plain.waterSources, height);
+
+            runFlood(height);
+            failed = false;
+        } catch (const DownloadError& e) {
+            problem = e.errorCode() < 0? kVisualizationErrorString : kRemoteDownloadErrorString;
+        } catch (const exception& e) {
+            problem = e.what();
+        }
+
+        if (failed) {
+            flood = FloodSession();
+            currTerrain = kNotSelected;
+            statusLine->setText(problem);
+            requestRepaint();
         }
+        container->setEnabled(true);
+        setFloodControlsEnabled(true);
     }
 }
 
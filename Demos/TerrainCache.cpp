@@ -0,0 +1,310 @@
+#include "TerrainCache.h"
+#include "TerrainFormat.h"
+#include "MappedFile.h"
+#include "error.h"
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+using namespace std;
+
+namespace {
+    /* Roughly how much memory a terrain takes up. */
+    size_t bytesFor(const Terrain& terrain) {
+        return sizeof(double) * terrain.heights.numRows() * terrain.heights.numCols() +
+               sizeof(GridLocation) * terrain.waterSources.size() +
+               sizeof(Terrain);
+    }
+}
+
+TerrainCache::TerrainCache(size_t byteBudget, const string& directory)
+    : budget(byteBudget), directory(directory) {
+
+}
+
+Terrain TerrainCache::load(const string& filename, TerrainStatusCallback callback) {
+    uint64_t key = keyFor(filename);
+
+    Terrain result;
+    if (lookup(key, result)) return result;
+
+    result = loadTerrainFile(filename, callback);
+    insert(key, result, isTextTerrainFile(filename));
+    return result;
+}
+
+uint64_t TerrainCache::keyFor(const string& filename) {
+    uint64_t key = 0;
+    try {
+        MappedFile file(filename);
+        key = terrainHashOf(file.data(), file.size());
+    } catch (const runtime_error&) {
+        error("Cannot open file " + filename);
+    }
+    return key;
+}
+
+bool TerrainCache::lookup(uint64_t key, Terrain& result) {
+    {
+        lock_guard<mutex> guard(lock);
+        auto entry = byKey.find(key);
+        if (entry != byKey.end()) {
+            entries.splice(entries.begin(), entries, entry->second);
+            result = entry->second->terrain;
+            return true;
+        }
+    }
+
+    /* Anything wrong with the file on disk is the same as not having it. */
+    string filename = diskFileFor(key);
+    if (!ifstream(filename, ios::binary)) return false;
+    try {
+        result = loadTerrainFile(filename);
+    } catch (const ErrorException&) {
+        remove(filename.c_str());
+        return false;
+    }
+
+    remember(key, result);
+    return true;
+}
+
+void TerrainCache::insert(uint64_t key, const Terrain& terrain, bool saveToDisk) {
+    remember(key, terrain);
+    if (!saveToDisk) return;
+
+    string filename = diskFileFor(key);
+    if (ifstream(filename, ios::binary)) return;
+
+    vector<int32_t> sources;
+    for (GridLocation source: terrain.waterSources) {
+        sources.push_back(source.row);
+        sources.push_back(source.col);
+    }
+    const double* heights = terrain.heights.isEmpty()? nullptr : &terrain.heights[0][0];
+
+    /* Written under another name and then renamed, so that another load never sees a
+     * file that's only partly there.
+     */
+    string partial = filename + ".partial";
+    try {
+        writeBinaryTerrain(partial, terrain.heights.numRows(), terrain.heights.numCols(), sources, heights);
+    } catch (const runtime_error&) {
+        remove(partial.c_str());
+        return;
+    }
+    if (rename(partial.c_str(), filename.c_str()) != 0) {
+        remove(partial.c_str());
+    }
+}
+
+size_t TerrainCache::bytesUsed() const {
+    lock_guard<mutex> guard(lock);
+    return used;
+}
+
+size_t TerrainCache::byteBudget() const {
+    lock_guard<mutex> guard(lock);
+    return budget;
+}
+
+void TerrainCache::setByteBudget(size_t newBudget) {
+    lock_guard<mutex> guard(lock);
+    budget = newBudget;
+    shrinkTo(budget);
+}
+
+int TerrainCache::size() const {
+    lock_guard<mutex> guard(lock);
+    return byKey.size();
+}
+
+void TerrainCache::clear() {
+    lock_guard<mutex> guard(lock);
+    shrinkTo(0);
+}
+
+string TerrainCache::diskFileFor(uint64_t key) const {
+    ostringstream name;
+    name << directory << hex << setw(16) << setfill('0') << key << kBinaryTerrainSuffix;
+    return name.str();
+}
+
+/* Terrains too large for the whole budget aren't kept at all, rather than pushing
+ * everything else out and then being dropped themselves.
+ */
+void TerrainCache::remember(uint64_t key, const Terrain& terrain) {
+    size_t bytes = bytesFor(terrain);
+
+    lock_guard<mutex> guard(lock);
+    auto entry = byKey.find(key);
+    if (entry != byKey.end()) {
+        entries.splice(entries.begin(), entries, entry->second);
+        return;
+    }
+    if (bytes > budget) return;
+
+    entries.push_front({ key, terrain, bytes });
+    byKey[key] = entries.begin();
+    used += bytes;
+    shrinkTo(budget);
+}
+
+/* Drops the least recently used terrains until they fit. The lock must be held. */
+void TerrainCache::shrinkTo(size_t limit) {
+    while (used > limit) {
+        used -= entries.back().bytes;
+        byKey.erase(entries.back().key);
+        entries.pop_back();
+    }
+}
+
+
+/***** Test Cases Below This Point *****/
+#include "GUI/SimpleTest.h"
+#include <iterator>
+
+namespace {
+    /* The cache's files all start with this, rather than going in a directory of their own. */
+    const string kTestCacheDirectory = "TerrainCacheTest-";
+    const string kTestTerrainFile    = "TerrainCacheTest.terrain";
+
+    Terrain flatTerrain(int numRows, int numCols, double height) {
+        return { Grid<double>(numRows, numCols, height), {} };
+    }
+
+    /* Where the test cache keeps the given key on disk. */
+    string testCacheFileFor(uint64_t key) {
+        ostringstream name;
+        name << kTestCacheDirectory << hex << setw(16) << setfill('0') << key << kBinaryTerrainSuffix;
+        return name.str();
+    }
+
+    bool holds(TerrainCache& cache, uint64_t key, double height) {
+        Terrain found;
+        return cache.lookup(key, found) && found.heights[0][0] == height;
+    }
+}
+
+STUDENT_TEST("TerrainCache drops the least recently used terrains first.") {
+    size_t bytes = bytesFor(flatTerrain(10, 10, 0));
+    TerrainCache cache(3 * bytes, kTestCacheDirectory);
+
+    cache.insert(1, flatTerrain(10, 10, 1), false);
+    cache.insert(2, flatTerrain(10, 10, 2), false);
+    cache.insert(3, flatTerrain(10, 10, 3), false);
+    EXPECT_EQUAL(cache.size(), 3);
+    EXPECT_EQUAL(cache.bytesUsed(), 3 * bytes);
+
+    /* Looking up 1 makes 2 the least recently used. */
+    EXPECT(holds(cache, 1, 1));
+    cache.insert(4, flatTerrain(10, 10, 4), false);
+    EXPECT_EQUAL(cache.size(), 3);
+    EXPECT(!holds(cache, 2, 2));
+
+    /* Inserting a terrain that's already there counts as using it, so 3 goes next. */
+    cache.insert(4, flatTerrain(10, 10, 4), false);
+    cache.insert(1, flatTerrain(10, 10, 1), false);
+    cache.insert(5, flatTerrain(10, 10, 5), false);
+    EXPECT(!holds(cache, 3, 3));
+    EXPECT(holds(cache, 1, 1));
+    EXPECT(holds(cache, 4, 4));
+    EXPECT(holds(cache, 5, 5));
+    EXPECT_EQUAL(cache.bytesUsed(), 3 * bytes);
+
+    cache.clear();
+    EXPECT_EQUAL(cache.size(), 0);
+    EXPECT_EQUAL(cache.bytesUsed(), 0);
+}
+
+STUDENT_TEST("TerrainCache keeps to its byte budget.") {
+    size_t bytes = bytesFor(flatTerrain(10, 10, 0));
+    TerrainCache cache(3 * bytes, kTestCacheDirectory);
+    for (int key = 1; key <= 3; key++) {
+        cache.insert(key, flatTerrain(10, 10, key), false);
+    }
+    EXPECT(holds(cache, 1, 1));
+
+    /* Lowering the budget drops terrains right away, oldest first. */
+    cache.setByteBudget(2 * bytes);
+    EXPECT_EQUAL(cache.byteBudget(), 2 * bytes);
+    EXPECT_EQUAL(cache.size(), 2);
+    EXPECT(!holds(cache, 2, 2));
+    EXPECT(holds(cache, 3, 3));
+    EXPECT(holds(cache, 1, 1));
+
+    /* Raising it again doesn't bring anything back. */
+    cache.setByteBudget(10 * bytes);
+    EXPECT_EQUAL(cache.size(), 2);
+
+    cache.setByteBudget(0);
+    EXPECT_EQUAL(cache.size(), 0);
+    EXPECT_EQUAL(cache.bytesUsed(), 0);
+}
+
+STUDENT_TEST("TerrainCache skips terrains bigger than its whole budget.") {
+    size_t bytes = bytesFor(flatTerrain(10, 10, 0));
+    TerrainCache cache(2 * bytes, kTestCacheDirectory);
+    cache.insert(1, flatTerrain(10, 10, 1), false);
+    cache.insert(2, flatTerrain(10, 10, 2), false);
+
+    /* Too big to keep, so it doesn't push anything else out either. */
+    cache.insert(3, flatTerrain(30, 10, 3), false);
+    EXPECT_EQUAL(cache.size(), 2);
+    EXPECT(!holds(cache, 3, 3));
+    EXPECT(holds(cache, 1, 1));
+    EXPECT(holds(cache, 2, 2));
+
+    /* One with twice the cells still fits, but only on its own. */
+    cache.insert(4, flatTerrain(20, 10, 4), false);
+    EXPECT_EQUAL(cache.size(), 1);
+    EXPECT(holds(cache, 4, 4));
+}
+
+STUDENT_TEST("TerrainCache throws away damaged files on disk and rebuilds them.") {
+    ofstream(kTestTerrainFile) << "local\n2 3 1 0 0\n1 2 3\n4 5 6\n";
+    uint64_t key = TerrainCache::keyFor(kTestTerrainFile);
+    string cacheFile = testCacheFileFor(key);
+    remove(cacheFile.c_str());
+
+    /* Loading a text terrain saves it to disk. */
+    Terrain expected = loadTerrainFile(kTestTerrainFile);
+    {
+        TerrainCache cache(kDefaultTerrainCacheBudget, kTestCacheDirectory);
+        EXPECT_EQUAL(cache.load(kTestTerrainFile).heights, expected.heights);
+    }
+    EXPECT(bool(ifstream(cacheFile, ios::binary)));
+
+    /* A fresh cache finds it there. */
+    {
+        TerrainCache cache(kDefaultTerrainCacheBudget, kTestCacheDirectory);
+        Terrain found;
+        EXPECT(cache.lookup(key, found));
+        EXPECT_EQUAL(found.heights, expected.heights);
+        EXPECT_EQUAL(found.waterSources, expected.waterSources);
+    }
+
+    /* Flip a height. The damaged file is a miss, and is deleted. */
+    string bytes;
+    {
+        ifstream in(cacheFile, ios::binary);
+        bytes.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+    bytes[bytes.size() - 3] ^= 0x40;
+    ofstream(cacheFile, ios::binary) << bytes;
+    {
+        TerrainCache cache(kDefaultTerrainCacheBudget, kTestCacheDirectory);
+        Terrain found;
+        EXPECT(!cache.lookup(key, found));
+        EXPECT(!ifstream(cacheFile, ios::binary));
+
+        /* Loading the terrain again writes a good copy. */
+        EXPECT_EQUAL(cache.load(kTestTerrainFile).heights, expected.heights);
+    }
+    EXPECT_EQUAL(loadTerrainFile(cacheFile).heights, expected.heights);
+
+    remove(cacheFile.c_str());
+    remove(kTestTerrainFile.c_str());
+}
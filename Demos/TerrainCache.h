@@ -0,0 +1,86 @@
+/* Caches of parsed terrains, so that going back to a terrain doesn't mean reading it again. */
+#ifndef TerrainCache_Included
+#define TerrainCache_Included
+
+#include "TerrainLoader.h"
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/* Default amount of memory the in-memory cache may use, in bytes. */
+const std::size_t kDefaultTerrainCacheBudget = std::size_t(256) << 20;
+
+/* Type: TerrainCache
+ * ----------------------------------------------------------------------------------
+ * Two levels of cache for parsed terrains, both keyed by a hash of the terrain file's
+ * contents, so that a file that changes is never mistaken for its old self:
+ *
+ *   - In memory, terrains are kept up to a byte budget, and the least recently used
+ *     ones are dropped to make room.
+ *   - On disk, text terrains are saved in the binary .terrainb format, which loads with
+ *     no parsing at all. The key is the hash of the file as it is on disk, so a terrain
+ *     file that just names a URL is found without going near the network or the
+ *     download cache.
+ *
+ * The disk cache is best-effort: files that can't be written are skipped, and files
+ * that turn out to be damaged are thrown away and rebuilt. All of the member functions
+ * may be called from any thread.
+ */
+class TerrainCache {
+public:
+    explicit TerrainCache(std::size_t byteBudget = kDefaultTerrainCacheBudget,
+                          const std::string& directory = "Downloads/");
+
+    /* Same as loadTerrainFile, but through the cache. */
+    Terrain load(const std::string& filename, TerrainStatusCallback callback = nullptr);
+
+    /* The key for a terrain file: the hash of its contents. Files that can't be opened
+     * are reported with error().
+     */
+    static std::uint64_t keyFor(const std::string& filename);
+
+    /* Looks for a terrain in memory, then on disk. Returns whether it was found. */
+    bool lookup(std::uint64_t key, Terrain& result);
+
+    /* Adds a terrain that was just parsed, and saves it to disk if asked. */
+    void insert(std::uint64_t key, const Terrain& terrain, bool saveToDisk);
+
+    /* Memory used by the terrains held in memory, and the most they may use. Lowering
+     * the budget drops terrains right away.
+     */
+    std::size_t bytesUsed() const;
+    std::size_t byteBudget() const;
+    void setByteBudget(std::size_t budget);
+
+    /* How many terrains are held in memory. */
+    int size() const;
+
+    /* Empties the in-memory cache. The files on disk are left alone. */
+    void clear();
+
+private:
+    struct Entry {
+        std::uint64_t key;
+        Terrain terrain;
+        std::size_t bytes;
+    };
+
+    /* Most recently used first. */
+    std::list<Entry> entries;
+    std::unordered_map<std::uint64_t, std::list<Entry>::iterator> byKey;
+
+    std::size_t budget;
+    std::size_t used = 0;
+    std::string directory;
+
+    mutable std::mutex lock;
+
+    std::string diskFileFor(std::uint64_t key) const;
+    void remember(std::uint64_t key, const Terrain& terrain);
+    void shrinkTo(std::size_t budget);
+};
+
+#endif
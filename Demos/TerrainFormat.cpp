@@ -0,0 +1,290 @@
+#include "TerrainFormat.h"
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+using namespace std;
+
+namespace {
+    const char     kMagic[8] = { 'T', 'E', 'R', 'R', 'A', 'I', 'N', 'B' };
+    const uint32_t kVersion  = 1;
+
+    const uint64_t kFNVPrime = 0x100000001b3ULL;
+
+    /* The file is read and written exactly as it sits in memory, which is only right on
+     * little-endian machines. That's all of the ones the demos run on.
+     */
+    void checkByteOrder() {
+        const uint16_t probe = 1;
+        unsigned char firstByte;
+        memcpy(&firstByte, &probe, 1);
+        if (firstByte != 1) throw runtime_error(".terrainb files need a little-endian machine.");
+    }
+
+    /* Total file size for the given header, or 0 if it's too large to be real. */
+    size_t fileSizeFor(uint64_t numRows, uint64_t numCols, uint64_t numSources) {
+        uint64_t numCells = numRows * numCols;
+        if (numRows != 0 && numCells / numRows != numCols) return 0;
+        if (numCells > (SIZE_MAX - sizeof(BinaryTerrainHeader)) / sizeof(double) - numSources) return 0;
+        return sizeof(BinaryTerrainHeader) + numSources * 2 * sizeof(int32_t) + numCells * sizeof(double);
+    }
+}
+
+BinaryTerrainFile::BinaryTerrainFile(const string& filename) : file(filename) {
+    checkByteOrder();
+
+    if (file.size() < sizeof(BinaryTerrainHeader)) {
+        throw runtime_error(filename + " is too short to be a .terrainb file.");
+    }
+    header = reinterpret_cast<const BinaryTerrainHeader*>(file.data());
+    if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0) {
+        throw runtime_error(filename + " isn't a .terrainb file.");
+    }
+    if (header->version != kVersion) {
+        throw runtime_error(filename + " is from an unsupported version of the .terrainb format.");
+    }
+    if (header->numRows > INT32_MAX || header->numCols > INT32_MAX || header->numSources > INT32_MAX ||
+        file.size() != fileSizeFor(header->numRows, header->numCols, header->numSources)) {
+        throw runtime_error(filename + " has the wrong size for the terrain it describes.");
+    }
+
+    for (int i = 0; i < numSources(); i++) {
+        if (sources()[2 * i]     < 0 || sources()[2 * i]     >= numRows() ||
+            sources()[2 * i + 1] < 0 || sources()[2 * i + 1] >= numCols()) {
+            throw runtime_error(filename + " has a water source out of bounds.");
+        }
+    }
+
+    uint64_t checksum = terrainHashOf(sources(), 2 * sizeof(int32_t) * numSources());
+    checksum = terrainHashOf(heights(), sizeof(double) * numRows() * numCols(), checksum);
+    if (checksum != header->checksum) {
+        throw runtime_error(filename + " is corrupt (its checksum doesn't match).");
+    }
+}
+
+int BinaryTerrainFile::numRows() const {
+    return header->numRows;
+}
+
+int BinaryTerrainFile::numCols() const {
+    return header->numCols;
+}
+
+int BinaryTerrainFile::numSources() const {
+    return header->numSources;
+}
+
+const int32_t* BinaryTerrainFile::sources() const {
+    return reinterpret_cast<const int32_t*>(file.data() + sizeof(BinaryTerrainHeader));
+}
+
+const double* BinaryTerrainFile::heights() const {
+    return reinterpret_cast<const double*>(sources() + 2 * size_t(numSources()));
+}
+
+double BinaryTerrainFile::lowestHeight() const {
+    return header->lowestHeight;
+}
+
+double BinaryTerrainFile::highestHeight() const {
+    return header->highestHeight;
+}
+
+uint64_t terrainHashOf(const void* data, size_t length, uint64_t hash) {
+    const char* bytes = static_cast<const char*>(data);
+    for (size_t i = 0; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * kFNVPrime;
+    }
+    if (length % sizeof(uint64_t) != 0) {
+        uint64_t word = 0;
+        memcpy(&word, bytes + length - length % sizeof(uint64_t), length % sizeof(uint64_t));
+        hash = (hash ^ word) * kFNVPrime;
+    }
+    return hash;
+}
+
+void writeBinaryTerrain(const string& filename, int numRows, int numCols,
+                        const vector<int32_t>& sources, const double* heights) {
+    checkByteOrder();
+    if (numRows < 0 || numCols < 0 || sources.size() % 2 != 0) {
+        throw runtime_error("Can't write a terrain with negative dimensions or half a water source.");
+    }
+
+    size_t numCells   = size_t(numRows) * numCols;
+    size_t numSources = sources.size() / 2;
+
+    BinaryTerrainHeader header = {};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version    = kVersion;
+    header.numRows    = numRows;
+    header.numCols    = numCols;
+    header.numSources = numSources;
+
+    header.lowestHeight = header.highestHeight = NAN;
+    for (size_t i = 0; i < numCells; i++) {
+        if (isnan(heights[i])) continue;
+        if (isnan(header.lowestHeight) || heights[i] < header.lowestHeight) {
+            header.lowestHeight = heights[i];
+        }
+        if (isnan(header.highestHeight) || heights[i] > header.highestHeight) {
+            header.highestHeight = heights[i];
+        }
+    }
+
+    header.checksum = terrainHashOf(sources.data(), sources.size() * sizeof(int32_t));
+    header.checksum = terrainHashOf(heights, numCells * sizeof(double), header.checksum);
+
+    MappedFile file = MappedFile::create(filename, fileSizeFor(numRows, numCols, numSources));
+    char* next = file.data();
+    memcpy(next, &header, sizeof(header));
+    next += sizeof(header);
+    if (numSources > 0) memcpy(next, sources.data(), sources.size() * sizeof(int32_t));
+    next += sources.size() * sizeof(int32_t);
+    if (numCells > 0) memcpy(next, heights, numCells * sizeof(double));
+}
+
+
+/***** Test Cases Below This Point *****/
+
+/* The terrain converter builds this file on its own, without the rest of the project, so
+ * it leaves the tests out.
+ */
+#ifndef TERRAIN_CONVERTER
+
+#include "GUI/SimpleTest.h"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+namespace {
+    const string kTestBinaryFile = "TerrainFormatTest.terrainb";
+
+    string readBytes(const string& filename) {
+        ifstream in(filename, ios::binary);
+        return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+
+    void writeBytes(const string& filename, const string& bytes) {
+        ofstream(filename, ios::binary) << bytes;
+    }
+
+    /* Whether the file opens as a .terrainb. These report problems with runtime_error
+     * rather than error(), so EXPECT_ERROR can't see them.
+     */
+    bool opens(const string& filename) {
+        try {
+            BinaryTerrainFile file(filename);
+            return true;
+        } catch (const runtime_error&) {
+            return false;
+        }
+    }
+}
+
+STUDENT_TEST("Binary terrains round-trip through a file.") {
+    const double heights[] = {
+        3, -1.5, 4, 1,
+        5, NAN,  2, 6.25
+    };
+    writeBinaryTerrain(kTestBinaryFile, 2, 4, { 0, 0, 1, 3 }, heights);
+    {
+        BinaryTerrainFile file(kTestBinaryFile);
+        EXPECT_EQUAL(file.numRows(), 2);
+        EXPECT_EQUAL(file.numCols(), 4);
+        EXPECT_EQUAL(file.numSources(), 2);
+        EXPECT(vector<int32_t>(file.sources(), file.sources() + 4) == vector<int32_t>({ 0, 0, 1, 3 }));
+        for (int i = 0; i < 8; i++) {
+            if (isnan(heights[i])) {
+                EXPECT(isnan(file.heights()[i]));
+            } else {
+                EXPECT_EQUAL(file.heights()[i], heights[i]);
+            }
+        }
+
+        /* NaN is left out of the lowest and highest heights. */
+        EXPECT_EQUAL(file.lowestHeight(), -1.5);
+        EXPECT_EQUAL(file.highestHeight(), 6.25);
+    }
+
+    /* Terrains with no cells have no lowest or highest height. */
+    writeBinaryTerrain(kTestBinaryFile, 3, 0, {}, nullptr);
+    {
+        BinaryTerrainFile file(kTestBinaryFile);
+        EXPECT_EQUAL(file.numRows(), 3);
+        EXPECT_EQUAL(file.numCols(), 0);
+        EXPECT_EQUAL(file.numSources(), 0);
+        EXPECT(isnan(file.lowestHeight()));
+        EXPECT(isnan(file.highestHeight()));
+    }
+
+    remove(kTestBinaryFile.c_str());
+}
+
+STUDENT_TEST("Damaged binary terrains don't open.") {
+    const double heights[] = { 1, 2, 3, 4, 5, 6 };
+    writeBinaryTerrain(kTestBinaryFile, 2, 3, { 1, 2 }, heights);
+    string good = readBytes(kTestBinaryFile);
+    EXPECT_EQUAL(good.size(), sizeof(BinaryTerrainHeader) + 2 * sizeof(int32_t) + 6 * sizeof(double));
+    EXPECT(opens(kTestBinaryFile));
+
+    /* Truncated, or with extra bytes on the end. */
+    writeBytes(kTestBinaryFile, good.substr(0, good.size() - 1));
+    EXPECT(!opens(kTestBinaryFile));
+    writeBytes(kTestBinaryFile, good.substr(0, sizeof(BinaryTerrainHeader) - 1));
+    EXPECT(!opens(kTestBinaryFile));
+    writeBytes(kTestBinaryFile, "");
+    EXPECT(!opens(kTestBinaryFile));
+    writeBytes(kTestBinaryFile, good + '\0');
+    EXPECT(!opens(kTestBinaryFile));
+
+    /* Wrong magic number, or wrong version. */
+    string bad = good;
+    bad[7] = 'Z';
+    writeBytes(kTestBinaryFile, bad);
+    EXPECT(!opens(kTestBinaryFile));
+
+    bad = good;
+    bad[offsetof(BinaryTerrainHeader, version)]++;
+    writeBytes(kTestBinaryFile, bad);
+    EXPECT(!opens(kTestBinaryFile));
+
+    /* A header that promises far more cells than there are. */
+    bad = good;
+    bad[offsetof(BinaryTerrainHeader, numRows) + 3] = 0x7F;
+    writeBytes(kTestBinaryFile, bad);
+    EXPECT(!opens(kTestBinaryFile));
+
+    /* A single flipped bit anywhere in the heights or sources fails the checksum. */
+    for (size_t i = sizeof(BinaryTerrainHeader); i < good.size(); i++) {
+        bad = good;
+        bad[i] ^= 0x10;
+        writeBytes(kTestBinaryFile, bad);
+        EXPECT(!opens(kTestBinaryFile));
+    }
+    bad = good;
+    bad[offsetof(BinaryTerrainHeader, checksum)] ^= 1;
+    writeBytes(kTestBinaryFile, bad);
+    EXPECT(!opens(kTestBinaryFile));
+
+    writeBytes(kTestBinaryFile, good);
+    EXPECT(opens(kTestBinaryFile));
+    remove(kTestBinaryFile.c_str());
+    EXPECT(!opens(kTestBinaryFile));
+}
+
+STUDENT_TEST("Binary terrains with water sources out of bounds don't open.") {
+    const double heights[] = { 1, 2, 3, 4, 5, 6 };
+    for (vector<int32_t> sources: { vector<int32_t>{ 2, 0 }, vector<int32_t>{ 0, 3 },
+                                    vector<int32_t>{ -1, 0 }, vector<int32_t>{ 0, -1 },
+                                    vector<int32_t>{ 0, 0, 1, 2, 1, 3 } }) {
+        writeBinaryTerrain(kTestBinaryFile, 2, 3, sources, heights);
+        EXPECT(!opens(kTestBinaryFile));
+    }
+
+    writeBinaryTerrain(kTestBinaryFile, 2, 3, { 0, 0, 1, 2 }, heights);
+    EXPECT(opens(kTestBinaryFile));
+    remove(kTestBinaryFile.c_str());
+}
+
+#endif
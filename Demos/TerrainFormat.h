@@ -0,0 +1,83 @@
+/* The binary .terrainb terrain format, shared by the demos and the terrain converter. */
+#ifndef TerrainFormat_Included
+#define TerrainFormat_Included
+
+#include "MappedFile.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* File suffix for binary terrains. Text terrains use ".terrain". */
+const std::string kBinaryTerrainSuffix = ".terrainb";
+
+/* Type: BinaryTerrainHeader
+ * ----------------------------------------------------------------------------------
+ * The first 64 bytes of a .terrainb file. After it come numSources (row, col) pairs of
+ * 32-bit ints, then the numRows x numCols heights as doubles, row by row. Everything is
+ * little-endian, and since the header and each source are a multiple of eight bytes,
+ * the heights are always aligned well enough to be used right where they're mapped.
+ *
+ * The checksum is 64-bit FNV-1a over the sources and heights, taken a 64-bit word at a
+ * time rather than a byte at a time. The lowest and highest heights leave out NaN cells,
+ * and are both NaN if there aren't any other cells.
+ */
+struct BinaryTerrainHeader {
+    char          magic[8];     // "TERRAINB"
+    std::uint32_t version;
+    std::uint32_t numRows;
+    std::uint32_t numCols;
+    std::uint32_t numSources;
+    double        lowestHeight;
+    double        highestHeight;
+    std::uint64_t checksum;
+    std::uint8_t  reserved[16]; // Zero.
+};
+static_assert(sizeof(BinaryTerrainHeader) == 64, "The .terrainb header must be 64 bytes.");
+
+/* Type: BinaryTerrainFile
+ * ----------------------------------------------------------------------------------
+ * A .terrainb file, mapped into memory. Opening one checks the header, the size and the
+ * checksum, and nothing is parsed: the heights are read straight out of the mapping.
+ *
+ * Files that are missing or malformed are reported with a std::runtime_error, as with
+ * MappedFile, so that this can be used from programs that don't link the course library.
+ */
+class BinaryTerrainFile {
+public:
+    explicit BinaryTerrainFile(const std::string& filename);
+
+    int numRows() const;
+    int numCols() const;
+    int numSources() const;
+
+    /* The water sources, as numSources() (row, col) pairs. */
+    const std::int32_t* sources() const;
+
+    /* The heights, numCols() to a row. */
+    const double* heights() const;
+
+    double lowestHeight() const;
+    double highestHeight() const;
+
+private:
+    MappedFile file;
+    const BinaryTerrainHeader* header;
+};
+
+/* Hashes the given bytes with the same FNV-1a variant as the checksum: a 64-bit word at
+ * a time, with a last partial word padded out with zeros. A hash can be continued over
+ * more bytes by passing it back in, as long as the bytes before were a whole number of
+ * words.
+ */
+const std::uint64_t kTerrainHashBasis = 0xcbf29ce484222325ULL;
+std::uint64_t terrainHashOf(const void* data, std::size_t length,
+                            std::uint64_t hash = kTerrainHashBasis);
+
+/* Writes a .terrainb file. Sources are (row, col) pairs and heights go row by row, as in
+ * BinaryTerrainFile. Failures are reported with a std::runtime_error.
+ */
+void writeBinaryTerrain(const std::string& filename, int numRows, int numCols,
+                        const std::vector<std::int32_t>& sources, const double* heights);
+
+#endif
@@ -0,0 +1,780 @@
+#include "TerrainLoader.h"
+#include "TerrainCache.h"
+#include "CompressedTerrain.h"
+#include "DownloadCache.h"
+#include "TerrainFormat.h"
+#include "MappedFile.h"
+#include "error.h"
+#include "strlib.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#if defined(__has_include)
+    #if __has_include(<charconv>)
+        #include <charconv>
+    #endif
+#endif
+using namespace std;
+
+namespace {
+    const string kDownloadingMessage = "Downloading the terrain from Stanford's servers...";
+    const string kLoadingText        = "Loading the landscape...";
+
+    /* Error message to display when failing to read a terrain. */
+    const string kMalformedDataFileMessage = "Oops! Something went wrong reading that data file. If this is a terrain file you designed, double-check the syntax of the file. Otherwise, this isn't your fault.";
+
+    /* Height data shorter than this is parsed on one thread. Each extra thread gets at
+     * least this much text to parse, so that starting it up is worth it.
+     */
+    const size_t kMinBytesPerThread = size_t(1) << 20;
+
+    /* Same whitespace as isspace in the "C" locale, which is what istream >> skips. */
+    bool isSpace(char ch) {
+        return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\v' || ch == '\f' || ch == '\r';
+    }
+
+    /* Skips whitespace and a leading +, like istream >> does before a number. Returns
+     * false if there's no number left, or if a + is followed by a -.
+     */
+    bool skipToNumber(const char*& next, const char* end) {
+        while (next != end && isSpace(*next)) next++;
+        if (next != end && *next == '+') {
+            next++;
+            if (next != end && *next == '-') return false;
+        }
+        return next != end;
+    }
+
+    /* Reads an int the way istream >> does, advancing next past it. There are only a
+     * handful of these per file, so the number is simply copied out for strtol, which
+     * needs it null-terminated. (strtol would also take a second +, which istream won't.)
+     */
+    bool readInt(const char*& next, const char* end, int& result) {
+        if (!skipToNumber(next, end) || *next == '+') return false;
+
+        string token(next, find_if(next, end, isSpace));
+        char* tokenEnd;
+        errno = 0;
+        long value = strtol(token.c_str(), &tokenEnd, 10);
+        if (tokenEnd == token.c_str() || errno == ERANGE || value < INT_MIN || value > INT_MAX) {
+            return false;
+        }
+        result = int(value);
+        next += tokenEnd - token.c_str();
+        return true;
+    }
+
+    /* Parses every height in [begin, end), appending them to heights. Returns false if
+     * anything in there isn't a number. Numbers are read one after the other exactly as
+     * repeated istream >> calls would read them, so a file is malformed here if and only
+     * if it was malformed to the old loader.
+     *
+     * from_chars doesn't depend on the locale and doesn't need its input null-terminated,
+     * which is why it's used when the standard library has it for doubles. It also takes
+     * "inf" and "nan", which istream doesn't, so those are turned away by hand.
+     */
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    bool parseHeights(const char* begin, const char* end, vector<double>& heights) {
+        for (const char* next = begin; ; ) {
+            while (next != end && isSpace(*next)) next++;
+            if (next == end) return true;
+            if (!skipToNumber(next, end)) return false;
+
+            const char* digits = (*next == '-')? next + 1 : next;
+            if (digits == end || !((*digits >= '0' && *digits <= '9') || *digits == '.')) return false;
+
+            double height;
+            auto parsed = from_chars(next, end, height);
+            if (parsed.ec == errc::result_out_of_range) {
+                /* istream rounds numbers too tiny for a double to zero, where from_chars gives
+                 * up on them, so these (rare) numbers are left to istream to decide.
+                 */
+                const char* tokenEnd = find_if(next, end, isSpace);
+                istringstream token(string(next, tokenEnd));
+                if (!(token >> height)) return false;
+                parsed.ptr = token.eof()? tokenEnd : next + streamoff(token.tellg());
+            } else if (parsed.ec != errc()) {
+                return false;
+            }
+            heights.push_back(height);
+            next = parsed.ptr;
+        }
+    }
+#else
+    /* Without from_chars for doubles, fall back to an istream over the chunk. It's slower,
+     * but it can't disagree with the old loader. (strtod can, since it follows the C
+     * locale, which the GUI may have changed.)
+     */
+    bool parseHeights(const char* begin, const char* end, vector<double>& heights) {
+        istringstream input(string(begin, end));
+        double height;
+        while (input >> height) {
+            heights.push_back(height);
+        }
+        return input.eof();
+    }
+#endif
+
+    /* Parses the height data, which is split into chunks at whitespace so that no number
+     * is cut in two, and parsed a chunk per thread. Returns false if it's malformed or has
+     * the wrong number of heights.
+     */
+    bool parseAllHeights(const char* begin, const char* end, Grid<double>& heights) {
+        size_t numChunks = max<size_t>(1, min<size_t>(thread::hardware_concurrency(),
+                                                      (end - begin) / kMinBytesPerThread));
+
+        vector<const char*> cuts = { begin };
+        for (size_t i = 1; i < numChunks; i++) {
+            const char* cut = max(cuts.back(), begin + (end - begin) * i / numChunks);
+            while (cut != end && !isSpace(*cut)) cut++;
+            cuts.push_back(cut);
+        }
+        cuts.push_back(end);
+
+        vector<vector<double>> chunks(numChunks);
+        vector<char> parsed(numChunks, false);
+        vector<thread> workers;
+        for (size_t i = 1; i < numChunks; i++) {
+            workers.emplace_back([&, i] {
+                parsed[i] = parseHeights(cuts[i], cuts[i + 1], chunks[i]);
+            });
+        }
+        parsed[0] = parseHeights(cuts[0], cuts[1], chunks[0]);
+        for (thread& worker: workers) {
+            worker.join();
+        }
+
+        size_t numHeights = 0;
+        for (size_t i = 0; i < numChunks; i++) {
+            if (!parsed[i]) return false;
+            numHeights += chunks[i].size();
+        }
+        if (numHeights != size_t(heights.numRows()) * heights.numCols()) return false;
+
+        /* Grids are stored row by row, so the chunks just go in one after the other. */
+        double* next = heights.isEmpty()? nullptr : &heights[0][0];
+        for (const vector<double>& chunk: chunks) {
+            next = copy(chunk.begin(), chunk.end(), next);
+        }
+        return true;
+    }
+
+    /* Called as the rows of a terrain come in, with how many rows are final so far. It's
+     * first called with 0 once the header has been read, which is when the terrain takes
+     * on its final size and gets its water sources. Loads that nobody is watching pass
+     * nullptr instead.
+     */
+    using RowsCallback = function<void (int rowsLoaded)>;
+
+    /* How much text of a watched load goes in each chunk. */
+    const size_t kStreamChunkBytes = size_t(1) << 18;
+
+    /* Parses the height data for a watched load. The text is cut into chunks at whitespace,
+     * and the chunks are parsed on as many threads as parseAllHeights would use. Chunks are
+     * handed out in order, and whichever thread finishes the chunk that's next in line copies
+     * it (and any finished chunks right after it) into the grid, so the rows fill in from the
+     * top down. onRows is only ever called from the calling thread, as the rows come in, and
+     * if it throws, the workers are stopped before the exception goes on. Returns false
+     * under the same conditions as parseAllHeights. Assumes the terrain isn't empty.
+     */
+    bool streamHeights(const char* begin, const char* end, Grid<double>& heights,
+                       const RowsCallback& onRows) {
+        size_t numHeights = size_t(heights.numRows()) * heights.numCols();
+        double* cells = &heights[0][0];
+
+        vector<const char*> cuts = { begin };
+        while (cuts.back() != end) {
+            const char* cut = cuts.back() + min<size_t>(end - cuts.back(), kStreamChunkBytes);
+            while (cut != end && !isSpace(*cut)) cut++;
+            cuts.push_back(cut);
+        }
+        size_t numChunks = cuts.size() - 1;
+
+        /* Everything from here to the workers is guarded by the lock, except the chunk counter
+         * and the stop flag.
+         */
+        mutex lock;
+        condition_variable changed;
+        vector<vector<double>> chunks(numChunks);
+        vector<char> isParsed(numChunks, false);
+        size_t numCopied = 0;   // Chunks copied into the grid, all from the front.
+        size_t numFilled = 0;   // Cells those chunks filled.
+        size_t numStopped = 0;  // Workers that are done.
+        bool malformed = false;
+
+        atomic<size_t> nextChunk{0};
+        atomic<bool> stop{false};
+        auto work = [&] {
+            for (size_t i; !stop && (i = nextChunk++) < numChunks; ) {
+                vector<double> chunk;
+                bool parsed = parseHeights(cuts[i], cuts[i + 1], chunk);
+
+                lock_guard<mutex> guard(lock);
+                chunks[i] = move(chunk);
+                isParsed[i] = true;
+                if (!parsed) malformed = true;
+
+                while (!malformed && numCopied < numChunks && isParsed[numCopied]) {
+                    vector<double>& next = chunks[numCopied];
+                    if (next.size() > numHeights - numFilled) {
+                        malformed = true;
+                        break;
+                    }
+                    copy(next.begin(), next.end(), cells + numFilled);
+                    numFilled += next.size();
+                    vector<double>().swap(next);
+                    numCopied++;
+                }
+                if (malformed) stop = true;
+                changed.notify_one();
+            }
+
+            lock_guard<mutex> guard(lock);
+            numStopped++;
+            changed.notify_one();
+        };
+
+        size_t numThreads = max<size_t>(1, min<size_t>(thread::hardware_concurrency(), numChunks));
+        vector<thread> workers;
+        for (size_t i = 0; i < numThreads; i++) {
+            workers.emplace_back(work);
+        }
+        auto joinWorkers = [&] {
+            for (thread& worker: workers) {
+                worker.join();
+            }
+        };
+
+        try {
+            int rowsReported = 0;
+            unique_lock<mutex> guard(lock);
+            while (true) {
+                changed.wait(guard, [&] {
+                    return numStopped == numThreads || int(numFilled / heights.numCols()) > rowsReported;
+                });
+                if (numStopped == numThreads) break;
+
+                rowsReported = numFilled / heights.numCols();
+                guard.unlock();
+                onRows(rowsReported);
+                guard.lock();
+            }
+        } catch (...) {
+            stop = true;
+            joinWorkers();
+            throw;
+        }
+        joinWorkers();
+
+        return !malformed && numFilled == numHeights;
+    }
+
+    void readTerrain(istream& input, Terrain& result,
+                     const TerrainStatusCallback& callback, const RowsCallback& onRows);
+
+    /* Loads a terrain from the complete text of a .terrain file. */
+    void parseTerrain(const char* begin, const char* end, Terrain& result,
+                      const TerrainStatusCallback& callback, const RowsCallback& onRows) {
+        auto report = [&](const string& message) {
+            if (callback) callback(message);
+        };
+
+        /* The first line of the input is either a URL to download or the string "local."
+         * If it's a remote download, we need to fetch the file first.
+         */
+        if (begin == end) {
+            error(kMalformedDataFileMessage);
+        }
+        const char* next = find(begin, end, '\n');
+        string url(begin, next);
+        if (next != end) next++;
+
+        if (url != "local") {
+            auto data = webContentsOf(url, ".terrain", [&] (DownloadStatus status) {
+                if (status == DownloadStatus::DOWNLOADING) {
+                    report(kDownloadingMessage);
+                } else if (status == DownloadStatus::FINISHED) {
+                    report(" ");
+                }
+            });
+
+            /* Go download that data instead. */
+            readTerrain(*data, result, callback, onRows);
+            return;
+        }
+
+        report(kLoadingText);
+
+        int numRows, numCols;
+        if (!readInt(next, end, numRows) || !readInt(next, end, numCols) || numRows < 0 || numCols < 0) {
+            error(kMalformedDataFileMessage);
+        }
+
+        int numSources;
+        if (!readInt(next, end, numSources)) {
+            error(kMalformedDataFileMessage);
+        }
+
+        /* Read the flooding sources. */
+        for (int i = 0; i < numSources; i++) {
+            int row, col;
+            if (!readInt(next, end, row) || !readInt(next, end, col)) {
+                error(kMalformedDataFileMessage);
+            }
+
+            result.waterSources.add({ row, col });
+        }
+
+        /* Read the height data. Anything left over after it counts as malformed too. */
+        result.heights.resize(numRows, numCols);
+        if (onRows) onRows(0);
+
+        bool parsed = (onRows && !result.heights.isEmpty())? streamHeights(next, end, result.heights, onRows)
+                                                            : parseAllHeights(next, end, result.heights);
+        if (!parsed) {
+            error(kMalformedDataFileMessage);
+        }
+        if (onRows) onRows(numRows);
+    }
+
+    void readTerrain(istream& input, Terrain& result,
+                     const TerrainStatusCallback& callback, const RowsCallback& onRows) {
+        string contents{ istreambuf_iterator<char>(input), istreambuf_iterator<char>() };
+        parseTerrain(contents.data(), contents.data() + contents.size(), result, callback, onRows);
+    }
+
+    void readTerrainFile(const string& filename, Terrain& result,
+                         const TerrainStatusCallback& callback, const RowsCallback& onRows) {
+        if (endsWith(filename, kCompressedTerrainSuffix)) {
+            if (callback) callback(kLoadingText);
+            CompressedTerrain file = CompressedTerrain::load(filename);
+            result.waterSources = file.waterSources();
+            result.heights.resize(file.numRows(), file.numCols());
+            if (onRows) onRows(0);
+
+            /* Decoded straight into the grid, a row at a time. */
+            int numCols = file.numCols();
+            int rowsPerReport = max<int>(1, kStreamChunkBytes / (sizeof(double) * max(numCols, 1)));
+            CompressedRowReader reader(file);
+            for (int row = 0; row < file.numRows() && numCols > 0; row++) {
+                const double* line = reader.nextRow();
+                copy(line, line + numCols, &result.heights[row][0]);
+                if (onRows && (row + 1) % rowsPerReport == 0) onRows(row + 1);
+            }
+            if (onRows) onRows(file.numRows());
+            return;
+        }
+
+        if (!endsWith(filename, kBinaryTerrainSuffix)) {
+            /* Text terrains are parsed straight out of the mapped file, with no copy. */
+            unique_ptr<MappedFile> file;
+            try {
+                file.reset(new MappedFile(filename));
+            } catch (const runtime_error&) {
+                error("Cannot open file " + filename);
+            }
+            parseTerrain(file->data(), file->data() + file->size(), result, callback, onRows);
+            return;
+        }
+
+        if (callback) callback(kLoadingText);
+        try {
+            BinaryTerrainFile file(filename);
+            for (int i = 0; i < file.numSources(); i++) {
+                result.waterSources.add({ file.sources()[2 * i], file.sources()[2 * i + 1] });
+            }
+
+            result.heights.resize(file.numRows(), file.numCols());
+            if (onRows) onRows(0);
+
+            /* Grids are stored row by row just like the file, so this is one copy, made a
+             * chunk of rows at a time when someone is watching.
+             */
+            int numRows = file.numRows();
+            int numCols = file.numCols();
+            if (numRows > 0 && numCols > 0) {
+                int rowsPerCopy = onRows? max<int>(1, kStreamChunkBytes / (sizeof(double) * numCols)) : numRows;
+                for (int row = 0; row < numRows; row += rowsPerCopy) {
+                    int rows = min(rowsPerCopy, numRows - row);
+                    memcpy(&result.heights[row][0], file.heights() + size_t(row) * numCols,
+                           sizeof(double) * rows * numCols);
+                    if (onRows) onRows(row + rows);
+                }
+            }
+            if (onRows) onRows(numRows);
+        } catch (const runtime_error& e) {
+            error(e.what());
+        }
+    }
+
+    /* Thrown through the loader to stop a cancelled TerrainLoad. */
+    struct LoadCancelled {};
+}
+
+Terrain loadTerrain(istream& input, TerrainStatusCallback callback) {
+    Terrain result;
+    readTerrain(input, result, callback, nullptr);
+    return result;
+}
+
+Terrain loadTerrainFile(const string& filename, TerrainStatusCallback callback) {
+    Terrain result;
+    readTerrainFile(filename, result, callback, nullptr);
+    return result;
+}
+
+bool isTextTerrainFile(const string& filename) {
+    return !endsWith(filename, kBinaryTerrainSuffix) && !endsWith(filename, kCompressedTerrainSuffix);
+}
+
+TerrainLoad::TerrainLoad(const string& filename, TerrainCache* cache) {
+    worker = thread([this, filename, cache] {
+        try {
+            uint64_t key = 0;
+            if (cache) {
+                key = TerrainCache::keyFor(filename);
+                if (cache->lookup(key, loaded)) {
+                    numRowsLoaded = loaded.heights.numRows();
+                    hasHeader = true;
+                    finished = true;
+                    return;
+                }
+            }
+
+            readTerrainFile(filename, loaded, [this](const string& message) {
+                lock_guard<mutex> guard(statusLock);
+                statusMessage = message;
+            }, [this](int rowsLoaded) {
+                if (cancelled) throw LoadCancelled();
+                numRowsLoaded = rowsLoaded;
+                hasHeader = true;
+            });
+
+            if (cache) cache->insert(key, loaded, isTextTerrainFile(filename));
+        } catch (const LoadCancelled&) {
+            stoppedEarly = true;
+        } catch (...) {
+            failure = current_exception();
+        }
+        finished = true;
+    });
+}
+
+TerrainLoad::~TerrainLoad() {
+    cancel();
+    worker.join();
+}
+
+void TerrainLoad::cancel() {
+    cancelled = true;
+}
+
+bool TerrainLoad::isDone() const {
+    return finished;
+}
+
+bool TerrainLoad::headerLoaded() const {
+    return hasHeader;
+}
+
+int TerrainLoad::rowsLoaded() const {
+    return numRowsLoaded;
+}
+
+double TerrainLoad::progress() const {
+    if (!hasHeader) return 0;
+    return loaded.heights.numRows() == 0? 1 : double(numRowsLoaded) / loaded.heights.numRows();
+}
+
+const Terrain& TerrainLoad::terrain() const {
+    return loaded;
+}
+
+string TerrainLoad::status() const {
+    lock_guard<mutex> guard(statusLock);
+    return statusMessage;
+}
+
+Terrain TerrainLoad::result() {
+    if (!finished) error("The terrain is still loading.");
+    if (failure) rethrow_exception(failure);
+    if (stoppedEarly || cancelled) error("The terrain load was cancelled.");
+    return move(loaded);
+}
+
+void saveBinaryTerrain(const string& filename, const Terrain& terrain) {
+    vector<int32_t> sources;
+    for (GridLocation source: terrain.waterSources) {
+        sources.push_back(source.row);
+        sources.push_back(source.col);
+    }
+
+    const double* heights = terrain.heights.isEmpty()? nullptr : &terrain.heights[0][0];
+    try {
+        writeBinaryTerrain(filename, terrain.heights.numRows(), terrain.heights.numCols(), sources, heights);
+    } catch (const runtime_error& e) {
+        error(e.what());
+    }
+}
+
+
+/***** Test Cases Below This Point *****/
+#include "GUI/SimpleTest.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+
+namespace {
+    const string kTestTerrainFile = "TerrainLoaderTest.terrain";
+
+    /* Writes a local text terrain with the given heights and a source in the corner. */
+    void writeTextTerrain(const string& filename, const Grid<double>& heights) {
+        ofstream out(filename);
+        out << "local" << endl;
+        out << heights.numRows() << " " << heights.numCols() << " 1 0 0" << endl;
+        for (int row = 0; row < heights.numRows(); row++) {
+            for (int col = 0; col < heights.numCols(); col++) {
+                out << heights[row][col] << (col + 1 == heights.numCols()? "\n" : " ");
+            }
+        }
+    }
+
+    /* Heights whose text takes up a few chunks of a watched load. */
+    Grid<double> manyChunksOfHeights() {
+        Grid<double> result(300, 400);
+        for (int row = 0; row < result.numRows(); row++) {
+            for (int col = 0; col < result.numCols(); col++) {
+                result[row][col] = (row * 37 + col * 11) % 1000 / 8.0;
+            }
+        }
+        return result;
+    }
+
+    void waitFor(const TerrainLoad& load) {
+        while (!load.isDone()) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+
+    /* The loader as it was before heights were parsed by hand, with one istream >> per
+     * number. Local terrains only.
+     */
+    Terrain oldLoadTerrain(istream& input) {
+        string url;
+        if (!getline(input, url) || url != "local") {
+            error(kMalformedDataFileMessage);
+        }
+
+        int numRows, numCols;
+        if (input >> numRows >> numCols, !input) {
+            error(kMalformedDataFileMessage);
+        }
+
+        int numSources;
+        if (input >> numSources, !input) {
+            error(kMalformedDataFileMessage);
+        }
+
+        Terrain result;
+        for (int i = 0; i < numSources; i++) {
+            int row, col;
+            if (input >> row >> col, !input) {
+                error(kMalformedDataFileMessage);
+            }
+            result.waterSources.add({ row, col });
+        }
+
+        result.heights.resize(numRows, numCols);
+        for (int row = 0; row < result.heights.numRows(); row++) {
+            for (int col = 0; col < result.heights.numCols(); col++) {
+                if (input >> result.heights[row][col], !input) {
+                    error(kMalformedDataFileMessage);
+                }
+            }
+        }
+
+        char leftover;
+        if (input >> leftover) {
+            error(kMalformedDataFileMessage);
+        }
+        return result;
+    }
+
+    /* Loads the given text every way the loader can (all at once, and watched) and checks
+     * that each gives the same terrain as the old loader, or fails just as it did. Returns
+     * whether the old loader took it.
+     */
+    bool loadsLikeOldLoader(const string& text) {
+        Terrain expected;
+        bool accepted = true;
+        try {
+            istringstream input(text);
+            expected = oldLoadTerrain(input);
+        } catch (const ErrorException&) {
+            accepted = false;
+        }
+
+        ofstream(kTestTerrainFile, ios::binary) << text;
+        TerrainLoad load(kTestTerrainFile);
+        waitFor(load);
+
+        if (accepted) {
+            Terrain all = loadTerrainFile(kTestTerrainFile);
+            Terrain watched = load.result();
+            EXPECT_EQUAL(all.heights, expected.heights);
+            EXPECT_EQUAL(all.waterSources, expected.waterSources);
+            EXPECT_EQUAL(watched.heights, expected.heights);
+            EXPECT_EQUAL(watched.waterSources, expected.waterSources);
+        } else {
+            EXPECT_ERROR(loadTerrainFile(kTestTerrainFile));
+            EXPECT_ERROR(load.result());
+        }
+
+        remove(kTestTerrainFile.c_str());
+        return accepted;
+    }
+
+    /* A local terrain of the given size whose heights are written out in full, so that
+     * the text runs to several megabytes for big terrains.
+     */
+    string bigTerrainText(int numRows, int numCols) {
+        ostringstream out;
+        out << "local\n" << numRows << " " << numCols << " 2 0 0 " << numRows - 1 << " " << numCols - 1 << "\n";
+        for (int row = 0; row < numRows; row++) {
+            for (int col = 0; col < numCols; col++) {
+                out << (row * 7919 + col * 104729) % 100000 / 1000.0 - 25 << (col + 1 == numCols? "\n" : " ");
+            }
+        }
+        return out.str();
+    }
+}
+
+STUDENT_TEST("TerrainLoad fills in rows from the top down and finishes at 100%.") {
+    Grid<double> heights = manyChunksOfHeights();
+    writeTextTerrain(kTestTerrainFile, heights);
+
+    TerrainLoad load(kTestTerrainFile);
+    int lastRows = 0;
+    while (!load.isDone()) {
+        int rows = load.rowsLoaded();
+        EXPECT(rows >= lastRows);
+        if (rows > 0) {
+            /* Rows above rowsLoaded are final. */
+            EXPECT_EQUAL(load.terrain().heights[rows - 1][heights.numCols() - 1],
+                         heights[rows - 1][heights.numCols() - 1]);
+        }
+        lastRows = rows;
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+
+    EXPECT(load.headerLoaded());
+    EXPECT_EQUAL(load.rowsLoaded(), heights.numRows());
+    EXPECT_EQUAL(load.progress(), 1.0);
+
+    Terrain loaded = load.result();
+    EXPECT_EQUAL(loaded.heights, heights);
+    EXPECT_EQUAL(loaded.heights, loadTerrainFile(kTestTerrainFile).heights);
+    EXPECT_EQUAL(loaded.waterSources, Vector<GridLocation>({ { 0, 0 } }));
+
+    remove(kTestTerrainFile.c_str());
+}
+
+STUDENT_TEST("TerrainLoad reports cancelled and failed loads from result().") {
+    writeTextTerrain(kTestTerrainFile, manyChunksOfHeights());
+
+    /* However far the load got before it noticed, a cancelled load has no result. */
+    TerrainLoad cancelled(kTestTerrainFile);
+    cancelled.cancel();
+    waitFor(cancelled);
+    EXPECT_ERROR(cancelled.result());
+
+    TerrainLoad finished(kTestTerrainFile);
+    waitFor(finished);
+    finished.cancel();
+    EXPECT_ERROR(finished.result());
+
+    /* One height short. */
+    ofstream(kTestTerrainFile) << "local\n2 2 0\n1 2 3\n";
+    TerrainLoad malformed(kTestTerrainFile);
+    waitFor(malformed);
+    EXPECT_ERROR(malformed.result());
+
+    remove(kTestTerrainFile.c_str());
+    TerrainLoad missing(kTestTerrainFile);
+    waitFor(missing);
+    EXPECT_ERROR(missing.result());
+}
+
+STUDENT_TEST("The terrain parser agrees with istream >> on odd numbers.") {
+    const string header = "local\n2 2 1 0 0\n";
+
+    EXPECT(loadsLikeOldLoader(header + "1 2 3 4"));
+    EXPECT(loadsLikeOldLoader(header + "+1 +2.5 -3 -0"));
+    EXPECT(loadsLikeOldLoader(header + ".5 -.5 5. 1e3"));
+    EXPECT(loadsLikeOldLoader(header + "1E-5 2.5e+3 7e0 -1e-2"));
+    EXPECT(loadsLikeOldLoader(header + "\t1\n2\r\n3\v4\f  \n"));
+    EXPECT(loadsLikeOldLoader("local\n+2 +2 +1 +0 +0\n1 2 3 4"));
+
+    /* Numbers too small for a double: istream decides what they mean. */
+    loadsLikeOldLoader(header + "1e-400 2 3 4");
+    loadsLikeOldLoader(header + "1 2 3 -1e-400");
+
+    EXPECT(!loadsLikeOldLoader(header + "-+1 2 3 4"));
+    EXPECT(!loadsLikeOldLoader(header + "+-1 2 3 4"));
+    EXPECT(!loadsLikeOldLoader(header + "++1 2 3 4"));
+    EXPECT(!loadsLikeOldLoader(header + "1e400 2 3 4"));
+    EXPECT(!loadsLikeOldLoader(header + "1 2 3 -1e400"));
+    EXPECT(!loadsLikeOldLoader(header + "inf 2 3 4"));
+    EXPECT(!loadsLikeOldLoader(header + "1 -inf 3 4"));
+    EXPECT(!loadsLikeOldLoader(header + "1 2 nan 4"));
+    EXPECT(!loadsLikeOldLoader(header + "0x10 2 3 4"));
+    EXPECT(!loadsLikeOldLoader(header + "1 2 3 0x10"));
+    EXPECT(!loadsLikeOldLoader(header + "1,2 3 4"));
+    EXPECT(!loadsLikeOldLoader(header + "1 2 3"));
+    EXPECT(!loadsLikeOldLoader(header + "1 2 3 4 5"));
+    EXPECT(!loadsLikeOldLoader(header + "1 2 3 4x"));
+    EXPECT(!loadsLikeOldLoader(header + "1 2 3 4 junk"));
+    EXPECT(!loadsLikeOldLoader(header + "1 2 . 4"));
+    EXPECT(!loadsLikeOldLoader(header + "1 2 - 4"));
+    EXPECT(!loadsLikeOldLoader("local\n2 2 1 0\n"));
+    EXPECT(!loadsLikeOldLoader("local\n2 x 0\n1 2 3 4"));
+    EXPECT(!loadsLikeOldLoader("remote\n"));
+}
+
+STUDENT_TEST("The terrain parser agrees with istream >> on terrains split into many chunks.") {
+    /* A few megabytes of heights, so they're cut into many chunks, with mistakes at
+     * either end and in the middle.
+     */
+    const int numRows = 600;
+    const int numCols = 700;
+    string text = bigTerrainText(numRows, numCols);
+    EXPECT(text.size() > 2 * kMinBytesPerThread);
+
+    EXPECT(loadsLikeOldLoader(text));
+    EXPECT(!loadsLikeOldLoader(text + " 1"));
+    EXPECT(!loadsLikeOldLoader(text + "x"));
+    EXPECT(!loadsLikeOldLoader(text.substr(0, text.rfind(' '))));
+
+    size_t header = text.find('\n', text.find('\n') + 1) + 1;
+    string early = text;
+    early.insert(header, "1e400 ");
+    EXPECT(!loadsLikeOldLoader(early.substr(0, early.rfind(' '))));
+
+    size_t middle = text.find(' ', text.size() / 2);
+    for (string mistake: { " inf", " nan", " 0x10", " 1,5", " -+1" }) {
+        string broken = text;
+        broken.insert(middle, mistake);
+        EXPECT(!loadsLikeOldLoader(broken.substr(0, broken.rfind(' '))));
+    }
+}
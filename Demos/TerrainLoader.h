@@ -0,0 +1,121 @@
+/* Reading .terrain files, shared by the Rising Tides demo and the flood benchmarks. */
+#ifndef TerrainLoader_Included
+#define TerrainLoader_Included
+
+#include "grid.h"
+#include "vector.h"
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/* Type: Terrain
+ * ----------------------------------------------------------------------------------
+ * Type representing a terrain as a Grid<double> subdivided into individual cells,
+ * each with an associated height, along with a list of sources from which the water
+ * floods out.
+ *
+ * The GridLocation type is a simple struct that contains just a row and a column.
+ * It's used as a way of tracking a position in the Grid as a single object.
+ */
+struct Terrain {
+    Grid<double> heights;              // Height of each point on the map, in meters.
+    Vector<GridLocation> waterSources; // Which locations, if any, are water sources.
+};
+
+/* Callback function used to report what the loader is doing, as a human-readable
+ * message. An empty-looking message (" ") means "nothing to report."
+ */
+using TerrainStatusCallback = std::function<void (const std::string&)>;
+
+/* Loads a terrain from a data file. If the file just names a URL, the terrain is
+ * downloaded (or fetched from the download cache) first, which can throw a DownloadError.
+ * Malformed data is reported with error().
+ */
+Terrain loadTerrain(std::istream& input, TerrainStatusCallback callback = nullptr);
+
+/* Loads a terrain from a file in any format: binary if the name ends in .terrainb,
+ * compressed if it ends in .terrainz, and text otherwise. Binary terrains are mapped
+ * rather than parsed. Files that can't be opened or are malformed are reported with
+ * error().
+ */
+Terrain loadTerrainFile(const std::string& filename, TerrainStatusCallback callback = nullptr);
+
+/* Whether loadTerrainFile reads the given file as text, which is the only format that's
+ * slow enough to be worth caching on disk.
+ */
+bool isTextTerrainFile(const std::string& filename);
+
+/* Saves a terrain as a .terrainb file. Failures are reported with error(). */
+void saveBinaryTerrain(const std::string& filename, const Terrain& terrain);
+
+class TerrainCache;
+
+/* Type: TerrainLoad
+ * ----------------------------------------------------------------------------------
+ * A terrain being loaded by loadTerrainFile on a background thread, so that the caller
+ * can keep going (and show the terrain as it arrives) in the meantime.
+ *
+ * Once the header has been read, the terrain has its final size and its water sources,
+ * and from then on its rows are filled in from the top down. The rows above rowsLoaded()
+ * are final and can be read while the rest are still loading; nothing else about the
+ * terrain should be touched until the load is done.
+ *
+ * If a cache is given, the terrain comes from there when it can, all at once, and goes
+ * into it otherwise.
+ *
+ * Cancelling takes effect the next time a batch of rows comes in (a download that has
+ * already started runs to completion first). Destroying a TerrainLoad cancels it and
+ * waits for the thread to stop.
+ */
+class TerrainLoad {
+public:
+    /* Starts loading the given file. The cache, if any, must outlive the load. */
+    explicit TerrainLoad(const std::string& filename, TerrainCache* cache = nullptr);
+    ~TerrainLoad();
+
+    TerrainLoad(const TerrainLoad &) = delete;
+    TerrainLoad& operator= (const TerrainLoad &) = delete;
+
+    void cancel();
+
+    /* Whether the thread has stopped, because the load finished, failed, or was cancelled. */
+    bool isDone() const;
+
+    /* Whether the terrain has its final size yet. */
+    bool headerLoaded() const;
+
+    /* How many rows are final, and what fraction of all the rows that is. */
+    int rowsLoaded() const;
+    double progress() const;
+
+    /* The terrain as loaded so far. See above for what's safe to read from it. */
+    const Terrain& terrain() const;
+
+    /* The latest status message from the loader. */
+    std::string status() const;
+
+    /* Once the load is done, hands over the terrain, or rethrows whatever stopped the
+     * load. Calling this early, or after cancelling, is reported with error().
+     */
+    Terrain result();
+
+private:
+    Terrain loaded;
+    std::atomic<bool> cancelled{false};
+    std::atomic<bool> hasHeader{false};
+    std::atomic<bool> finished{false};
+    std::atomic<int> numRowsLoaded{0};
+    std::exception_ptr failure;
+    bool stoppedEarly = false; // Cancelled before it finished.
+
+    mutable std::mutex statusLock;
+    std::string statusMessage;
+
+    std::thread worker; // Last, so it starts after everything it uses is set up.
+};
+
+#endif
@@ -0,0 +1,259 @@
+/***************************************************************
+ * File: FloodKernel.h
+ *
+ * A breadth-first flood that's specialized at compile time on how
+ * water moves between cells: which cells count as neighbours, how
+ * the terrain is laid out, and how high the water has to be to get
+ * into a cell.
+ */
+#pragma once
+
+#include "grid.h"
+#include "vector.h"
+#include "FloodStats.h"
+#include <cstddef>
+#include <vector>
+
+/* Neighbourhood policies. Each one calls visit(row, col) on every neighbour of a cell,
+ * without checking bounds. The calls are written out one by one rather than looped over,
+ * so each instantiation of the kernel has its neighbour loop fully unrolled. Terrains
+ * that step between cells by fixed offsets call these with (0, 0) to get the offsets.
+ */
+struct FourConnected {
+    template <typename Visit> static void forEachNeighbour(int row, int col, Visit&& visit) {
+        visit(row, col - 1);
+        visit(row, col + 1);
+        visit(row - 1, col);
+        visit(row + 1, col);
+    }
+};
+
+struct EightConnected {
+    template <typename Visit> static void forEachNeighbour(int row, int col, Visit&& visit) {
+        visit(row - 1, col - 1);
+        visit(row - 1, col);
+        visit(row - 1, col + 1);
+        visit(row,     col - 1);
+        visit(row,     col + 1);
+        visit(row + 1, col - 1);
+        visit(row + 1, col);
+        visit(row + 1, col + 1);
+    }
+};
+
+/* Permeability policies. admits says whether water at the given height gets into a cell
+ * of the given height at the given (row-major) index.
+ */
+struct SolidTerrain {
+    bool admits(int /* index */, double cellHeight, double waterHeight) const {
+        return cellHeight <= waterHeight;
+    }
+};
+
+/* Cells that leak: water gets into a cell once it's within that cell's tolerance of the
+ * top, so a levee with tolerance 1 lets water through when the water is 1m below its crest.
+ * The tolerance grid has to be the same size as the terrain and outlive the policy.
+ */
+class LeakyLevees {
+public:
+    explicit LeakyLevees(const Grid<double>& tolerance)
+        : tolerance(tolerance.isEmpty()? nullptr : &tolerance[0][0]) {}
+
+    bool admits(int index, double cellHeight, double waterHeight) const {
+        return cellHeight <= waterHeight + tolerance[index];
+    }
+
+private:
+    const double* tolerance;
+};
+
+/* Calls visit(index) on each neighbour of the given cell of a numRows x numCols row-major
+ * array that's in bounds.
+ */
+template <typename Neighbourhood, typename Visit>
+void forEachNeighbourInBounds(int numRows, int numCols, int index, Visit&& visit) {
+    int row = index / numCols;
+    int col = index % numCols;
+    Neighbourhood::forEachNeighbour(row, col, [&](int newRow, int newCol) {
+        /* Negative rows and columns wrap around to huge unsigned ones. */
+        if (unsigned(newRow) < unsigned(numRows) && unsigned(newCol) < unsigned(numCols)) {
+            visit(index + (newRow - row) * numCols + (newCol - col));
+        }
+    });
+}
+
+/* Terrain-access policies. Each one numbers the cells of a terrain, and has
+ *
+ *     int indexOf(int row, int col) const;
+ *     template <typename Neighbourhood, typename Visit>
+ *         void forEachNeighbour(int index, Visit&& visit) const;   // In-bounds neighbours only.
+ *     bool admits(int index) const;                               // Whether the water gets in.
+ *
+ * GridTerrain is a Grid<double> under a fixed water height, numbered row by row. The grid
+ * has to outlive the policy.
+ */
+template <typename Permeability = SolidTerrain>
+class GridTerrain {
+public:
+    GridTerrain(const Grid<double>& terrain, double height,
+                const Permeability& permeability = Permeability())
+        : numRows(terrain.numRows()), numCols(terrain.numCols()),
+          heights(terrain.isEmpty()? nullptr : &terrain[0][0]),
+          height(height), permeability(permeability) {}
+
+    int indexOf(int row, int col) const {
+        return row * numCols + col;
+    }
+
+    template <typename Neighbourhood, typename Visit>
+    void forEachNeighbour(int index, Visit&& visit) const {
+        forEachNeighbourInBounds<Neighbourhood>(numRows, numCols, index, visit);
+    }
+
+    bool admits(int index) const {
+        return permeability.admits(index, heights[index], height);
+    }
+
+private:
+    int numRows, numCols;
+    const double* heights;
+    double height;
+    Permeability permeability;
+};
+
+/* Flooded-cell policies. Each one records which cells are flooded, and has
+ *
+ *     bool test(int index) const;
+ *     void set(int index);
+ *     void turnedAway(int index);   // Called on each neighbour the water couldn't get into.
+ *
+ * FloodedCells is an array with one element per cell, such as the one behind a Grid<bool>.
+ */
+template <typename T>
+class FloodedCells {
+public:
+    explicit FloodedCells(T* cells) : cells(cells) {}
+
+    bool test(int index) const {
+        return cells[index];
+    }
+    void set(int index) {
+        cells[index] = true;
+    }
+    void turnedAway(int /* index */) {}
+
+private:
+    T* cells;
+};
+
+/* Type representing the queue of cells a flood has reached but not spread out from yet, as
+ * packed cell indices. It's kept as two lists: the cells being spread out from now, read
+ * from the front, and the cells they reach, appended to the back. When the first list runs
+ * out, the two swap. That keeps the queue first in, first out, while only ever holding the
+ * frontier of the flood rather than every flooded cell: a few times the perimeter of the
+ * terrain, in practice. The lists only grow when a frontier is longer than any before it,
+ * so a queue that's kept between floods stops allocating after the first few.
+ */
+class FloodQueue {
+public:
+    bool isEmpty() const {
+        return head == current.size() && next.empty();
+    }
+    std::size_t size() const {
+        return current.size() - head + next.size();
+    }
+
+    /* Number of cells the two lists have room for between them. */
+    std::size_t capacity() const {
+        return current.capacity() + next.capacity();
+    }
+
+    /* Empties the queue, and makes room for at least the given number of cells per level. */
+    void clear(std::size_t minCapacity = 0) {
+        current.clear();
+        next.clear();
+        head = 0;
+        current.reserve(minCapacity);
+        next.reserve(minCapacity);
+    }
+
+    void enqueue(int index) {
+        next.push_back(index);
+    }
+    int dequeue() {
+        if (head == current.size()) {
+            current.swap(next);
+            next.clear();
+            head = 0;
+        }
+        return current[head++];
+    }
+
+private:
+    std::vector<int> current, next;
+    std::size_t head = 0; // Next cell to read from current.
+};
+
+/* The two halves of the flood. Sources are always flooded. From there, water spreads to
+ * every neighbour (as defined by the Neighbourhood and the terrain) that isn't flooded yet
+ * and that the terrain admits. Work done is reported through the Stats policy (see
+ * FloodStats.h). Every cell is enqueued at most once.
+ *
+ * seedFlood floods the sources and queues them up; spreadFlood empties the queue.
+ */
+template <typename Terrain, typename Flooded, typename Stats>
+void seedFlood(const Terrain& terrain, const Vector<GridLocation>& sources,
+               Flooded& flooded, FloodQueue& queue, Stats& stats) {
+    for (GridLocation source: sources) {
+        int index = terrain.indexOf(source.row, source.col);
+        if (!flooded.test(index)) {
+            flooded.set(index);
+            queue.enqueue(index);
+            stats.enqueued(queue.size());
+        }
+    }
+}
+
+template <typename Neighbourhood, typename Terrain, typename Flooded, typename Stats>
+void spreadFlood(const Terrain& terrain, Flooded& flooded, FloodQueue& queue, Stats& stats) {
+    while (!queue.isEmpty()) {
+        int index = queue.dequeue();
+        stats.visited();
+
+        terrain.template forEachNeighbour<Neighbourhood>(index, [&](int neighbour) {
+            if (flooded.test(neighbour)) {
+                stats.rejectedAsFlooded();
+            } else if (terrain.admits(neighbour)) {
+                flooded.set(neighbour);
+                queue.enqueue(neighbour);
+                stats.enqueued(queue.size());
+            } else {
+                stats.rejectedByHeight();
+                flooded.turnedAway(neighbour);
+            }
+        });
+    }
+}
+
+/* The whole flood over a Grid<double>, into a new Grid<bool>. */
+template <typename Neighbourhood, typename Permeability, typename Stats>
+Grid<bool> floodKernel(const Grid<double>& terrain,
+                       const Vector<GridLocation>& sources,
+                       double height,
+                       const Permeability& permeability,
+                       Stats& stats) {
+    Grid<bool> result(terrain.numRows(), terrain.numCols());
+    if (result.isEmpty()) return result;
+
+    GridTerrain<Permeability> cells(terrain, height, permeability);
+    FloodedCells<bool> flooded(&result[0][0]);
+    FloodQueue queue;
+
+    stats.startSeeding();
+    seedFlood(cells, sources, flooded, queue, stats);
+    stats.startExpansion();
+    spreadFlood<Neighbourhood>(cells, flooded, queue, stats);
+    stats.finish();
+
+    return result;
+}
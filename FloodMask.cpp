@@ -0,0 +1,243 @@
+#include "FloodMask.h"
+#include "error.h"
+#include <algorithm>
+#include <bitset>
+using namespace std;
+
+namespace {
+    const int kBitsPerWord = 64;
+
+    /* Number of set bits in a word. The builtin compiles down to the hardware popcount
+     * instruction where there is one, and the counting loops below are simple enough for
+     * the compiler to vectorize.
+     */
+    inline int bitsIn(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_popcountll(word);
+#else
+        return int(bitset<64>(word).count());
+#endif
+    }
+
+    /* Word with bits [from, to) set, where 0 <= from < to <= 64. */
+    inline uint64_t bitsBetween(int from, int to) {
+        uint64_t high = (to == kBitsPerWord)? ~uint64_t(0) : (uint64_t(1) << to) - 1;
+        return high & ~((uint64_t(1) << from) - 1);
+    }
+}
+
+FloodMask::FloodMask(int numRows, int numCols) {
+    if (numRows < 0 || numCols < 0) {
+        error("FloodMask dimensions can't be negative.");
+    }
+    rows   = numRows;
+    cols   = numCols;
+    stride = (numCols + kBitsPerWord - 1) / kBitsPerWord;
+    words.assign(size_t(rows) * stride, 0);
+}
+
+FloodMask::FloodMask(const Grid<bool>& flooded) : FloodMask(flooded.numRows(), flooded.numCols()) {
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            if (flooded[row][col]) set(row, col);
+        }
+    }
+}
+
+Grid<bool> FloodMask::toGrid() const {
+    Grid<bool> result(rows, cols);
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            result[row][col] = test(row, col);
+        }
+    }
+    return result;
+}
+
+int FloodMask::numRows() const {
+    return rows;
+}
+
+int FloodMask::numCols() const {
+    return cols;
+}
+
+bool FloodMask::isEmpty() const {
+    return rows == 0 || cols == 0;
+}
+
+bool FloodMask::inBounds(int row, int col) const {
+    return row >= 0 && col >= 0 && row < rows && col < cols;
+}
+
+bool FloodMask::test(int row, int col) const {
+    return (words[size_t(row) * stride + col / kBitsPerWord] >> (col % kBitsPerWord)) & 1;
+}
+
+void FloodMask::set(int row, int col) {
+    words[size_t(row) * stride + col / kBitsPerWord] |= uint64_t(1) << (col % kBitsPerWord);
+}
+
+void FloodMask::reset(int row, int col) {
+    words[size_t(row) * stride + col / kBitsPerWord] &= ~(uint64_t(1) << (col % kBitsPerWord));
+}
+
+/* Fill the partial words at either end bit by bit and everything in between a word at a time. */
+void FloodMask::setRange(int row, int fromCol, int toCol) {
+    if (fromCol >= toCol) return;
+
+    uint64_t* line = rowWords(row);
+    int firstWord = fromCol / kBitsPerWord;
+    int lastWord  = (toCol - 1) / kBitsPerWord;
+
+    if (firstWord == lastWord) {
+        line[firstWord] |= bitsBetween(fromCol % kBitsPerWord, (toCol - 1) % kBitsPerWord + 1);
+        return;
+    }
+
+    line[firstWord] |= bitsBetween(fromCol % kBitsPerWord, kBitsPerWord);
+    fill(line + firstWord + 1, line + lastWord, ~uint64_t(0));
+    line[lastWord] |= bitsBetween(0, (toCol - 1) % kBitsPerWord + 1);
+}
+
+void FloodMask::clear() {
+    fill(words.begin(), words.end(), 0);
+}
+
+int64_t FloodMask::count() const {
+    int64_t result = 0;
+    for (uint64_t word: words) {
+        result += bitsIn(word);
+    }
+    return result;
+}
+
+int FloodMask::countInRow(int row) const {
+    int result = 0;
+    const uint64_t* line = rowWords(row);
+    for (int i = 0; i < stride; i++) {
+        result += bitsIn(line[i]);
+    }
+    return result;
+}
+
+void FloodMask::checkSameSize(const FloodMask& rhs) const {
+    if (rows != rhs.rows || cols != rhs.cols) {
+        error("FloodMasks must be the same size.");
+    }
+}
+
+FloodMask& FloodMask::operator&= (const FloodMask& rhs) {
+    checkSameSize(rhs);
+    for (size_t i = 0; i < words.size(); i++) {
+        words[i] &= rhs.words[i];
+    }
+    return *this;
+}
+
+FloodMask& FloodMask::operator|= (const FloodMask& rhs) {
+    checkSameSize(rhs);
+    for (size_t i = 0; i < words.size(); i++) {
+        words[i] |= rhs.words[i];
+    }
+    return *this;
+}
+
+FloodMask& FloodMask::andNot(const FloodMask& rhs) {
+    checkSameSize(rhs);
+    for (size_t i = 0; i < words.size(); i++) {
+        words[i] &= ~rhs.words[i];
+    }
+    return *this;
+}
+
+int FloodMask::wordsPerRow() const {
+    return stride;
+}
+
+const uint64_t* FloodMask::rowWords(int row) const {
+    return words.data() + size_t(row) * stride;
+}
+
+uint64_t* FloodMask::rowWords(int row) {
+    return words.data() + size_t(row) * stride;
+}
+
+/* Padding bits are always zero, so whole words can be compared. */
+bool operator== (const FloodMask& lhs, const FloodMask& rhs) {
+    if (lhs.numRows() != rhs.numRows() || lhs.numCols() != rhs.numCols()) return false;
+    for (int row = 0; row < lhs.numRows(); row++) {
+        if (!equal(lhs.rowWords(row), lhs.rowWords(row) + lhs.wordsPerRow(), rhs.rowWords(row))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool operator!= (const FloodMask& lhs, const FloodMask& rhs) {
+    return !(lhs == rhs);
+}
+
+/* Same format as a Grid<bool>, to make test failures readable. */
+ostream& operator<< (ostream& out, const FloodMask& mask) {
+    return out << mask.toGrid();
+}
+
+
+/***** Test Cases Below This Point *****/
+#include "GUI/SimpleTest.h"
+
+STUDENT_TEST("FloodMask round-trips through Grid<bool> and counts flooded cells.") {
+    Grid<bool> flooded = {
+        {  true, false,  true, false },
+        { false, false, false, false },
+        {  true,  true,  true,  true }
+    };
+
+    FloodMask mask(flooded);
+    EXPECT_EQUAL(mask.toGrid(), flooded);
+    EXPECT_EQUAL(mask.count(), 6);
+    EXPECT_EQUAL(mask.countInRow(1), 0);
+    EXPECT_EQUAL(mask.countInRow(2), 4);
+
+    mask.reset(0, 0);
+    EXPECT(!mask.test(0, 0));
+    EXPECT_EQUAL(mask.count(), 5);
+}
+
+STUDENT_TEST("FloodMask setRange works within and across word boundaries.") {
+    FloodMask mask(3, 200);
+    mask.setRange(0, 3, 9);
+    mask.setRange(1, 60, 130);
+    mask.setRange(2, 0, 200);
+    mask.setRange(2, 5, 5);
+
+    EXPECT_EQUAL(mask.countInRow(0), 6);
+    EXPECT_EQUAL(mask.countInRow(1), 70);
+    EXPECT_EQUAL(mask.countInRow(2), 200);
+    EXPECT(!mask.test(0, 2) && mask.test(0, 3) && mask.test(0, 8) && !mask.test(0, 9));
+    EXPECT(!mask.test(1, 59) && mask.test(1, 64) && mask.test(1, 129) && !mask.test(1, 130));
+    EXPECT_EQUAL(mask.count(), 276);
+}
+
+STUDENT_TEST("FloodMask bulk operations.") {
+    FloodMask lhs(2, 70), rhs(2, 70);
+    lhs.setRange(0, 0, 40);
+    rhs.setRange(0, 20, 70);
+    rhs.setRange(1, 0, 1);
+
+    FloodMask both = lhs;
+    both &= rhs;
+    EXPECT_EQUAL(both.count(), 20);
+
+    FloodMask either = lhs;
+    either |= rhs;
+    EXPECT_EQUAL(either.count(), 71);
+
+    FloodMask onlyLeft = lhs;
+    onlyLeft.andNot(rhs);
+    EXPECT_EQUAL(onlyLeft.count(), 20);
+    EXPECT(onlyLeft.test(0, 19) && !onlyLeft.test(0, 20));
+
+    EXPECT_ERROR(lhs |= FloodMask(3, 70));
+}
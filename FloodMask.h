@@ -0,0 +1,77 @@
+/***************************************************************
+ * File: FloodMask.h
+ *
+ * A compact record of which cells of a terrain are under water,
+ * using one bit per cell rather than the one byte per cell of a
+ * Grid<bool>.
+ */
+#pragma once
+
+#include "grid.h"
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/* Type representing which cells of a terrain are flooded. Bits are packed 64 to a word,
+ * and each row starts at the beginning of a new word so that a row can be scanned or
+ * filled a word at a time. Bits past the end of a row are always zero.
+ */
+class FloodMask {
+public:
+    /* Creates an empty mask, or an all-dry mask of the given size. */
+    FloodMask() = default;
+    FloodMask(int numRows, int numCols);
+
+    /* Converts from and to a Grid<bool>. */
+    explicit FloodMask(const Grid<bool>& flooded);
+    Grid<bool> toGrid() const;
+
+    int numRows() const;
+    int numCols() const;
+    bool isEmpty() const;
+    bool inBounds(int row, int col) const;
+
+    /* Cell access. These don't check bounds; use inBounds first if you aren't sure. */
+    bool test(int row, int col) const;
+    void set(int row, int col);
+    void reset(int row, int col);
+
+    /* Marks the cells in columns [fromCol, toCol) of the given row as flooded. */
+    void setRange(int row, int fromCol, int toCol);
+
+    /* Marks every cell as dry. */
+    void clear();
+
+    /* Number of flooded cells. */
+    std::int64_t count() const;
+
+    /* Number of flooded cells in the given row. */
+    int countInRow(int row) const;
+
+    /* Bulk operations with another mask of the same size:
+     *
+     *     a &= b;      // Flooded in both.
+     *     a |= b;      // Flooded in either.
+     *     a.andNot(b); // Flooded in a but not in b.
+     */
+    FloodMask& operator&= (const FloodMask& rhs);
+    FloodMask& operator|= (const FloodMask& rhs);
+    FloodMask& andNot(const FloodMask& rhs);
+
+    /* Word-level access. Row r occupies words [r * wordsPerRow(), (r + 1) * wordsPerRow()),
+     * with column c at bit (c % 64) of word c / 64.
+     */
+    int wordsPerRow() const;
+    const std::uint64_t* rowWords(int row) const;
+    std::uint64_t* rowWords(int row);
+
+private:
+    int rows = 0, cols = 0, stride = 0;
+    std::vector<std::uint64_t> words;
+
+    void checkSameSize(const FloodMask& rhs) const;
+};
+
+bool operator== (const FloodMask& lhs, const FloodMask& rhs);
+bool operator!= (const FloodMask& lhs, const FloodMask& rhs);
+std::ostream& operator<< (std::ostream& out, const FloodMask& mask);
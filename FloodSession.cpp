@@ -0,0 +1,689 @@
+#include "FloodSession.h"
+#include "RisingTides.h"
+#include "error.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+using namespace std;
+
+namespace {
+    /* Neighbour offsets. Opposite directions differ only in their lowest bit. */
+    const int rowOffsets[] = {  0, 0, -1, 1 };
+    const int colOffsets[] = { -1, 1,  0, 0 };
+}
+
+/* The flood heights come from the same priority-flood as floodHeightsIn, except that it also
+ * records where each cell's flood height came from, which editTerrain and removeSources need.
+ */
+FloodSession::FloodSession(Grid<double> terrain,
+                           const Vector<GridLocation>& sources,
+                           double height)
+    : rows(terrain.numRows()), cols(terrain.numCols()), level(height),
+      cellHeights(move(terrain)),
+      cellFloodHeights(rows, cols, numeric_limits<double>::quiet_NaN()),
+      cameFrom(size_t(rows) * cols, -1),
+      isSource(size_t(rows) * cols, false),
+      editing(size_t(rows) * cols, false),
+      onShoreline(size_t(rows) * cols, false) {
+    if (isnan(height)) error("Water height can't be NaN.");
+
+    vector<Entry> toVisit;
+    for (int index: indicesOf(sources)) {
+        if (isSource[index]) continue;
+        isSource[index] = true;
+        cellFloodHeights[index / cols][index % cols] = -numeric_limits<double>::infinity();
+        toVisit.push_back({ -numeric_limits<double>::infinity(), index });
+    }
+    spread(toVisit, false);
+
+    wet = floodedMaskAt(cellFloodHeights, height);
+    wetCount = wet.count();
+    rebuildQueues();
+}
+
+/* Dijkstra's algorithm where a path's length is its tallest cell, run from whatever is in toVisit.
+ * A neighbour takes a new flood height only if it's strictly lower than the one it has (NaN counts
+ * as higher than everything), so starting from a mostly finished flood only does work where flood
+ * heights actually drop. If asked to, it notes each cell whose flood height it changes.
+ */
+void FloodSession::spread(vector<Entry>& toVisit, bool noteChanges) {
+    make_heap(toVisit.begin(), toVisit.end(), greater<Entry>());
+    while (!toVisit.empty()) {
+        pop_heap(toVisit.begin(), toVisit.end(), greater<Entry>());
+        Entry current = toVisit.back();
+        toVisit.pop_back();
+
+        int row = current.second / cols;
+        int col = current.second % cols;
+        if (current.first != cellFloodHeights[row][col]) continue; // lowered since it was queued
+
+        for (int i = 0; i < 4; i++) {
+            int newRow = row + rowOffsets[i];
+            int newCol = col + colOffsets[i];
+            if (!cellHeights.inBounds(newRow, newCol) || isnan(cellHeights[newRow][newCol])) continue;
+
+            double newLevel = max(current.first, cellHeights[newRow][newCol]);
+            double& floodHeight = cellFloodHeights[newRow][newCol];
+            if (isnan(floodHeight) || newLevel < floodHeight) {
+                int index = newRow * cols + newCol;
+                if (noteChanges) noteChange(index);
+                floodHeight = newLevel;
+                cameFrom[index] = i ^ 1;
+                toVisit.push_back({ newLevel, index });
+                push_heap(toVisit.begin(), toVisit.end(), greater<Entry>());
+            }
+        }
+    }
+}
+
+/* Every flooded cell goes in the underwater queue, and every dry, reachable cell next to a flooded
+ * one goes on the shoreline. Both queues are built with make_heap, which is linear time.
+ */
+void FloodSession::rebuildQueues() {
+    shoreline.clear();
+    underwater.clear();
+    fill(onShoreline.begin(), onShoreline.end(), false);
+
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            if (!wet.test(row, col)) continue;
+
+            underwater.push_back({ cellFloodHeights[row][col], row * cols + col });
+            for (int i = 0; i < 4; i++) {
+                int newRow = row + rowOffsets[i];
+                int newCol = col + colOffsets[i];
+                if (wet.inBounds(newRow, newCol) && !wet.test(newRow, newCol) &&
+                    !onShoreline[newRow * cols + newCol] && !isnan(cellFloodHeights[newRow][newCol])) {
+                    onShoreline[newRow * cols + newCol] = true;
+                    shoreline.push_back({ cellFloodHeights[newRow][newCol], newRow * cols + newCol });
+                }
+            }
+        }
+    }
+
+    make_heap(shoreline.begin(), shoreline.end(), greater<Entry>());
+    make_heap(underwater.begin(), underwater.end());
+}
+
+int FloodSession::numRows() const {
+    return rows;
+}
+
+int FloodSession::numCols() const {
+    return cols;
+}
+
+double FloodSession::height() const {
+    return level;
+}
+
+int64_t FloodSession::setHeight(double height) {
+    NoFloodStats stats;
+    return moveTo(height, stats);
+}
+
+int64_t FloodSession::setHeight(double height, FloodStats& stats) {
+    RecordFloodStats recorder(stats);
+    return moveTo(height, recorder);
+}
+
+template <typename Stats> int64_t FloodSession::moveTo(double height, Stats& stats) {
+    if (isnan(height)) error("Water height can't be NaN.");
+
+    stats.startSeeding();
+    stats.startExpansion();
+
+    int64_t changed = 0;
+    if (height > level) {
+        rise(height, changed, stats);
+    } else if (height < level) {
+        fall(height, changed, stats);
+    }
+    level = height;
+
+    stats.finish();
+    return changed;
+}
+
+const FloodMask& FloodSession::flooded() const {
+    return wet;
+}
+
+bool FloodSession::isFlooded(int row, int col) const {
+    if (!wet.inBounds(row, col)) error("Location out of bounds.");
+    return wet.test(row, col);
+}
+
+int64_t FloodSession::numFlooded() const {
+    return wetCount;
+}
+
+const Grid<double>& FloodSession::terrain() const {
+    return cellHeights;
+}
+
+const Grid<double>& FloodSession::floodHeights() const {
+    return cellFloodHeights;
+}
+
+template <typename Stats> void FloodSession::addToShoreline(int index, Stats& stats) {
+    if (onShoreline[index]) return;
+    onShoreline[index] = true;
+    shoreline.push_back({ cellFloodHeights[index / cols][index % cols], index });
+    push_heap(shoreline.begin(), shoreline.end(), greater<Entry>());
+    stats.enqueued(shoreline.size());
+}
+
+/* The flood at any height is exactly the cells whose flood height is at most that height, so any
+ * shoreline cell at or below the new height floods. Each cell's flood height comes from a path
+ * through a neighbour with a flood height no higher than its own, so following neighbours out from
+ * the shoreline finds every cell that needs to flood.
+ */
+template <typename Stats> void FloodSession::rise(double height, int64_t& changed, Stats& stats) {
+    while (!shoreline.empty() && shoreline.front().first <= height) {
+        Entry next = shoreline.front();
+        pop_heap(shoreline.begin(), shoreline.end(), greater<Entry>());
+        shoreline.pop_back();
+
+        int index = next.second;
+        int row = index / cols;
+        int col = index % cols;
+        if (wet.test(row, col) || next.first != cellFloodHeights[row][col]) continue;
+        onShoreline[index] = false;
+        stats.visited();
+
+        wet.set(row, col);
+        wetCount++;
+        changed++;
+        underwater.push_back({ cellFloodHeights[row][col], index });
+        push_heap(underwater.begin(), underwater.end());
+        stats.enqueued(underwater.size());
+
+        for (int i = 0; i < 4; i++) {
+            int newRow = row + rowOffsets[i];
+            int newCol = col + colOffsets[i];
+            if (!wet.inBounds(newRow, newCol)) continue;
+            if (wet.test(newRow, newCol)) {
+                stats.rejectedAsFlooded();
+            } else if (isnan(cellFloodHeights[newRow][newCol])) {
+                stats.rejectedByHeight();
+            } else {
+                addToShoreline(newRow * cols + newCol, stats);
+            }
+        }
+    }
+}
+
+/* Dry out every flooded cell above the new height. Each one goes back on the shoreline, since it may
+ * now border the water. Cells already on the shoreline stay there even if the water has pulled away
+ * from them; that's harmless, because a cell only floods once the water reaches its flood height.
+ */
+template <typename Stats> void FloodSession::fall(double height, int64_t& changed, Stats& stats) {
+    while (!underwater.empty() && underwater.front().first > height) {
+        Entry next = underwater.front();
+        pop_heap(underwater.begin(), underwater.end());
+        underwater.pop_back();
+
+        int index = next.second;
+        int row = index / cols;
+        int col = index % cols;
+        if (!wet.test(row, col) || next.first != cellFloodHeights[row][col]) continue;
+        stats.visited();
+
+        wet.reset(row, col);
+        wetCount--;
+        changed++;
+        addToShoreline(index, stats);
+    }
+}
+
+/* Whenever sources or terrain change, the flood heights are patched up in three steps:
+ *
+ *   1. Anything that can raise flood heights wipes out the cells that might be affected: the subtree of
+ *      the cameFrom tree hanging off the changed cell, which is every cell whose recorded path back to a
+ *      source goes through it. Every other cell's path is untouched, and nothing that raises a cell or
+ *      removes a source can make any path lower, so their flood heights still stand.
+ *   2. spread restarts from the reached neighbours of every wiped or lowered cell, plus any new sources.
+ *      It refills the wiped cells, and elsewhere only does work where flood heights drop.
+ *   3. settleChanges moves every cell whose flood height changed to the right side of the water and
+ *      requeues it. Its old queue entries are dead now that its flood height is different.
+ *
+ * noteChange records a cell's flood height the first time it changes, so step 3 knows what it was.
+ */
+void FloodSession::noteChange(int index) {
+    if (editing[index]) return;
+    editing[index] = true;
+    changedCells.push_back(index);
+    oldFloodHeights.push_back(cellFloodHeights[index / cols][index % cols]);
+}
+
+void FloodSession::wipeSubtree(int index, vector<int>& toRestart) {
+    noteChange(index);
+    cellFloodHeights[index / cols][index % cols] = numeric_limits<double>::quiet_NaN();
+    cameFrom[index] = -1;
+
+    // a neighbour is a child if its cameFrom points back at its parent
+    vector<int> toWipe = { index };
+    while (!toWipe.empty()) {
+        int parent = toWipe.back();
+        toWipe.pop_back();
+        toRestart.push_back(parent);
+
+        for (int i = 0; i < 4; i++) {
+            int newRow = parent / cols + rowOffsets[i];
+            int newCol = parent % cols + colOffsets[i];
+            if (!cellHeights.inBounds(newRow, newCol)) continue;
+
+            int child = newRow * cols + newCol;
+            if (cameFrom[child] == (i ^ 1)) {
+                noteChange(child);
+                cellFloodHeights[newRow][newCol] = numeric_limits<double>::quiet_NaN();
+                cameFrom[child] = -1;
+                toWipe.push_back(child);
+            }
+        }
+    }
+}
+
+void FloodSession::restartAround(const vector<int>& cells, vector<Entry>& toVisit) {
+    for (int index: cells) {
+        for (int i = 0; i < 4; i++) {
+            int newRow = index / cols + rowOffsets[i];
+            int newCol = index % cols + colOffsets[i];
+            if (cellHeights.inBounds(newRow, newCol) && !isnan(cellFloodHeights[newRow][newCol])) {
+                toVisit.push_back({ cellFloodHeights[newRow][newCol], newRow * cols + newCol });
+            }
+        }
+    }
+    spread(toVisit, true);
+}
+
+FloodDiff FloodSession::settleChanges() {
+    FloodDiff result;
+    NoFloodStats stats;
+    for (size_t i = 0; i < changedCells.size(); i++) {
+        int index = changedCells[i];
+        int row = index / cols;
+        int col = index % cols;
+        editing[index] = false;
+
+        double floodHeight = cellFloodHeights[row][col];
+        if (floodHeight == oldFloodHeights[i] || (isnan(floodHeight) && isnan(oldFloodHeights[i]))) continue;
+
+        onShoreline[index] = false;
+        bool wasWet = wet.test(row, col);
+        bool isWet  = floodHeight <= level;
+        if (isWet) {
+            underwater.push_back({ floodHeight, index });
+            push_heap(underwater.begin(), underwater.end());
+        } else if (!isnan(floodHeight)) {
+            addToShoreline(index, stats);
+        }
+
+        if (isWet && !wasWet) {
+            wet.set(row, col);
+            wetCount++;
+            result.flooded.add({ row, col });
+
+            // the new water may border cells that weren't on the shoreline before
+            for (int j = 0; j < 4; j++) {
+                int newRow = row + rowOffsets[j];
+                int newCol = col + colOffsets[j];
+                if (wet.inBounds(newRow, newCol) && !wet.test(newRow, newCol) &&
+                    !isnan(cellFloodHeights[newRow][newCol])) {
+                    addToShoreline(newRow * cols + newCol, stats);
+                }
+            }
+        } else if (!isWet && wasWet) {
+            wet.reset(row, col);
+            wetCount--;
+            result.drained.add({ row, col });
+        }
+    }
+    changedCells.clear();
+    oldFloodHeights.clear();
+
+    // dead entries pile up over many changes; start the queues over once they dominate
+    if (shoreline.size() + underwater.size() > 2 * size_t(rows) * cols + 1024) {
+        rebuildQueues();
+    }
+    return result;
+}
+
+/* Raising a cell above its flood height wipes its subtree. Raising it to no more than its flood height
+ * changes nothing, since the water was already at least that high when it got there. Lowering a cell
+ * can only lower flood heights, and only along paths through it, so the flood just restarts around it.
+ */
+FloodDiff FloodSession::editTerrain(const Vector<TerrainEdit>& edits) {
+    for (const TerrainEdit& edit: edits) {
+        if (!cellHeights.inBounds(edit.location.row, edit.location.col)) {
+            error("Edited location out of bounds.");
+        }
+    }
+
+    vector<int> toRestart;
+    for (const TerrainEdit& edit: edits) {
+        int row = edit.location.row;
+        int col = edit.location.col;
+        int index = row * cols + col;
+        double oldHeight = cellHeights[row][col];
+        cellHeights[row][col] = edit.height;
+        if (isSource[index] || oldHeight == edit.height ||
+            (isnan(oldHeight) && isnan(edit.height))) continue;
+
+        double floodHeight = cellFloodHeights[row][col];
+        if (!isnan(floodHeight) && !(edit.height <= floodHeight)) {
+            wipeSubtree(index, toRestart);
+        } else {
+            toRestart.push_back(index);
+        }
+    }
+
+    vector<Entry> toVisit;
+    restartAround(toRestart, toVisit);
+    return settleChanges();
+}
+
+FloodDiff FloodSession::addSources(const Vector<GridLocation>& sources) {
+    return addSourceCells(indicesOf(sources));
+}
+
+FloodDiff FloodSession::addSourceMask(const FloodMask& sources) {
+    return addSourceCells(indicesOf(sources));
+}
+
+FloodDiff FloodSession::removeSources(const Vector<GridLocation>& sources) {
+    return removeSourceCells(indicesOf(sources));
+}
+
+FloodDiff FloodSession::removeSourceMask(const FloodMask& sources) {
+    return removeSourceCells(indicesOf(sources));
+}
+
+bool FloodSession::isWaterSource(int row, int col) const {
+    if (!cellHeights.inBounds(row, col)) error("Location out of bounds.");
+    return isSource[row * cols + col];
+}
+
+vector<int> FloodSession::indicesOf(const Vector<GridLocation>& cells) const {
+    vector<int> result;
+    result.reserve(cells.size());
+    for (GridLocation cell: cells) {
+        if (!cellHeights.inBounds(cell.row, cell.col)) error("Source location out of bounds.");
+        result.push_back(cell.row * cols + cell.col);
+    }
+    return result;
+}
+
+/* Masks are read a word at a time, skipping straight from one set bit to the next, so a sparse mask
+ * costs little more than its number of words.
+ */
+vector<int> FloodSession::indicesOf(const FloodMask& cells) const {
+    if (cells.numRows() != rows || cells.numCols() != cols) error("Source mask is the wrong size.");
+
+    vector<int> result;
+    for (int row = 0; row < rows; row++) {
+        const uint64_t* words = cells.rowWords(row);
+        for (int word = 0; word < cells.wordsPerRow(); word++) {
+            for (uint64_t bits = words[word]; bits != 0; bits &= bits - 1) {
+                result.push_back(row * cols + word * 64 + __builtin_ctzll(bits));
+            }
+        }
+    }
+    return result;
+}
+
+/* A new source can only lower flood heights, so the flood simply expands out from it. All the new
+ * sources go in the priority queue together, which make_heap sets up in linear time.
+ */
+FloodDiff FloodSession::addSourceCells(const vector<int>& sources) {
+    vector<Entry> toVisit;
+    for (int index: sources) {
+        if (isSource[index]) continue;
+        isSource[index] = true;
+        noteChange(index);
+        cellFloodHeights[index / cols][index % cols] = -numeric_limits<double>::infinity();
+        cameFrom[index] = -1;
+        toVisit.push_back({ -numeric_limits<double>::infinity(), index });
+    }
+    restartAround({}, toVisit);
+    return settleChanges();
+}
+
+/* The cells that drained through a removed source are exactly its subtree, found by following cameFrom
+ * backwards. The source itself becomes an ordinary cell and is wiped along with them.
+ */
+FloodDiff FloodSession::removeSourceCells(const vector<int>& sources) {
+    vector<int> toRestart;
+    for (int index: sources) {
+        if (!isSource[index]) continue;
+        isSource[index] = false;
+        wipeSubtree(index, toRestart);
+    }
+
+    vector<Entry> toVisit;
+    restartAround(toRestart, toVisit);
+    return settleChanges();
+}
+
+/***** Test Cases Below This Point *****/
+#include "GUI/SimpleTest.h"
+#include "TestTerrains.h"
+#include <random>
+
+namespace {
+    bool sameFloodHeights(const Grid<double>& lhs, const Grid<double>& rhs) {
+        if (lhs.numRows() != rhs.numRows() || lhs.numCols() != rhs.numCols()) return false;
+        for (int row = 0; row < lhs.numRows(); row++) {
+            for (int col = 0; col < lhs.numCols(); col++) {
+                if (lhs[row][col] != rhs[row][col] && !(isnan(lhs[row][col]) && isnan(rhs[row][col]))) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+}
+
+STUDENT_TEST("FloodSession matches floodedRegionsIn as the water moves up and down.") {
+    for (int seed = 0; seed < 4; seed++) {
+        Grid<double> world = randomTerrain(40, 55, seed);
+        world[5][5] = numeric_limits<double>::quiet_NaN();
+        Vector<GridLocation> sources = {
+            { 0, 0 }, { 20, 27 }, { 39, 54 }, { 20, 27 }
+        };
+
+        FloodSession session(world, sources, 4.0);
+        EXPECT_EQUAL(session.flooded(), FloodMask(floodedRegionsIn(world, sources, 4.0)));
+
+        mt19937 generator(seed);
+        uniform_int_distribution<int> steps(-3, 11);
+        for (int i = 0; i < 40; i++) {
+            double height = steps(generator) + (i % 2) * 0.5;
+            Grid<bool> expected = floodedRegionsIn(world, sources, height);
+            int64_t before = session.numFlooded();
+
+            int64_t changed = session.setHeight(height);
+            EXPECT_EQUAL(session.flooded(), FloodMask(expected));
+            EXPECT_EQUAL(session.numFlooded(), session.flooded().count());
+            EXPECT_EQUAL(changed, before > session.numFlooded()? before - session.numFlooded()
+                                                               : session.numFlooded() - before);
+        }
+    }
+}
+
+STUDENT_TEST("FloodSession only touches cells that change.") {
+    /* A staircase: column c has height c, so each one-meter rise floods exactly one column. */
+    Grid<double> world(30, 20);
+    for (int row = 0; row < 30; row++) {
+        for (int col = 0; col < 20; col++) {
+            world[row][col] = col;
+        }
+    }
+
+    FloodSession session(world, { { 0, 0 } }, 0.0);
+    EXPECT_EQUAL(session.numFlooded(), 30);
+    EXPECT_EQUAL(session.setHeight(1.0), 30);
+    EXPECT_EQUAL(session.setHeight(1.5), 0);
+    EXPECT_EQUAL(session.setHeight(5.0), 120);
+    EXPECT_EQUAL(session.setHeight(-1.0), 179);
+    EXPECT(session.isFlooded(0, 0));
+
+    FloodStats stats;
+    EXPECT_EQUAL(session.setHeight(0.0, stats), 29);
+    EXPECT_EQUAL(stats.cellsVisited, 29);
+    EXPECT_EQUAL(stats.rejectedAsFlooded, 29); // Each new cell looks back at the one above it.
+    EXPECT_EQUAL(session.setHeight(numeric_limits<double>::infinity()), 570);
+    EXPECT_ERROR(session.setHeight(numeric_limits<double>::quiet_NaN()));
+}
+
+STUDENT_TEST("FloodSession edits match flooding the edited terrain from scratch.") {
+    for (int seed = 0; seed < 4; seed++) {
+        Grid<double> world = randomTerrain(30, 35, seed);
+        Vector<GridLocation> sources = { { 0, 0 }, { 15, 17 } };
+        FloodSession session(world, sources, 5.0);
+
+        mt19937 generator(seed);
+        uniform_int_distribution<int> rows(0, 29), cols(0, 34), heights(-2, 12), batchSizes(1, 8);
+        for (int round = 0; round < 30; round++) {
+            Vector<TerrainEdit> edits;
+            for (int batch = batchSizes(generator); batch > 0; batch--) {
+                TerrainEdit edit = { { rows(generator), cols(generator) }, double(heights(generator)) };
+                if (edit.height == 12) edit.height = numeric_limits<double>::quiet_NaN();
+                world[edit.location.row][edit.location.col] = edit.height;
+                edits.add(edit);
+            }
+
+            FloodMask before = session.flooded();
+            FloodDiff diff = session.editTerrain(edits);
+            EXPECT(sameFloodHeights(session.terrain(), world));
+            EXPECT(sameFloodHeights(session.floodHeights(), floodHeightsIn(world, sources)));
+            EXPECT_EQUAL(session.flooded(), FloodMask(floodedRegionsIn(world, sources, session.height())));
+            EXPECT_EQUAL(session.numFlooded(), session.flooded().count());
+
+            /* The diff is exactly the cells that changed. */
+            for (GridLocation cell: diff.flooded) {
+                EXPECT(!before.test(cell.row, cell.col));
+                before.set(cell.row, cell.col);
+            }
+            for (GridLocation cell: diff.drained) {
+                EXPECT(before.test(cell.row, cell.col));
+                before.reset(cell.row, cell.col);
+            }
+            EXPECT_EQUAL(before, session.flooded());
+
+            /* The water still moves correctly afterwards. */
+            double height = heights(generator) + 0.5;
+            session.setHeight(height);
+            EXPECT_EQUAL(session.flooded(), FloodMask(floodedRegionsIn(world, sources, height)));
+        }
+    }
+}
+
+STUDENT_TEST("FloodSession edits only redo the basin behind a levee.") {
+    /* A flat plain at height 0 with a source in the top-left corner. */
+    Grid<double> world(10, 10, 0.0);
+    FloodSession session(world, { { 0, 0 } }, 1.0);
+    EXPECT_EQUAL(session.numFlooded(), 100);
+
+    /* A levee of height 3 down column 5 cuts off the right half, levee included. */
+    Vector<TerrainEdit> levee;
+    for (int row = 0; row < 10; row++) {
+        levee.add({ { row, 5 }, 3.0 });
+    }
+    FloodDiff diff = session.editTerrain(levee);
+    EXPECT_EQUAL(diff.flooded.size(), 0);
+    EXPECT_EQUAL(diff.drained.size(), 50);
+    EXPECT_EQUAL(session.numFlooded(), 50);
+    EXPECT_EQUAL(session.floodHeights()[4][8], 3.0);
+
+    /* Overtopping it floods everything again. */
+    EXPECT_EQUAL(session.setHeight(3.0), 50);
+
+    /* Breaching the levee at one point brings the basin back down to the plain. */
+    session.setHeight(1.0);
+    diff = session.editTerrain({ { { 9, 5 }, 0.0 } });
+    EXPECT_EQUAL(diff.flooded.size(), 41);
+    EXPECT_EQUAL(diff.drained.size(), 0);
+    EXPECT_EQUAL(session.floodHeights()[4][8], 0.0);
+
+    /* Editing the source does nothing, and out-of-bounds edits change nothing. */
+    diff = session.editTerrain({ { { 0, 0 }, 100.0 } });
+    EXPECT_EQUAL(diff.flooded.size() + diff.drained.size(), 0);
+    EXPECT_ERROR(session.editTerrain({ { { 0, 0 }, 0.0 }, { { 10, 0 }, 0.0 } }));
+    EXPECT_EQUAL(session.numFlooded(), 91);
+}
+
+STUDENT_TEST("FloodSession sources can be added and removed.") {
+    for (int seed = 0; seed < 4; seed++) {
+        Grid<double> world = randomTerrain(30, 70, seed);
+        world[10][10] = numeric_limits<double>::quiet_NaN();
+        Grid<bool> isSource(30, 70);
+        isSource[0][0] = true;
+        FloodSession session(world, { { 0, 0 } }, 4.5);
+
+        mt19937 generator(seed);
+        uniform_int_distribution<int> rows(0, 29), cols(0, 69), batchSizes(1, 5);
+        for (int round = 0; round < 40; round++) {
+            Vector<GridLocation> changed;
+            for (int batch = batchSizes(generator); batch > 0; batch--) {
+                changed.add({ rows(generator), cols(generator) });
+            }
+
+            bool adding = round % 3 != 2;
+            FloodMask before = session.flooded();
+            FloodDiff diff;
+            if (round % 2 == 0) {
+                diff = adding? session.addSources(changed) : session.removeSources(changed);
+            } else {
+                FloodMask mask(30, 70);
+                for (GridLocation cell: changed) mask.set(cell.row, cell.col);
+                diff = adding? session.addSourceMask(mask) : session.removeSourceMask(mask);
+            }
+            for (GridLocation cell: changed) isSource[cell.row][cell.col] = adding;
+
+            Vector<GridLocation> sources;
+            for (int row = 0; row < 30; row++) {
+                for (int col = 0; col < 70; col++) {
+                    if (isSource[row][col]) sources.add({ row, col });
+                    EXPECT_EQUAL(session.isWaterSource(row, col), isSource[row][col]);
+                }
+            }
+            EXPECT(sameFloodHeights(session.floodHeights(), floodHeightsIn(world, sources)));
+            EXPECT_EQUAL(session.flooded(), FloodMask(floodedRegionsIn(world, sources, 4.5)));
+
+            for (GridLocation cell: diff.flooded) before.set(cell.row, cell.col);
+            for (GridLocation cell: diff.drained) before.reset(cell.row, cell.col);
+            EXPECT_EQUAL(before, session.flooded());
+            EXPECT_EQUAL(session.numFlooded(), session.flooded().count());
+        }
+
+        EXPECT_ERROR(session.addSources({ { 30, 0 } }));
+        EXPECT_ERROR(session.removeSourceMask(FloodMask(30, 69)));
+    }
+}
+
+STUDENT_TEST("FloodSession removing a source only drains what it fed.") {
+    /* Two basins at height 0 split by a wall of height 5, each with its own source. */
+    Grid<double> world(5, 11, 0.0);
+    for (int row = 0; row < 5; row++) {
+        world[row][5] = 5;
+    }
+    FloodSession session(world, { { 0, 0 }, { 0, 10 } }, 1.0);
+    EXPECT_EQUAL(session.numFlooded(), 50);
+
+    FloodDiff diff = session.removeSources({ { 0, 10 } });
+    EXPECT_EQUAL(diff.drained.size(), 25);
+    EXPECT_EQUAL(diff.flooded.size(), 0);
+    EXPECT_EQUAL(session.floodHeights()[2][8], 5.0);
+
+    diff = session.addSources({ { 4, 10 } });
+    EXPECT_EQUAL(diff.flooded.size(), 25);
+    EXPECT_EQUAL(session.numFlooded(), 50);
+
+    /* Adding a source on the wall floods it, whatever its height. */
+    diff = session.addSources({ { 2, 5 } });
+    EXPECT_EQUAL(diff.flooded.size(), 1);
+    EXPECT(session.isWaterSource(2, 5));
+}
@@ -0,0 +1,164 @@
+/***************************************************************
+ * File: FloodSession.h
+ *
+ * A flood that remembers its last result, so that moving the
+ * water level up or down only costs as much as the number of
+ * cells that change.
+ */
+#pragma once
+
+#include "grid.h"
+#include "vector.h"
+#include "FloodMask.h"
+#include "FloodStats.h"
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/* A change to the height of one cell of a terrain. */
+struct TerrainEdit {
+    GridLocation location;
+    double height;          // New terrain height; NaN marks the cell as never flooding.
+};
+
+/* Cells that flooded or dried out because of a change to a FloodSession. */
+struct FloodDiff {
+    Vector<GridLocation> flooded;
+    Vector<GridLocation> drained;
+};
+
+/* Type representing a terrain flooded at some water height that can be changed.
+ *
+ * The session works out the flood height of every cell once, up front (see floodHeightsIn),
+ * after which the flood at height h is exactly the cells whose flood height is at most h.
+ * To move between heights quickly, it keeps two priority queues:
+ *
+ *   - the dry cells along the shoreline, lowest flood height first, and
+ *   - the flooded cells, highest flood height first.
+ *
+ * Raising the water pops shoreline cells until the next one is above the new height,
+ * flooding each one and adding its dry neighbours to the shoreline. Lowering the water pops
+ * flooded cells until the next one is at or below the new height, drying each one out. Either
+ * way, the work done is proportional to the number of cells that change (times a log factor
+ * for the queues), not to the size of the terrain.
+ *
+ * The terrain and the sources can be changed too (say, to try out a new levee, or breach a
+ * canal). The session remembers which neighbour each cell's flood height came from, so a
+ * change only has to redo the cells downstream of it, plus any cells it opens a new way into.
+ */
+class FloodSession {
+public:
+    /* Creates an empty session. */
+    FloodSession() = default;
+
+    /* Floods the given terrain from the given sources at the given height. Takes
+     * O(n log n) time for a terrain of n cells. The session keeps the terrain, so callers
+     * that are done with theirs can move it in rather than copy it.
+     */
+    FloodSession(Grid<double> terrain,
+                 const Vector<GridLocation>& sources,
+                 double height);
+
+    int numRows() const;
+    int numCols() const;
+
+    /* Current water height. */
+    double height() const;
+
+    /* Moves the water to a new height, returning how many cells flooded or dried out.
+     * NaN heights are reported with error().
+     */
+    std::int64_t setHeight(double height);
+
+    /* Same, but also fills in a FloodStats. Here the "queue" is whichever of the two
+     * priority queues the cell went into, and there's no seeding phase.
+     */
+    std::int64_t setHeight(double height, FloodStats& stats);
+
+    /* Which cells are currently flooded. */
+    const FloodMask& flooded() const;
+    bool isFlooded(int row, int col) const;
+
+    /* Number of cells currently flooded. */
+    std::int64_t numFlooded() const;
+
+    /* The terrain, with any edits made to it. */
+    const Grid<double>& terrain() const;
+
+    /* Lowest water height at which each cell floods, as returned by floodHeightsIn. */
+    const Grid<double>& floodHeights() const;
+
+    /* Changes the heights of the given cells, in order, and updates the flood to match,
+     * returning which cells flooded or dried out. Raising a cell above its flood height
+     * recomputes the basin that drained through it; lowering a cell only revisits the cells
+     * whose flood heights actually drop. Edits to sources are recorded but change nothing,
+     * since sources are always flooded. Out-of-bounds edits are reported with error(),
+     * before any edit is made.
+     */
+    FloodDiff editTerrain(const Vector<TerrainEdit>& edits);
+
+    /* Adds or removes water sources, returning which cells flooded or dried out. Adding
+     * expands the flood out from the new sources; removing recomputes only the cells that
+     * drained through the removed ones. Sources that are already there (or not there) are
+     * skipped. The mask versions take every set cell of the mask, and are the fast way to
+     * change very many sources at once, such as a whole coastline. Out-of-bounds sources
+     * and wrongly-sized masks are reported with error().
+     */
+    FloodDiff addSources(const Vector<GridLocation>& sources);
+    FloodDiff addSourceMask(const FloodMask& sources);
+    FloodDiff removeSources(const Vector<GridLocation>& sources);
+    FloodDiff removeSourceMask(const FloodMask& sources);
+
+    /* Whether the given cell is currently a water source. */
+    bool isWaterSource(int row, int col) const;
+
+private:
+    int rows = 0, cols = 0;
+    double level = 0;
+    std::int64_t wetCount = 0;
+
+    Grid<double> cellHeights;
+    Grid<double> cellFloodHeights;
+    FloodMask wet;
+
+    /* Where each cell's flood height came from, as an index into the neighbour offsets
+     * (-1 for sources and unreached cells). Following these from any reached cell leads
+     * back to a source along a path no taller than the cell's flood height.
+     */
+    std::vector<signed char> cameFrom;
+    std::vector<bool> isSource;
+
+    /* Cells whose flood heights have changed during an update, and what they used to be.
+     * The flags say which cells are in the list, and are all false between updates.
+     */
+    std::vector<int> changedCells;
+    std::vector<double> oldFloodHeights;
+    std::vector<bool> editing;
+
+    /* Queue entries are (flood height, packed cell index). An entry is only live if the
+     * cell is still on the right side of the water and its flood height hasn't been changed
+     * by an edit since; dead entries are skipped when they come out. The flags say which
+     * cells have a live entry in the shoreline queue.
+     */
+    using Entry = std::pair<double, int>;
+    std::vector<Entry> shoreline;   // Min-heap of dry cells.
+    std::vector<Entry> underwater;  // Max-heap of flooded cells.
+    std::vector<bool>  onShoreline;
+
+    template <typename Stats> std::int64_t moveTo(double height, Stats& stats);
+    template <typename Stats> void rise(double height, std::int64_t& changed, Stats& stats);
+    template <typename Stats> void fall(double height, std::int64_t& changed, Stats& stats);
+    template <typename Stats> void addToShoreline(int index, Stats& stats);
+    void spread(std::vector<Entry>& toVisit, bool noteChanges);
+    void rebuildQueues();
+
+    void noteChange(int index);
+    void wipeSubtree(int index, std::vector<int>& toRestart);
+    void restartAround(const std::vector<int>& cells, std::vector<Entry>& toVisit);
+    FloodDiff settleChanges();
+
+    std::vector<int> indicesOf(const Vector<GridLocation>& cells) const;
+    std::vector<int> indicesOf(const FloodMask& cells) const;
+    FloodDiff addSourceCells(const std::vector<int>& sources);
+    FloodDiff removeSourceCells(const std::vector<int>& sources);
+};
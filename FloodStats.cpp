@@ -0,0 +1,22 @@
+#include "FloodStats.h"
+#include <iomanip>
+#include <sstream>
+using namespace std;
+
+string toString(const FloodStats& stats) {
+    ostringstream out;
+    out << stats;
+    return out.str();
+}
+
+ostream& operator<< (ostream& out, const FloodStats& stats) {
+    ostringstream result;
+    result << stats.cellsVisited << " cells visited, "
+           << stats.enqueues << " enqueued (peak queue " << stats.peakQueueLength << "), "
+           << stats.rejectedByHeight << " too high, "
+           << stats.rejectedAsFlooded << " already flooded; "
+           << fixed << setprecision(2)
+           << stats.seedingSeconds * 1000 << " ms seeding, "
+           << stats.expansionSeconds * 1000 << " ms expanding";
+    return out << result.str();
+}
@@ -0,0 +1,89 @@
+/***************************************************************
+ * File: FloodStats.h
+ *
+ * Counters describing how much work a flood did, and the policies
+ * that flood kernels use to fill them in.
+ */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/* Type representing what a flood did. Every cell that's enqueued is later visited, and
+ * every neighbour of a visited cell that's in bounds is either enqueued or rejected.
+ */
+struct FloodStats {
+    std::int64_t cellsVisited      = 0; // Cells taken off the queue.
+    std::int64_t enqueues          = 0; // Cells put on the queue, sources included.
+    std::int64_t peakQueueLength   = 0; // Most cells on the queue at once.
+    std::int64_t rejectedByHeight  = 0; // Neighbours that were above the water.
+    std::int64_t rejectedAsFlooded = 0; // Neighbours that were already under water.
+    double seedingSeconds   = 0;        // Time spent putting the sources on the queue.
+    double expansionSeconds = 0;        // Time spent spreading out from them.
+};
+
+/* One-line human-readable summary, suitable for a status line. */
+std::string toString(const FloodStats& stats);
+std::ostream& operator<< (std::ostream& out, const FloodStats& stats);
+
+/* Compile-time policies for filling in FloodStats. Flood kernels are templated on the
+ * policy and call its hooks as they go. NoFloodStats's hooks are all empty, so when it's
+ * used the calls inline away to nothing and the kernel costs the same as it would with
+ * no instrumentation at all.
+ */
+struct NoFloodStats {
+    void startSeeding() {}
+    void startExpansion() {}
+    void finish() {}
+    void visited() {}
+    void enqueued(std::size_t /* queueLength */) {}
+    void rejectedByHeight() {}
+    void rejectedAsFlooded() {}
+};
+
+/* Records into a FloodStats, which is reset when recording starts. */
+class RecordFloodStats {
+public:
+    explicit RecordFloodStats(FloodStats& stats) : stats(stats) {
+        this->stats = FloodStats();
+    }
+
+    void startSeeding() {
+        phaseStart = Clock::now();
+    }
+    void startExpansion() {
+        stats.seedingSeconds += secondsSincePhaseStart();
+        phaseStart = Clock::now();
+    }
+    void finish() {
+        stats.expansionSeconds += secondsSincePhaseStart();
+    }
+
+    void visited() {
+        stats.cellsVisited++;
+    }
+    void enqueued(std::size_t queueLength) {
+        stats.enqueues++;
+        stats.peakQueueLength = std::max(stats.peakQueueLength, std::int64_t(queueLength));
+    }
+    void rejectedByHeight() {
+        stats.rejectedByHeight++;
+    }
+    void rejectedAsFlooded() {
+        stats.rejectedAsFlooded++;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    FloodStats& stats;
+    Clock::time_point phaseStart = Clock::now();
+
+    double secondsSincePhaseStart() const {
+        return std::chrono::duration<double>(Clock::now() - phaseStart).count();
+    }
+};
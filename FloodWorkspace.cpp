@@ -0,0 +1,83 @@
+#include "FloodWorkspace.h"
+#include "RisingTides.h"
+#include "error.h"
+#include <algorithm>
+#include <climits>
+using namespace std;
+
+/* The same flood as floodedRegionsIn, with the result and the queue kept between floods. */
+const Grid<bool>& FloodWorkspace::flood(const Grid<double>& terrain,
+                                        const Vector<GridLocation>& sources,
+                                        double height) {
+    int numRows = terrain.numRows();
+    int numCols = terrain.numCols();
+    if (size_t(numRows) * numCols > INT_MAX) error("Terrain too large to flood with a FloodWorkspace.");
+
+    if (result.numRows() != numRows || result.numCols() != numCols) {
+        result.resize(numRows, numCols);
+    }
+    if (result.isEmpty()) return result;
+
+    bool* cells = &result[0][0];
+    fill(cells, cells + size_t(numRows) * numCols, false);
+
+    /* Start out big enough for a frontier running around the whole terrain. */
+    queue.clear(2 * (size_t(numRows) + numCols));
+
+    GridTerrain<> access(terrain, height);
+    FloodedCells<bool> flooded(cells);
+    NoFloodStats stats;
+    seedFlood(access, sources, flooded, queue, stats);
+    spreadFlood<FourConnected>(access, flooded, queue, stats);
+    return result;
+}
+
+size_t FloodWorkspace::queueCapacity() const {
+    return queue.capacity();
+}
+
+
+/***** Test Cases Below This Point *****/
+#include "GUI/SimpleTest.h"
+#include "TestTerrains.h"
+
+STUDENT_TEST("FloodWorkspace matches floodedRegionsIn and reuses its memory.") {
+    FloodWorkspace workspace;
+    Grid<double> world = randomTerrain(80, 90, 137);
+    Vector<GridLocation> sources = { { 0, 0 }, { 40, 45 }, { 40, 45 }, { 79, 89 } };
+
+    const Grid<bool>& first = workspace.flood(world, sources, 5.0);
+    const bool* cells = &first[0][0];
+    size_t capacity = workspace.queueCapacity();
+
+    for (int seed = 0; seed < 5; seed++) {
+        Grid<double> other = randomTerrain(80, 90, seed);
+        for (double height = -1.0; height <= 11.0; height += 1.5) {
+            const Grid<bool>& result = workspace.flood(other, sources, height);
+            EXPECT_EQUAL(result, floodedRegionsIn(other, sources, height));
+            EXPECT(&result[0][0] == cells);
+        }
+    }
+
+    /* None of those frontiers outgrew the queue the workspace started with. */
+    EXPECT_EQUAL(workspace.queueCapacity(), capacity);
+}
+
+STUDENT_TEST("FloodWorkspace handles new sizes and long frontiers.") {
+    FloodWorkspace workspace;
+    EXPECT_EQUAL(workspace.flood(Grid<double>(), {}, 0.0).numRows(), 0);
+
+    /* Sources everywhere means the whole terrain is on the queue at once. */
+    Grid<double> world = randomTerrain(50, 60, 1);
+    Vector<GridLocation> everywhere;
+    for (int row = 0; row < 50; row++) {
+        for (int col = 0; col < 60; col++) {
+            everywhere.add({ row, col });
+        }
+    }
+    EXPECT_EQUAL(workspace.flood(world, everywhere, 0.0), floodedRegionsIn(world, everywhere, 0.0));
+    EXPECT(workspace.queueCapacity() >= 3000);
+
+    Grid<double> small = randomTerrain(7, 3, 2);
+    EXPECT_EQUAL(workspace.flood(small, { { 6, 2 } }, 6.0), floodedRegionsIn(small, { { 6, 2 } }, 6.0));
+}
@@ -0,0 +1,37 @@
+/***************************************************************
+ * File: FloodWorkspace.h
+ *
+ * Scratch space for running many floods one after another, so
+ * that after the first one they don't allocate any memory.
+ */
+#pragma once
+
+#include "grid.h"
+#include "vector.h"
+#include "FloodKernel.h"
+#include <cstddef>
+
+/* Type holding the memory a breadth-first flood needs: the result grid, and the flood
+ * kernel's queue (see FloodKernel.h). Both are kept between floods. The result is only
+ * reallocated when the terrain changes size, and the queue only grows when a flood's
+ * frontier is longer than any before it, so repeated floods over terrains of the same
+ * size (as in the GUI or a batch job) don't touch the heap at all.
+ */
+class FloodWorkspace {
+public:
+    FloodWorkspace() = default;
+
+    /* Same as floodedRegionsIn. The result belongs to the workspace, and is overwritten
+     * by the next flood.
+     */
+    const Grid<bool>& flood(const Grid<double>& terrain,
+                            const Vector<GridLocation>& sources,
+                            double height);
+
+    /* Number of cells the queue has room for. */
+    std::size_t queueCapacity() const;
+
+private:
+    Grid<bool> result;
+    FloodQueue queue;
+};
@@ -80,6 +80,10 @@ HEADERS         *=  ""
 SOURCES         *=  $$files(*.cpp, true)
 HEADERS         *=  $$files(*.h, true)
 
+# Programs under tools/ have their own main() and their own project files.
+SOURCES         -=  $$files(tools/*.cpp, true)
+HEADERS         -=  $$files(tools/*.h, true)
+
 # Gather resource files (image/sound/etc) from res dir, list under "Other files"
 OTHER_FILES     *=  $$files(res/*, true)
 # Gather text files from root dir or anywhere recursively
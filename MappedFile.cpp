@@ -0,0 +1,175 @@
+#include "MappedFile.h"
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifndef _WIN32
+
+namespace {
+    /* Opens the file and maps the given number of bytes of it, reporting errors as exceptions. */
+    char* mapFile(const string& filename, int flags, size_t* bytes, bool create) {
+        int fd = open(filename.c_str(), flags, 0644);
+        if (fd < 0) {
+            throw runtime_error("Cannot open file " + filename);
+        }
+
+        /* New files are sized first; existing files are mapped at whatever size they are. */
+        if (create) {
+            if (ftruncate(fd, *bytes) != 0) {
+                close(fd);
+                throw runtime_error("Cannot resize file " + filename);
+            }
+        } else {
+            struct stat info;
+            if (fstat(fd, &info) != 0) {
+                close(fd);
+                throw runtime_error("Cannot read size of file " + filename);
+            }
+            *bytes = info.st_size;
+        }
+
+        /* mmap refuses to map zero bytes, but an empty file is still a valid file. */
+        if (*bytes == 0) {
+            close(fd);
+            return nullptr;
+        }
+
+        int protection = (flags & O_RDWR)? PROT_READ | PROT_WRITE : PROT_READ;
+        void* result = mmap(nullptr, *bytes, protection, MAP_SHARED, fd, 0);
+        close(fd); // The mapping keeps the file alive.
+
+        if (result == MAP_FAILED) {
+            throw runtime_error("Cannot map file " + filename);
+        }
+        return static_cast<char*>(result);
+    }
+}
+
+MappedFile::MappedFile(const string& filename, bool writable) : filename(filename), writable(writable) {
+    contents = mapFile(filename, writable? O_RDWR : O_RDONLY, &bytes, false);
+}
+
+MappedFile MappedFile::create(const string& filename, size_t size) {
+    MappedFile result;
+    result.filename = filename;
+    result.writable = true;
+    result.bytes    = size;
+    result.contents = mapFile(filename, O_RDWR | O_CREAT | O_TRUNC, &result.bytes, true);
+    return result;
+}
+
+void MappedFile::unmap() {
+    if (contents != nullptr) {
+        munmap(contents, bytes);
+        contents = nullptr;
+    }
+}
+
+void MappedFile::discard(size_t offset, size_t length) {
+    if (contents == nullptr || length == 0) return;
+
+    /* madvise only works on whole pages, so shrink the range inward to page boundaries. */
+    size_t page  = pageSize();
+    size_t start = (offset + page - 1) / page * page;
+    size_t end   = min(offset + length, bytes) / page * page;
+    if (start >= end) return;
+
+    if (writable) {
+        msync(contents + start, end - start, MS_SYNC);
+    }
+    madvise(contents + start, end - start, MADV_DONTNEED);
+}
+
+size_t MappedFile::pageSize() {
+    return sysconf(_SC_PAGESIZE);
+}
+
+#else
+
+/* No mmap available, so read the whole file in and write it back out on destruction. */
+MappedFile::MappedFile(const string& filename, bool writable) : filename(filename), writable(writable) {
+    ifstream input(filename, ios::binary);
+    if (!input) {
+        throw runtime_error("Cannot open file " + filename);
+    }
+    buffer.assign(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+    contents = buffer.data();
+    bytes    = buffer.size();
+}
+
+MappedFile MappedFile::create(const string& filename, size_t size) {
+    ofstream output(filename, ios::binary | ios::trunc);
+    if (!output) {
+        throw runtime_error("Cannot create file " + filename);
+    }
+
+    MappedFile result;
+    result.filename = filename;
+    result.writable = true;
+    result.buffer.assign(size, 0);
+    result.contents = result.buffer.data();
+    result.bytes    = size;
+    return result;
+}
+
+void MappedFile::unmap() {
+    if (contents != nullptr && writable) {
+        ofstream output(filename, ios::binary | ios::trunc);
+        output.write(contents, bytes);
+    }
+    contents = nullptr;
+    buffer.clear();
+}
+
+void MappedFile::discard(size_t, size_t) {
+    // Nothing to drop; the whole file is in memory.
+}
+
+size_t MappedFile::pageSize() {
+    return 1;
+}
+
+#endif
+
+MappedFile::~MappedFile() {
+    unmap();
+}
+
+MappedFile::MappedFile(MappedFile&& rhs) {
+    *this = std::move(rhs);
+}
+
+MappedFile& MappedFile::operator= (MappedFile&& rhs) {
+    if (this != &rhs) {
+        unmap();
+        filename = std::move(rhs.filename);
+        bytes    = rhs.bytes;
+        writable = rhs.writable;
+        buffer   = std::move(rhs.buffer);
+        contents = buffer.empty()? rhs.contents : buffer.data();
+        rhs.contents = nullptr;
+        rhs.bytes    = 0;
+    }
+    return *this;
+}
+
+char* MappedFile::data() {
+    return contents;
+}
+
+const char* MappedFile::data() const {
+    return contents;
+}
+
+size_t MappedFile::size() const {
+    return bytes;
+}
@@ -0,0 +1,66 @@
+/* Memory-mapped files, used to work with terrains that are too large to read into memory. */
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/* Type representing a file mapped into memory. The contents of the file are paged in by
+ * the operating system as they're touched, so mapping a file costs (almost) nothing up
+ * front no matter how large it is.
+ *
+ * On systems without mmap, the file is read into memory instead (and, for writable
+ * mappings, written back out when the MappedFile is destroyed).
+ *
+ * If the file can't be opened or mapped, a std::runtime_error is thrown.
+ */
+class MappedFile {
+public:
+    /* Maps an existing file. Writable mappings write their changes back to the file. */
+    explicit MappedFile(const std::string& filename, bool writable = false);
+
+    /* Creates (or truncates) a file of the given size, zero-filled, and maps it writable. */
+    static MappedFile create(const std::string& filename, std::size_t size);
+
+    /* Unmaps the file, writing back any changes. */
+    ~MappedFile();
+
+    /* Copying is not allowed; moving is. */
+    MappedFile(const MappedFile &) = delete;
+    MappedFile& operator= (const MappedFile &) = delete;
+    MappedFile(MappedFile &&);
+    MappedFile& operator= (MappedFile &&);
+
+    /* Contents of the file. */
+    char* data();
+    const char* data() const;
+    std::size_t size() const;
+
+    /* Hints that the given byte range won't be needed for a while. Any changes to it are
+     * written back to the file and its pages are dropped from memory; touching it again
+     * pages it back in. This is how callers keep their working set bounded.
+     *
+     * Only pages lying entirely inside the range are dropped, so discarding a range
+     * smaller than a page, or one that shares its pages with data still in use, does
+     * nothing. Callers that want to drop pieces of a file on their own should lay those
+     * pieces out on pageSize() boundaries.
+     */
+    void discard(std::size_t offset, std::size_t length);
+
+    /* Granularity of discard, in bytes. On systems without mmap, where discard never
+     * drops anything, this is 1.
+     */
+    static std::size_t pageSize();
+
+private:
+    MappedFile() = default;
+    void unmap();
+
+    std::string filename;
+    char* contents    = nullptr;
+    std::size_t bytes = 0;
+    bool writable     = false;
+
+    /* Fallback storage on systems without mmap. */
+    std::vector<char> buffer;
+};
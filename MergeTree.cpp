@@ -0,0 +1,394 @@
+#include "MergeTree.h"
+#include "error.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+using namespace std;
+
+namespace {
+    const char kMagic[8] = { 'M', 'R', 'G', 'T', 'R', 'E', 'E', '1' };
+
+    /* Bytes each event takes up in a saved merge tree. */
+    const uint64_t kEventBytes = sizeof(double) + sizeof(int64_t) + sizeof(int32_t);
+
+    /* Flood levels are read this many at a time from streams whose size isn't known, so
+     * that a corrupt header can't make us allocate more than the stream actually holds.
+     */
+    const size_t kLevelsPerRead = size_t(1) << 16;
+
+    /* How many bytes are left to read in the stream, or -1 if it can't be told. */
+    int64_t bytesLeftIn(istream& in) {
+        streampos here = in.tellg();
+        if (here == streampos(-1)) {
+            in.clear();
+            return -1;
+        }
+        in.seekg(0, ios::end);
+        streampos end = in.tellg();
+        in.seekg(here);
+        if (!in || end == streampos(-1)) {
+            in.clear();
+            in.seekg(here);
+            return -1;
+        }
+        return int64_t(end - here);
+    }
+
+    /* Union-find over the cells of the terrain. Each region also tracks its size, whether it
+     * contains a source, and a linked list of its cells, so that when a region first joins a
+     * flooded one, every cell in it can be given its flood level. Each cell is handed a flood
+     * level only once, so the lists cost O(n) in total.
+     */
+    class Regions {
+    public:
+        explicit Regions(int numCells)
+            : parent(numCells), area(numCells, 1), hasSource(numCells, false),
+              next(numCells, -1), last(numCells) {
+            iota(parent.begin(), parent.end(), 0);
+            iota(last.begin(), last.end(), 0);
+        }
+
+        int find(int cell) {
+            while (parent[cell] != cell) {
+                parent[cell] = parent[parent[cell]];
+                cell = parent[cell];
+            }
+            return cell;
+        }
+
+        /* Merges two regions (given by their roots), returning the root of the result. */
+        int merge(int lhs, int rhs) {
+            if (area[lhs] < area[rhs]) swap(lhs, rhs);
+            parent[rhs] = lhs;
+            area[lhs] += area[rhs];
+            hasSource[lhs] = hasSource[lhs] || hasSource[rhs];
+
+            next[last[lhs]] = rhs;
+            last[lhs] = last[rhs];
+            return lhs;
+        }
+
+        vector<int> parent;
+        vector<int64_t> area;
+        vector<bool> hasSource;
+
+        /* Cells of each region, as a linked list from the root to last[root]. */
+        vector<int> next;
+        vector<int> last;
+    };
+}
+
+MergeTree::MergeTree(const Grid<double>& terrain, const Vector<GridLocation>& sources)
+    : rows(terrain.numRows()), cols(terrain.numCols()),
+      floodLevel(size_t(rows) * cols, numeric_limits<double>::quiet_NaN()) {
+    int numCells = rows * cols;
+
+    // sources are under water at every height, so they count as infinitely low
+    vector<double> level(numCells);
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            level[row * cols + col] = terrain[row][col];
+        }
+    }
+    vector<bool> isSource(numCells, false);
+    for (GridLocation source: sources) {
+        int index = source.row * cols + source.col;
+        isSource[index] = true;
+        level[index] = -numeric_limits<double>::infinity();
+    }
+
+    // cells go in from lowest to highest; NaN cells are never under water, so they never go in
+    vector<int> order;
+    order.reserve(numCells);
+    for (int index = 0; index < numCells; index++) {
+        if (!isnan(level[index])) order.push_back(index);
+    }
+    sort(order.begin(), order.end(), [&](int lhs, int rhs) {
+        return level[lhs] < level[rhs];
+    });
+
+    Regions regions(numCells);
+    vector<bool> isActive(numCells, false);
+    int64_t floodedArea = 0;
+    int32_t lakes = 0;
+
+    // gives every cell in a newly flooded region its flood level
+    auto floodRegion = [&](int root, double height) {
+        for (int cell = root; cell != -1; cell = regions.next[cell]) {
+            floodLevel[cell] = height;
+        }
+    };
+
+    for (size_t i = 0; i < order.size(); i++) {
+        int index = order[i];
+        double height = level[index];
+
+        // the cell starts as a region of its own
+        isActive[index] = true;
+        int root = index;
+        if (isSource[index]) {
+            regions.hasSource[index] = true;
+            floodRegion(index, height);
+            floodedArea++;
+            lakes++;
+        }
+
+        // and merges with every neighbouring region that's already under the water
+        int row = index / cols;
+        int col = index % cols;
+        const int rowOffsets[] = {  0, 0, -1, 1 };
+        const int colOffsets[] = { -1, 1,  0, 0 };
+        for (int dir = 0; dir < 4; dir++) {
+            int newRow = row + rowOffsets[dir];
+            int newCol = col + colOffsets[dir];
+            if (newRow < 0 || newRow >= rows || newCol < 0 || newCol >= cols) continue;
+
+            int neighbour = newRow * cols + newCol;
+            if (!isActive[neighbour]) continue;
+
+            int other = regions.find(neighbour);
+            if (other == root) continue;
+
+            bool rootFlooded  = regions.hasSource[root];
+            bool otherFlooded = regions.hasSource[other];
+            if (rootFlooded && otherFlooded) {
+                lakes--;
+            } else if (rootFlooded) {
+                floodRegion(other, height);
+                floodedArea += regions.area[other];
+            } else if (otherFlooded) {
+                floodRegion(root, height);
+                floodedArea += regions.area[root];
+            }
+            root = regions.merge(root, other);
+        }
+
+        // record where things stand once every cell at this height is in
+        bool lastAtHeight = i + 1 == order.size() || level[order[i + 1]] != height;
+        if (lastAtHeight && (events.empty() || events.back().area != floodedArea || events.back().lakes != lakes)) {
+            events.push_back({ height, floodedArea, lakes });
+        }
+    }
+}
+
+int MergeTree::numRows() const {
+    return rows;
+}
+
+int MergeTree::numCols() const {
+    return cols;
+}
+
+bool MergeTree::isFloodedAt(int row, int col, double height) const {
+    if (row < 0 || row >= rows || col < 0 || col >= cols) {
+        error("Location out of bounds.");
+    }
+    return floodLevel[size_t(row) * cols + col] <= height;
+}
+
+const MergeTree::Event* MergeTree::eventAt(double height) const {
+    auto after = upper_bound(events.begin(), events.end(), height, [](double level, const Event& event) {
+        return level < event.level;
+    });
+    return after == events.begin()? nullptr : &*(after - 1);
+}
+
+int64_t MergeTree::floodedAreaAt(double height) const {
+    const Event* event = eventAt(height);
+    return event? event->area : 0;
+}
+
+int MergeTree::lakesAt(double height) const {
+    const Event* event = eventAt(height);
+    return event? event->lakes : 0;
+}
+
+/* Format is the magic number, the dimensions, the number of events, the flood levels, and
+ * then the events, all in native byte order.
+ */
+void MergeTree::save(ostream& out) const {
+    int32_t dimensions[2] = { rows, cols };
+    uint64_t numEvents = events.size();
+
+    out.write(kMagic, sizeof(kMagic));
+    out.write(reinterpret_cast<const char*>(dimensions), sizeof(dimensions));
+    out.write(reinterpret_cast<const char*>(&numEvents), sizeof(numEvents));
+    out.write(reinterpret_cast<const char*>(floodLevel.data()), floodLevel.size() * sizeof(double));
+    for (const Event& event: events) {
+        out.write(reinterpret_cast<const char*>(&event.level), sizeof(event.level));
+        out.write(reinterpret_cast<const char*>(&event.area),  sizeof(event.area));
+        out.write(reinterpret_cast<const char*>(&event.lakes), sizeof(event.lakes));
+    }
+    if (!out) error("Couldn't write merge tree.");
+}
+
+MergeTree MergeTree::load(istream& in) {
+    char magic[sizeof(kMagic)];
+    int32_t dimensions[2];
+    uint64_t numEvents;
+
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(dimensions), sizeof(dimensions));
+    in.read(reinterpret_cast<char*>(&numEvents), sizeof(numEvents));
+    if (!in || memcmp(magic, kMagic, sizeof(kMagic)) != 0 || dimensions[0] < 0 || dimensions[1] < 0) {
+        error("Not a merge tree.");
+    }
+
+    /* Check the header against what's actually there before allocating anything for it.
+     * Neither count can overflow: cells fits in 62 bits, and numEvents is compared by
+     * division.
+     */
+    uint64_t cells = uint64_t(dimensions[0]) * uint64_t(dimensions[1]);
+    int64_t bytesLeft = bytesLeftIn(in);
+    if (bytesLeft >= 0 && (cells > uint64_t(bytesLeft) / sizeof(double) ||
+                           numEvents > (uint64_t(bytesLeft) - cells * sizeof(double)) / kEventBytes)) {
+        error("Merge tree data is truncated.");
+    }
+
+    MergeTree result;
+    result.rows = dimensions[0];
+    result.cols = dimensions[1];
+    for (uint64_t done = 0; in && done < cells; ) {
+        size_t count = size_t(min<uint64_t>(cells - done, kLevelsPerRead));
+        result.floodLevel.resize(done + count);
+        in.read(reinterpret_cast<char*>(result.floodLevel.data() + done), count * sizeof(double));
+        done += count;
+    }
+
+    for (uint64_t i = 0; in && i < numEvents; i++) {
+        Event event;
+        in.read(reinterpret_cast<char*>(&event.level), sizeof(event.level));
+        in.read(reinterpret_cast<char*>(&event.area),  sizeof(event.area));
+        in.read(reinterpret_cast<char*>(&event.lakes), sizeof(event.lakes));
+        result.events.push_back(event);
+    }
+    if (!in) error("Merge tree data is truncated.");
+
+    return result;
+}
+
+
+/***** Test Cases Below This Point *****/
+#include "GUI/SimpleTest.h"
+#include "RisingTides.h"
+#include "TestTerrains.h"
+#include <sstream>
+
+namespace {
+    /* Counts the 4-connected regions of flooded cells the slow way. */
+    int countLakes(const Grid<bool>& flooded) {
+        Grid<bool> seen(flooded.numRows(), flooded.numCols());
+        int lakes = 0;
+        for (int row = 0; row < flooded.numRows(); row++) {
+            for (int col = 0; col < flooded.numCols(); col++) {
+                if (!flooded[row][col] || seen[row][col]) continue;
+
+                lakes++;
+                vector<GridLocation> toVisit = { { row, col } };
+                seen[row][col] = true;
+                while (!toVisit.empty()) {
+                    GridLocation curr = toVisit.back();
+                    toVisit.pop_back();
+                    for (GridLocation next: { GridLocation(curr.row - 1, curr.col), GridLocation(curr.row + 1, curr.col),
+                                              GridLocation(curr.row, curr.col - 1), GridLocation(curr.row, curr.col + 1) }) {
+                        if (flooded.inBounds(next) && flooded[next] && !seen[next]) {
+                            seen[next] = true;
+                            toVisit.push_back(next);
+                        }
+                    }
+                }
+            }
+        }
+        return lakes;
+    }
+}
+
+STUDENT_TEST("MergeTree queries match floodedRegionsIn.") {
+    for (int seed = 0; seed < 4; seed++) {
+        Grid<double> world = randomTerrain(30, 40, seed);
+        world[3][3] = numeric_limits<double>::quiet_NaN();
+
+        /* Includes a source sitting on a high cell and a duplicate. */
+        world[25][5] = 10;
+        Vector<GridLocation> sources = {
+            { 0, 0 }, { 15, 20 }, { 29, 39 }, { 25, 5 }, { 15, 20 }
+        };
+
+        MergeTree tree(world, sources);
+        for (double height = -1.0; height <= 11.0; height += 0.5) {
+            Grid<bool> flooded = floodedRegionsIn(world, sources, height);
+
+            int area = 0;
+            for (int row = 0; row < world.numRows(); row++) {
+                for (int col = 0; col < world.numCols(); col++) {
+                    EXPECT_EQUAL(tree.isFloodedAt(row, col, height), flooded[row][col]);
+                    if (flooded[row][col]) area++;
+                }
+            }
+            EXPECT_EQUAL(tree.floodedAreaAt(height), area);
+            EXPECT_EQUAL(tree.lakesAt(height), countLakes(flooded));
+        }
+    }
+}
+
+STUDENT_TEST("MergeTree survives a round trip through a stream.") {
+    Grid<double> world = randomTerrain(20, 25, 137);
+    Vector<GridLocation> sources = { { 10, 10 }, { 0, 24 } };
+    MergeTree tree(world, sources);
+
+    stringstream stream;
+    tree.save(stream);
+    MergeTree copy = MergeTree::load(stream);
+
+    EXPECT_EQUAL(copy.numRows(), 20);
+    EXPECT_EQUAL(copy.numCols(), 25);
+    for (double height = 0.0; height <= 10.0; height += 1.0) {
+        EXPECT_EQUAL(copy.floodedAreaAt(height), tree.floodedAreaAt(height));
+        EXPECT_EQUAL(copy.lakesAt(height), tree.lakesAt(height));
+        EXPECT_EQUAL(copy.isFloodedAt(10, 11, height), tree.isFloodedAt(10, 11, height));
+    }
+
+    stringstream garbage("this is not a merge tree");
+    EXPECT_ERROR(MergeTree::load(garbage));
+}
+
+STUDENT_TEST("MergeTree rejects saved trees whose header doesn't match their size.") {
+    MergeTree tree(randomTerrain(6, 7, 137), { { 3, 3 } });
+    stringstream stream;
+    tree.save(stream);
+    string saved = stream.str();
+
+    uint64_t numEvents;
+    memcpy(&numEvents, &saved[16], sizeof(numEvents));
+
+    /* The dimensions come right after the magic number, and the event count after them. */
+    auto withHeader = [&](int32_t rows, int32_t cols, uint64_t numEvents) {
+        string result = saved;
+        memcpy(&result[8],  &rows, sizeof(rows));
+        memcpy(&result[12], &cols, sizeof(cols));
+        memcpy(&result[16], &numEvents, sizeof(numEvents));
+        return result;
+    };
+
+    /* Huge dimensions and event counts are errors, not attempts to allocate them. */
+    for (string bad: { withHeader(numeric_limits<int32_t>::max(), numeric_limits<int32_t>::max(), 0),
+                       withHeader(6, 7, numeric_limits<uint64_t>::max()),
+                       withHeader(6, 7, numEvents + 1),
+                       saved.substr(0, saved.size() - 1) }) {
+        stringstream in(bad);
+        EXPECT_ERROR(MergeTree::load(in));
+    }
+
+    /* Trees at the start of a longer stream still load. */
+    stringstream longer(saved + "more data");
+    EXPECT_EQUAL(MergeTree::load(longer).numCols(), 7);
+}
+
+STUDENT_TEST("MergeTree of a world with no sources never floods.") {
+    MergeTree tree(randomTerrain(5, 5, 0), {});
+    EXPECT_EQUAL(tree.floodedAreaAt(numeric_limits<double>::infinity()), 0);
+    EXPECT_EQUAL(tree.lakesAt(numeric_limits<double>::infinity()), 0);
+    EXPECT(!tree.isFloodedAt(2, 2, numeric_limits<double>::infinity()));
+}
@@ -0,0 +1,82 @@
+/***************************************************************
+ * File: MergeTree.h
+ *
+ * An index over a terrain and its water sources that answers
+ * questions about floods ("is this cell under water?", "how much
+ * is under water?", "how many separate lakes are there?") at any
+ * water height without running a flood.
+ */
+#pragma once
+
+#include "grid.h"
+#include "vector.h"
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+/* Type representing a merge tree (component tree) of a terrain.
+ *
+ * Imagine raising the water level from -infinity to +infinity. Cells at or below the
+ * water join up into connected regions, and those regions merge with one another as the
+ * water rises. Sources count as being infinitely low, since they're under water at every
+ * height. A region is flooded once it contains a source.
+ *
+ * The tree is built by replaying that process with a union-find structure, one cell at a
+ * time in order of height. Along the way it records
+ *
+ *   - for each cell, the water height at which its region first contains a source (the
+ *     point where its branch of the tree joins a flooded branch), and
+ *   - each height at which the flooded area or the number of flooded regions changes.
+ *
+ * That's everything the queries below need, so the rest of the tree isn't kept.
+ */
+class MergeTree {
+public:
+    /* Creates an empty tree. */
+    MergeTree() = default;
+
+    /* Builds the tree for the given terrain and sources. Takes O(n log n) time for a
+     * terrain of n cells.
+     */
+    MergeTree(const Grid<double>& terrain, const Vector<GridLocation>& sources);
+
+    int numRows() const;
+    int numCols() const;
+
+    /* Whether the given cell is under water at the given water height. O(1). */
+    bool isFloodedAt(int row, int col, double height) const;
+
+    /* Number of flooded cells at the given water height. O(log n). */
+    std::int64_t floodedAreaAt(double height) const;
+
+    /* Number of separate bodies of water (4-connected regions of flooded cells) at the
+     * given water height. O(log n).
+     */
+    int lakesAt(double height) const;
+
+    /* Writes the tree to a stream, or reads one back. Reading reports malformed data
+     * with error().
+     */
+    void save(std::ostream& out) const;
+    static MergeTree load(std::istream& in);
+
+private:
+    int rows = 0, cols = 0;
+
+    /* Water height at which each cell floods; NaN for cells that never do. */
+    std::vector<double> floodLevel;
+
+    /* Heights at which the flooded area or number of lakes changes, in increasing order,
+     * along with the area and number of lakes from that height up to the next one.
+     */
+    struct Event {
+        double level;
+        std::int64_t area;
+        std::int32_t lakes;
+    };
+    std::vector<Event> events;
+
+    /* Last event at or below the given height, or nullptr if there isn't one. */
+    const Event* eventAt(double height) const;
+};
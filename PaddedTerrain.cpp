@@ -0,0 +1,47 @@
+#include "PaddedTerrain.h"
+#include <algorithm>
+#include <limits>
+using namespace std;
+
+/* Everything starts out as +infinity, and then the interior is copied in row by row. */
+PaddedTerrain::PaddedTerrain(const Grid<double>& terrain)
+    : rows(terrain.numRows()), cols(terrain.numCols()),
+      heights(size_t(rows + 2) * (cols + 2), numeric_limits<double>::infinity()) {
+    for (int row = 0; row < rows; row++) {
+        if (cols == 0) break;
+        const double* from = &terrain[row][0];
+        copy(from, from + cols, heights.begin() + indexOf(row, 0));
+    }
+}
+
+int PaddedTerrain::numRows() const {
+    return rows;
+}
+
+int PaddedTerrain::numCols() const {
+    return cols;
+}
+
+bool PaddedTerrain::isEmpty() const {
+    return rows == 0 || cols == 0;
+}
+
+int PaddedTerrain::stride() const {
+    return cols + 2;
+}
+
+int PaddedTerrain::indexOf(int row, int col) const {
+    return (row + 1) * stride() + (col + 1);
+}
+
+double PaddedTerrain::get(int row, int col) const {
+    return heights[indexOf(row, col)];
+}
+
+const double* PaddedTerrain::data() const {
+    return heights.data();
+}
+
+const double* PaddedTerrain::row(int row) const {
+    return heights.data() + indexOf(row, 0);
+}
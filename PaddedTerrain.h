@@ -0,0 +1,50 @@
+/***************************************************************
+ * File: PaddedTerrain.h
+ *
+ * A flat copy of a terrain surrounded by a ring of cells that
+ * are infinitely high, so that code walking from a cell to its
+ * neighbours never has to check whether it's fallen off the map.
+ */
+#pragma once
+
+#include "grid.h"
+#include <vector>
+
+/* Type representing a terrain stored as one contiguous array of heights, row by row,
+ * with one extra cell of +infinity on every side. Interior cell (row, col) lives at
+ * index (row + 1) * stride() + (col + 1), so its neighbours are always at index - 1,
+ * index + 1, index - stride(), and index + stride().
+ */
+class PaddedTerrain {
+public:
+    /* Creates an empty terrain. */
+    PaddedTerrain() = default;
+
+    /* Copies the heights out of a Grid<double>. */
+    explicit PaddedTerrain(const Grid<double>& terrain);
+
+    int numRows() const;
+    int numCols() const;
+    bool isEmpty() const;
+
+    /* Number of array slots between one row and the next (numCols() + 2). */
+    int stride() const;
+
+    /* Index in data() of the given interior cell. Doesn't check bounds. */
+    int indexOf(int row, int col) const;
+
+    /* Height of the given interior cell. Doesn't check bounds. */
+    double get(int row, int col) const;
+
+    /* The padded array, border included. */
+    const double* data() const;
+
+    /* Pointer to the first interior cell of the given row; the row's numCols() heights
+     * follow it contiguously.
+     */
+    const double* row(int row) const;
+
+private:
+    int rows = 0, cols = 0;
+    std::vector<double> heights;
+};
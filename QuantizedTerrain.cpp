@@ -0,0 +1,101 @@
+#include "QuantizedTerrain.h"
+#include "error.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+using namespace std;
+
+namespace {
+    /* Most distinct heights a terrain can have; the last code is saved for NaN. */
+    const size_t kMaxLevels = QuantizedTerrain::kNaNCode;
+
+    /* Gathers up the distinct heights in the terrain, giving up as soon as there are too many. Negative
+     * zero compares and hashes the same as zero, so the two share a code.
+     */
+    bool distinctHeights(const Grid<double>& terrain, unordered_map<double, uint16_t>& result) {
+        for (int row = 0; row < terrain.numRows(); row++) {
+            const double* line = &terrain[row][0];
+            for (int col = 0; col < terrain.numCols(); col++) {
+                if (isnan(line[col])) continue;
+                if (result.emplace(line[col], 0).second && result.size() > kMaxLevels) return false;
+            }
+        }
+        return true;
+    }
+}
+
+/* Codes are handed out in two passes. The first collects the distinct heights and ranks them, and the
+ * second looks up each cell's rank. The hash table never holds more than 65536 heights, however large
+ * the terrain is.
+ */
+QuantizedTerrain::QuantizedTerrain(const Grid<double>& terrain)
+    : rows(terrain.numRows()), cols(terrain.numCols()) {
+    if (isEmpty()) return;
+
+    unordered_map<double, uint16_t> ranks;
+    if (!distinctHeights(terrain, ranks)) {
+        error("Terrain has more than " + to_string(kMaxLevels) + " distinct heights, so it can't be quantized exactly.");
+    }
+
+    for (const auto& entry: ranks) {
+        heights.push_back(entry.first);
+    }
+    sort(heights.begin(), heights.end());
+    for (size_t i = 0; i < heights.size(); i++) {
+        ranks[heights[i]] = i;
+    }
+
+    codes.resize(size_t(rows) * cols);
+    for (int row = 0; row < rows; row++) {
+        const double* line = &terrain[row][0];
+        uint16_t* out = codes.data() + size_t(row) * cols;
+        for (int col = 0; col < cols; col++) {
+            out[col] = isnan(line[col])? kNaNCode : ranks[line[col]];
+        }
+    }
+}
+
+bool QuantizedTerrain::fits(const Grid<double>& terrain) {
+    if (terrain.isEmpty()) return true;
+
+    unordered_map<double, uint16_t> ranks;
+    return distinctHeights(terrain, ranks);
+}
+
+int QuantizedTerrain::numRows() const {
+    return rows;
+}
+
+int QuantizedTerrain::numCols() const {
+    return cols;
+}
+
+bool QuantizedTerrain::isEmpty() const {
+    return rows == 0 || cols == 0;
+}
+
+uint16_t QuantizedTerrain::code(int row, int col) const {
+    return codes[size_t(row) * cols + col];
+}
+
+double QuantizedTerrain::get(int row, int col) const {
+    uint16_t value = code(row, col);
+    return value == kNaNCode? numeric_limits<double>::quiet_NaN() : heights[value];
+}
+
+/* The number of distinct heights at or below the water. NaN is at or above nothing, so nothing is below
+ * it, which matches how a NaN water height compares against the heights themselves.
+ */
+uint32_t QuantizedTerrain::codeLimit(double height) const {
+    if (isnan(height)) return 0;
+    return upper_bound(heights.begin(), heights.end(), height) - heights.begin();
+}
+
+const uint16_t* QuantizedTerrain::data() const {
+    return codes.data();
+}
+
+const vector<double>& QuantizedTerrain::levels() const {
+    return heights;
+}
@@ -0,0 +1,61 @@
+/***************************************************************
+ * File: QuantizedTerrain.h
+ *
+ * A terrain stored in two bytes per cell instead of eight, for
+ * terrains with few enough distinct heights that every one of
+ * them can be given its own 16-bit code.
+ */
+#pragma once
+
+#include "grid.h"
+#include <cstdint>
+#include <vector>
+
+/* Type representing a terrain whose heights have been replaced by 16-bit codes. The codes
+ * are the ranks of the heights among all the distinct heights in the terrain, so they sort
+ * the same way the heights do, and a cell is at or below a water height exactly when its
+ * code is below codeLimit of that height. Floods over the codes therefore give exactly the
+ * same results as floods over the heights, while reading a quarter as much memory.
+ *
+ * This is exact for any terrain with at most 65535 distinct heights, which covers heights
+ * stored to the nearest centimeter (or any other fixed step) over a range of up to 655m.
+ * NaN cells get a code of their own, which is never below any limit.
+ */
+class QuantizedTerrain {
+public:
+    /* Code given to NaN cells. */
+    static const std::uint16_t kNaNCode = 0xFFFF;
+
+    /* Creates an empty terrain. */
+    QuantizedTerrain() = default;
+
+    /* Quantizes the given terrain. Terrains with more than 65535 distinct heights can't be
+     * quantized exactly, and are reported with error(); use fits to check ahead of time.
+     */
+    explicit QuantizedTerrain(const Grid<double>& terrain);
+
+    /* Whether the given terrain has few enough distinct heights to be quantized. */
+    static bool fits(const Grid<double>& terrain);
+
+    int numRows() const;
+    int numCols() const;
+    bool isEmpty() const;
+
+    /* Code and height of the given cell. These don't check bounds. */
+    std::uint16_t code(int row, int col) const;
+    double get(int row, int col) const;
+
+    /* Cells whose codes are below this are at or below the given water height. */
+    std::uint32_t codeLimit(double height) const;
+
+    /* The codes, row by row. */
+    const std::uint16_t* data() const;
+
+    /* The distinct heights in the terrain, in increasing order; code i stands for levels()[i]. */
+    const std::vector<double>& levels() const;
+
+private:
+    int rows = 0, cols = 0;
+    std::vector<std::uint16_t> codes;
+    std::vector<double> heights;
+};
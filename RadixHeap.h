@@ -0,0 +1,104 @@
+/***************************************************************
+ * File: RadixHeap.h
+ *
+ * A priority queue for searches where the smallest key never goes
+ * down, like Dijkstra's algorithm. Each item is moved between
+ * buckets at most once per bit of its key, rather than being
+ * compared its way up and down a heap.
+ */
+#pragma once
+
+#include "error.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+/* Converts a double to a 64-bit key that sorts the same way, so that doubles can be used
+ * as RadixHeap keys. Negative zero is treated as zero. NaN has no place in the order and
+ * mustn't be converted.
+ */
+inline std::uint64_t radixKeyFor(double value) {
+    if (value == 0) value = 0;
+
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    /* Positive doubles sort like their bits once the sign bit is set; negative doubles sort
+     * backwards, so all of their bits get flipped.
+     */
+    const std::uint64_t signBit = std::uint64_t(1) << 63;
+    return (bits & signBit)? ~bits : bits | signBit;
+}
+
+/* Type representing a monotone priority queue: items come out smallest key first, and
+ * an item may only go in if its key is at least the key of the last item that came out.
+ * Items with the same key come out in the order they went in.
+ *
+ * Bucket b holds the items whose keys first differ from the last key that came out at
+ * bit b - 1, and bucket 0 holds the items whose keys equal it. Bucket 0 is read from the
+ * front like a queue. When it runs dry, the lowest nonempty bucket is emptied into the
+ * buckets below it, and since the keys in it all agree with each other on every bit above
+ * that one, each item lands in a strictly lower bucket.
+ */
+template <typename ValueType> class RadixHeap {
+public:
+    bool isEmpty() const {
+        return count == 0;
+    }
+
+    std::size_t size() const {
+        return count;
+    }
+
+    /* Adds an item. Keys lower than the last one dequeued are reported with error(). */
+    void enqueue(std::uint64_t key, const ValueType& value) {
+        if (key < last) error("RadixHeap keys can't be lower than the last key dequeued.");
+        buckets[bucketFor(key)].push_back({ key, value });
+        count++;
+    }
+
+    /* Removes and returns the item with the lowest key. Empty heaps are reported with error(). */
+    std::pair<std::uint64_t, ValueType> dequeue() {
+        if (count == 0) error("Can't dequeue from an empty RadixHeap.");
+        if (front == buckets[0].size()) refill();
+
+        std::pair<std::uint64_t, ValueType> result = buckets[0][front++];
+        count--;
+        if (front == buckets[0].size()) {
+            buckets[0].clear();
+            front = 0;
+        }
+        return result;
+    }
+
+private:
+    static const int kNumBuckets = 65;
+
+    std::vector<std::pair<std::uint64_t, ValueType>> buckets[kNumBuckets];
+    std::size_t front = 0;      // Next item to read from bucket 0.
+    std::size_t count = 0;
+    std::uint64_t last = 0;
+
+    int bucketFor(std::uint64_t key) const {
+        return key == last? 0 : 64 - __builtin_clzll(key ^ last);
+    }
+
+    /* Finds the lowest nonempty bucket, makes its smallest key the new last key, and
+     * redistributes it. At least that one item ends up in bucket 0.
+     */
+    void refill() {
+        int bucket = 1;
+        while (buckets[bucket].empty()) bucket++;
+
+        last = buckets[bucket][0].first;
+        for (const auto& item: buckets[bucket]) {
+            if (item.first < last) last = item.first;
+        }
+        for (const auto& item: buckets[bucket]) {
+            buckets[bucketFor(item.first)].push_back(item);
+        }
+        buckets[bucket].clear();
+    }
+};
@@ -5,9 +5,158 @@
  */
 
 #include "RisingTides.h"
+#include "FloodKernel.h"
+#include "RadixHeap.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    #include <arm_neon.h>
+#endif
 
 using namespace std;
 
+namespace {
+    /* Terrains smaller than this are flooded sequentially even when a parallel flood is
+     * requested, since starting up the worker threads costs more than the flood itself.
+     */
+    const int kMinParallelCells = 1 << 16;
+
+    /* How many frontier cells a worker thread claims at once. */
+    const size_t kFrontierChunkSize = 1024;
+
+    /* Reusable barrier used to keep the worker threads in lockstep between BFS levels. */
+    class LevelBarrier {
+    public:
+        explicit LevelBarrier(int numThreads) : numThreads(numThreads) {}
+
+        /* Blocks until all threads have called wait() for the current round. */
+        void wait() {
+            unique_lock<mutex> lock(barrierLock);
+            size_t round = currentRound;
+            numWaiting++;
+            if (numWaiting == numThreads) {
+                numWaiting = 0;
+                currentRound++;
+                allArrived.notify_all();
+            } else {
+                allArrived.wait(lock, [&] { return currentRound != round; });
+            }
+        }
+
+    private:
+        mutex barrierLock;
+        condition_variable allArrived;
+        int numThreads;
+        int numWaiting = 0;
+        size_t currentRound = 0;
+    };
+
+    /* How many heights wetLanes compares against the water level at once. */
+#if defined(__AVX__)
+    const int kLanes = 4;
+#elif defined(__SSE2__) || (defined(__ARM_NEON) && defined(__aarch64__))
+    const int kLanes = 2;
+#else
+    const int kLanes = 1;
+#endif
+
+    /* Compares heights[0 .. kLanes) against the water level, returning a bitmask with bit i
+     * set if heights[i] is at or below the water. NaN heights are never at or below anything,
+     * same as with the <= operator.
+     */
+    inline unsigned wetLanes(const double* heights, double height) {
+#if defined(__AVX__)
+        __m256d cmp = _mm256_cmp_pd(_mm256_loadu_pd(heights), _mm256_set1_pd(height), _CMP_LE_OQ);
+        return _mm256_movemask_pd(cmp);
+#elif defined(__SSE2__)
+        return _mm_movemask_pd(_mm_cmple_pd(_mm_loadu_pd(heights), _mm_set1_pd(height)));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        uint64x2_t cmp = vcleq_f64(vld1q_f64(heights), vdupq_n_f64(height));
+        return (vgetq_lane_u64(cmp, 0) & 1) | (vgetq_lane_u64(cmp, 1) & 2);
+#else
+        return heights[0] <= height;
+#endif
+    }
+
+    /* Returns the first column in [from, to) of the row whose height is above the water, or
+     * to if there isn't one.
+     */
+    int firstDryIn(const double* row, int from, int to, double height) {
+        const unsigned allWet = (1u << kLanes) - 1;
+        while (from + kLanes <= to) {
+            unsigned wet = wetLanes(row + from, height);
+            if (wet != allWet) {
+                int lane = 0;
+                while (wet & (1u << lane)) lane++;
+                return from + lane;
+            }
+            from += kLanes;
+        }
+        while (from < to && row[from] <= height) from++;
+        return from;
+    }
+
+    /* Returns the first column in [from, to) of the row whose height is at or below the water,
+     * or to if there isn't one.
+     */
+    int firstWetIn(const double* row, int from, int to, double height) {
+        while (from + kLanes <= to) {
+            unsigned wet = wetLanes(row + from, height);
+            if (wet != 0) {
+                int lane = 0;
+                while (!(wet & (1u << lane))) lane++;
+                return from + lane;
+            }
+            from += kLanes;
+        }
+        while (from < to && !(row[from] <= height)) from++;
+        return from;
+    }
+
+    /* Returns the leftmost column l such that columns [l, to) of the row are all at or below
+     * the water, scanning leftward from to.
+     */
+    int wetRunStart(const double* row, int to, double height) {
+        const unsigned allWet = (1u << kLanes) - 1;
+        while (to - kLanes >= 0) {
+            unsigned wet = wetLanes(row + to - kLanes, height);
+            if (wet != allWet) {
+                int lane = kLanes - 1;
+                while (wet & (1u << lane)) lane--;
+                return to - kLanes + lane + 1;
+            }
+            to -= kLanes;
+        }
+        while (to > 0 && row[to - 1] <= height) to--;
+        return to;
+    }
+
+    /* Atomically marks the cell with the given index as flooded. Returns true if this call
+     * is the one that flooded it, and false if some other thread got there first.
+     */
+    bool claimCell(vector<atomic<uint64_t>>& visited, int index) {
+        uint64_t bit = uint64_t(1) << (index & 63);
+        atomic<uint64_t>& word = visited[index >> 6];
+
+        /* Cheap check first so that already-flooded cells don't cost a read-modify-write. */
+        if (word.load(memory_order_relaxed) & bit) return false;
+        return !(word.fetch_or(bit, memory_order_relaxed) & bit);
+    }
+}
 
 /* floodedRegionsIn is a function that takes in terrain which is a grid of doubles (a list of locations of water sources),
  * sources which is a vector containing GridLocations (what square the water originates from),
@@ -19,56 +168,1175 @@ using namespace std;
 Grid<bool> floodedRegionsIn(const Grid<double>& terrain,
                             const Vector<GridLocation>& sources,
                             double height) {
-    // new grid to flood
-    Grid<bool> newTerrain(terrain.numRows(), terrain.numCols());
+    NoFloodStats stats;
+    return floodKernel<FourConnected, SolidTerrain>(terrain, sources, height, SolidTerrain(), stats);
+}
+
+/* Same search, with the counters switched on. */
+Grid<bool> floodedRegionsIn(const Grid<double>& terrain,
+                            const Vector<GridLocation>& sources,
+                            double height,
+                            FloodStats& stats) {
+    RecordFloodStats recorder(stats);
+    return floodKernel<FourConnected, SolidTerrain>(terrain, sources, height, SolidTerrain(), recorder);
+}
+
+
+namespace {
+    /* Permeability for the analytics flood: sources above the water flood anyway, so they let the water in
+     * too. They're kept in a sorted list and looked up whenever a neighbour is too high, which is rare enough
+     * not to matter.
+     */
+    class HighSourcesAdmitted {
+    public:
+        explicit HighSourcesAdmitted(const vector<int>& highSources) : highSources(&highSources) {}
+
+        bool admits(int index, double cellHeight, double waterHeight) const {
+            return cellHeight <= waterHeight || binary_search(highSources->begin(), highSources->end(), index);
+        }
+
+    private:
+        const vector<int>* highSources;
+    };
+
+    /* Stats policy that adds up the flooded area and the shoreline. */
+    class AnalyticsStats: public NoFloodStats {
+    public:
+        explicit AnalyticsStats(FloodAnalytics& analytics) : analytics(analytics) {}
+
+        void enqueued(size_t /* queueLength */) {
+            analytics.floodedArea++;
+        }
+        void rejectedByHeight() {
+            analytics.shorelineEdges++;
+        }
+
+    private:
+        FloodAnalytics& analytics;
+    };
+}
+
+/* The analytics come straight out of the flood kernel. Every flooded cell is enqueued exactly once, so the area
+ * is the number of enqueues. A dry neighbour of a flooded cell stays dry (if it were at or below the water it
+ * would have been flooded from there), so each neighbour turned away is one edge of shoreline. And since each
+ * source's flood runs to completion before the next source is looked at, a source that isn't flooded by then
+ * isn't connected to any earlier one.
+ *
+ * The one wrinkle is sources above the water: they flood anyway, so water can't be turned away from them.
+ */
+Grid<bool> floodedRegionsIn(const Grid<double>& terrain,
+                            const Vector<GridLocation>& sources,
+                            double height,
+                            FloodAnalytics& analytics) {
+    analytics = FloodAnalytics();
+
+    int numRows = terrain.numRows();
+    int numCols = terrain.numCols();
+    Grid<bool> result(numRows, numCols);
+    if (result.isEmpty()) return result;
+
+    vector<int> highSources;
+    for (GridLocation source: sources) {
+        if (!(terrain[source.row][source.col] <= height)) highSources.push_back(source.row * numCols + source.col);
+    }
+    sort(highSources.begin(), highSources.end());
+
+    GridTerrain<HighSourcesAdmitted> cells(terrain, height, HighSourcesAdmitted(highSources));
+    FloodedCells<bool> flooded(&result[0][0]);
+    FloodQueue queue;
+    AnalyticsStats stats(analytics);
+
+    for (GridLocation source: sources) {
+        int index = cells.indexOf(source.row, source.col);
+        if (flooded.test(index)) continue;
+
+        analytics.waterBodies++;
+        flooded.set(index);
+        queue.enqueue(index);
+        stats.enqueued(queue.size());
+        spreadFlood<FourConnected>(cells, flooded, queue, stats);
+    }
+    return result;
+}
+
+/* floodedRegionsInParallel runs the same breadth-first search as floodedRegionsIn, but one level at a time.
+ * Each level (the frontier) is held as one list of packed cell indices per thread. The threads claim chunks
+ * of the frontier, flood the unflooded neighbours at or below the water level into their own list for the
+ * next level, and then wait at a barrier until everyone is done before moving on to the next level.
+ * A cell can be reached by two threads at once, so the visited set is an atomic bitmap and only the thread
+ * whose fetch_or sets the bit gets to add the cell to its list.
+ */
+Grid<bool> floodedRegionsInParallel(const Grid<double>& terrain,
+                                    const Vector<GridLocation>& sources,
+                                    double height,
+                                    int numThreads) {
+    if (numThreads <= 0) {
+        numThreads = max(1, int(thread::hardware_concurrency()));
+    }
+
+    // small terrains (or a single thread) aren't worth the overhead of starting threads
+    int numRows = terrain.numRows();
+    int numCols = terrain.numCols();
+    if (numThreads == 1 || numRows * numCols < kMinParallelCells) {
+        return floodedRegionsIn(terrain, sources, height);
+    }
+
+    // one bit per cell, packed into 64-bit words
+    vector<atomic<uint64_t>> visited((numRows * numCols + 63) / 64);
+    for (auto& word: visited) {
+        word.store(0, memory_order_relaxed);
+    }
+
+    // each thread reads from the current frontier and writes into its own list for the next one
+    vector<vector<int>> frontier(numThreads), nextFrontier(numThreads);
+    vector<size_t> frontierStart(numThreads + 1, 0);
+
+    // the sources make up the first level
+    for (GridLocation source: sources) {
+        int index = source.row * numCols + source.col;
+        if (claimCell(visited, index)) {
+            frontier[0].push_back(index);
+        }
+    }
+    frontierStart[1] = frontier[0].size();
+    for (int i = 2; i <= numThreads; i++) {
+        frontierStart[i] = frontierStart[1];
+    }
+
+    atomic<size_t> nextChunk(0);
+    bool finished = frontier[0].empty();
+    LevelBarrier barrier(numThreads);
+    Grid<bool> newTerrain(numRows, numCols);
+
+    auto worker = [&](int id) {
+        while (!finished) {
+            // looked up each level, since thread 0 swaps the lists around between levels
+            vector<int>& output = nextFrontier[id];
+
+            // claim chunks of the current level until it's used up
+            size_t total = frontierStart[numThreads];
+            size_t low;
+            while ((low = nextChunk.fetch_add(kFrontierChunkSize)) < total) {
+                size_t high = min(total, low + kFrontierChunkSize);
+
+                // find which thread's list the chunk starts in, then walk forward through the lists
+                int list = 0;
+                while (frontierStart[list + 1] <= low) list++;
+                for (size_t i = low; i < high; i++) {
+                    while (frontierStart[list + 1] <= i) list++;
+                    int index = frontier[list][i - frontierStart[list]];
+                    int row = index / numCols;
+                    int col = index % numCols;
+
+                    // flood each cardinal neighbour that's in bounds and at or below the water level
+                    if (col > 0 && terrain[row][col - 1] <= height && claimCell(visited, index - 1)) {
+                        output.push_back(index - 1);
+                    }
+                    if (col + 1 < numCols && terrain[row][col + 1] <= height && claimCell(visited, index + 1)) {
+                        output.push_back(index + 1);
+                    }
+                    if (row > 0 && terrain[row - 1][col] <= height && claimCell(visited, index - numCols)) {
+                        output.push_back(index - numCols);
+                    }
+                    if (row + 1 < numRows && terrain[row + 1][col] <= height && claimCell(visited, index + numCols)) {
+                        output.push_back(index + numCols);
+                    }
+                }
+            }
+
+            // once everyone is done with this level, thread 0 promotes the next level
+            barrier.wait();
+            if (id == 0) {
+                frontier.swap(nextFrontier);
+                for (int i = 0; i < numThreads; i++) {
+                    nextFrontier[i].clear();
+                    frontierStart[i + 1] = frontierStart[i] + frontier[i].size();
+                }
+                finished = frontierStart[numThreads] == 0;
+                nextChunk = 0;
+            }
+            barrier.wait();
+        }
+
+        // copy the bitmap into the result, with the rows dealt out among the threads
+        for (int row = id; row < numRows; row += numThreads) {
+            for (int col = 0; col < numCols; col++) {
+                int index = row * numCols + col;
+                newTerrain[row][col] = (visited[index >> 6].load(memory_order_relaxed) >> (index & 63)) & 1;
+            }
+        }
+    };
+
+    vector<thread> threads;
+    for (int id = 1; id < numThreads; id++) {
+        threads.emplace_back(worker, id);
+    }
+    worker(0);
+    for (thread& t: threads) {
+        t.join();
+    }
+
+    return newTerrain;
+}
+
+/* floodHeightsIn is a priority-flood: it's Dijkstra's algorithm, except the "length" of a path is the tallest
+ * cell on it rather than the sum of the cells. The sources go in first with a height of negative infinity.
+ * Cells come out of the priority queue in order of increasing flood height, and whenever a cell comes out,
+ * each neighbour that hasn't been reached yet gets a flood height of max(the cell's flood height, its own height).
+ * Since cells come out lowest first, the first height a cell is given is already the lowest one possible,
+ * so every cell is enqueued at most once.
+ *
+ * That also means the heights that go into the priority queue never drop below the last one that came out,
+ * which is what a RadixHeap needs. Cells come out in the order they flood, so floodArrivalsIn just numbers
+ * them as they do.
+ */
+namespace {
+    void priorityFlood(const Grid<double>& terrain,
+                       const Vector<GridLocation>& sources,
+                       Grid<double>& floodHeights,
+                       Grid<int>* order) {
+        int numRows = terrain.numRows();
+        int numCols = terrain.numCols();
+
+        // cells that are never reached keep a flood height of NaN
+        floodHeights = Grid<double>(numRows, numCols, numeric_limits<double>::quiet_NaN());
+        if (order != nullptr) *order = Grid<int>(numRows, numCols, -1);
+        if (floodHeights.isEmpty()) return;
+
+        // keys are flood heights, values are packed cell indices
+        RadixHeap<int> toVisit;
+
+        // sources are under water at every height
+        for (GridLocation source: sources) {
+            if (!isnan(floodHeights[source.row][source.col])) continue;
+            floodHeights[source.row][source.col] = -numeric_limits<double>::infinity();
+            toVisit.enqueue(radixKeyFor(-numeric_limits<double>::infinity()), source.row * numCols + source.col);
+        }
+
+        const double* heights = &terrain[0][0];
+        double* levels = &floodHeights[0][0];
+        int* ranks = order != nullptr? &(*order)[0][0] : nullptr;
+
+        int nextRank = 0;
+        while (!toVisit.isEmpty()) {
+            int index = toVisit.dequeue().second;
+            int row = index / numCols;
+            int col = index % numCols;
+            double level = levels[index];
+            if (ranks != nullptr) ranks[index] = nextRank++;
+
+            // give each unreached cardinal neighbour the height of the lowest path through this cell;
+            // NaN cells are never wet, so they stay unreached
+            const int rowOffsets[] = {  0, 0, -1, 1 };
+            const int colOffsets[] = { -1, 1,  0, 0 };
+            for (int i = 0; i < 4; i++) {
+                int newRow = row + rowOffsets[i];
+                int newCol = col + colOffsets[i];
+                if (newRow < 0 || newRow >= numRows || newCol < 0 || newCol >= numCols) continue;
+
+                int newIndex = newRow * numCols + newCol;
+                if (isnan(levels[newIndex]) && !isnan(heights[newIndex])) {
+                    levels[newIndex] = max(level, heights[newIndex]);
+                    toVisit.enqueue(radixKeyFor(levels[newIndex]), newIndex);
+                }
+            }
+        }
+    }
+}
+
+Grid<double> floodHeightsIn(const Grid<double>& terrain,
+                            const Vector<GridLocation>& sources) {
+    Grid<double> floodHeights;
+    priorityFlood(terrain, sources, floodHeights, nullptr);
+    return floodHeights;
+}
+
+FloodArrivals floodArrivalsIn(const Grid<double>& terrain,
+                              const Vector<GridLocation>& sources) {
+    FloodArrivals result;
+    priorityFlood(terrain, sources, result.heights, &result.order);
+    return result;
+}
 
-    // creates an empty queue to put flooded squares;
-    Queue<GridLocation> floodedSquares;
+/* floodedRegionsAt thresholds the flood heights. NaN compares false against everything, so cells that
+ * can't be reached are never flooded.
+ */
+Grid<bool> floodedRegionsAt(const Grid<double>& floodHeights, double height) {
+    Grid<bool> newTerrain(floodHeights.numRows(), floodHeights.numCols());
+    for (int row = 0; row < floodHeights.numRows(); row++) {
+        for (int col = 0; col < floodHeights.numCols(); col++) {
+            newTerrain[row][col] = floodHeights[row][col] <= height;
+        }
+    }
+    return newTerrain;
+}
+
+namespace {
+    /* Flooded-cell policy that records the flood in a FloodMask, with cells numbered row by row. */
+    class FloodedMaskCells {
+    public:
+        explicit FloodedMaskCells(FloodMask& mask) : mask(mask), numCols(mask.numCols()) {}
 
-    // GridLocation to hold location of the adjacent square
-    GridLocation newLocation;
+        bool test(int index) const {
+            return mask.test(index / numCols, index % numCols);
+        }
+        void set(int index) {
+            mask.set(index / numCols, index % numCols);
+        }
+        void turnedAway(int /* index */) {}
 
-    // a grid of directions to cycle through for adjacent squares
-    Grid <int> directions = {
-        {0, -1}, // left
-        {0, 1},  // right
-        {-1, 0}, // up
-        {1, 0}   // down
+    private:
+        FloodMask& mask;
+        int numCols;
     };
+}
 
-    // for each water source at or below the water level, flood that square, and add that square to the queue
+/* floodedMaskIn is the same flood as floodedRegionsIn, writing into a FloodMask instead of a Grid<bool>. */
+FloodMask floodedMaskIn(const Grid<double>& terrain,
+                        const Vector<GridLocation>& sources,
+                        double height) {
+    FloodMask result(terrain.numRows(), terrain.numCols());
+    if (result.isEmpty()) return result;
+
+    GridTerrain<> cells(terrain, height);
+    FloodedMaskCells flooded(result);
+    FloodQueue queue;
+    NoFloodStats stats;
+
+    seedFlood(cells, sources, flooded, queue, stats);
+    spreadFlood<FourConnected>(cells, flooded, queue, stats);
+    return result;
+}
 
-    for (GridLocation source: sources){
-        newTerrain.set(source, true);
-        floodedSquares.enqueue(source);
+/* floodedMaskAt thresholds the flood heights into a mask, just like floodedRegionsAt. */
+FloodMask floodedMaskAt(const Grid<double>& floodHeights, double height) {
+    FloodMask flooded(floodHeights.numRows(), floodHeights.numCols());
+    for (int row = 0; row < floodHeights.numRows(); row++) {
+        for (int col = 0; col < floodHeights.numCols(); col++) {
+            if (floodHeights[row][col] <= height) {
+                flooded.set(row, col);
+            }
+        }
     }
+    return flooded;
+}
 
-    // while the queue isnt empty dequeue a position from the front of the queue
-    while(!floodedSquares.isEmpty()){
-        GridLocation currentSquare = floodedSquares.dequeue();
+/* floodedRegionsByScanline is a span-filling flood. A seed is a cell at or below the water level that might not
+ * be flooded yet. Flooding a seed means flooding the entire horizontal run of wet cells around it, then adding one
+ * seed for each run of wet cells in the row above and the row below that touches it. Runs are always flooded all
+ * at once, so if any cell in a run is flooded the whole run is, and the rest of its seeds can be skipped.
+ *
+ * This reads the terrain and the result a row at a time through &grid[row][0], which works because Grid stores
+ * its elements row by row in a single array.
+ */
+Grid<bool> floodedRegionsByScanline(const Grid<double>& terrain,
+                                    const Vector<GridLocation>& sources,
+                                    double height) {
+    int numRows = terrain.numRows();
+    int numCols = terrain.numCols();
+    Grid<bool> newTerrain(numRows, numCols);
+    if (numRows == 0 || numCols == 0) return newTerrain;
+
+    // seeds are packed cell indices
+    vector<int> seeds;
 
-        // cycle through each square adjacent to the position in a cardinal direction
-        for (int i = 0; i < 4; i++) {
-            newLocation.row = currentSquare.row + directions[i][0];
-            newLocation.col = currentSquare.col + directions[i][1];
-            // check if this newLocation is in bounds, not filled, and at or below the water level
-            if (terrain.inBounds(newLocation) &&
-                !newTerrain.get(newLocation.row, newLocation.col) &&
-                terrain.get(newLocation.row, newLocation.col) <= height) {
-                // flood the square and add it to the queue
-                newTerrain.set(newLocation, true);
-                floodedSquares.enqueue(newLocation);
+    // adds a seed for each run of wet, unflooded cells in the given row that overlaps [from, to)
+    auto seedRunsIn = [&](int row, int from, int to) {
+        const double* heights = &terrain[row][0];
+        const bool* flooded = &newTerrain[row][0];
+        while (from < to) {
+            int start = firstWetIn(heights, from, to, height);
+            if (start == to) break;
+            if (!flooded[start]) {
+                seeds.push_back(row * numCols + start);
             }
+            from = firstDryIn(heights, start + 1, to, height);
+        }
+    };
+
+    // sources at or below the water are ordinary seeds; ones above it flood just themselves and seed their neighbours
+    for (GridLocation source: sources) {
+        if (terrain[source.row][source.col] <= height) {
+            seeds.push_back(source.row * numCols + source.col);
+        } else if (!newTerrain[source.row][source.col]) {
+            newTerrain[source.row][source.col] = true;
+            seedRunsIn(source.row, max(source.col - 1, 0), source.col);
+            seedRunsIn(source.row, source.col + 1, min(source.col + 2, numCols));
+            if (source.row > 0) seedRunsIn(source.row - 1, source.col, source.col + 1);
+            if (source.row + 1 < numRows) seedRunsIn(source.row + 1, source.col, source.col + 1);
         }
     }
 
+    while (!seeds.empty()) {
+        int row = seeds.back() / numCols;
+        int col = seeds.back() % numCols;
+        seeds.pop_back();
+
+        bool* flooded = &newTerrain[row][0];
+        if (flooded[col]) continue;
+
+        // flood the whole run of wet cells around the seed
+        const double* heights = &terrain[row][0];
+        int from = wetRunStart(heights, col, height);
+        int to = firstDryIn(heights, col + 1, numCols, height);
+        fill(flooded + from, flooded + to, true);
+
+        // and look for runs to flood directly above and below it
+        if (row > 0) seedRunsIn(row - 1, from, to);
+        if (row + 1 < numRows) seedRunsIn(row + 1, from, to);
+    }
+
     return newTerrain;
 }
 
+/* Hands the flood off to whichever engine was asked for. */
+Grid<bool> floodedRegionsIn(const Grid<double>& terrain,
+                            const Vector<GridLocation>& sources,
+                            double height,
+                            FloodEngine engine) {
+    switch (engine) {
+        case FloodEngine::BREADTH_FIRST: return floodedRegionsIn(terrain, sources, height);
+        case FloodEngine::PARALLEL:      return floodedRegionsInParallel(terrain, sources, height);
+        case FloodEngine::SCANLINE:      return floodedRegionsByScanline(terrain, sources, height);
+    }
+    error("Unknown flood engine.");
+}
+
+namespace {
+    /* Flooded-cell policy for floodedRegionsForHeights. Cells are unvisited, flooded, or parked waiting for a
+     * higher water level, and a cell that's too high for the current level is parked in the bucket of the first
+     * later level that floods it, if there is one.
+     */
+    class ParkingCells {
+    public:
+        ParkingCells(const Grid<double>& terrain, const vector<double>& sortedHeights, Grid<bool>& flooded)
+            : heights(terrain.isEmpty()? nullptr : &terrain[0][0]),
+              sortedHeights(sortedHeights),
+              flooded(flooded.isEmpty()? nullptr : &flooded[0][0]),
+              state(size_t(terrain.numRows()) * terrain.numCols(), kUnvisited),
+              parked(sortedHeights.size()) {}
+
+        bool test(int index) const {
+            return state[index] != kUnvisited;
+        }
+        void set(int index) {
+            state[index] = kFlooded;
+            flooded[index] = true;
+        }
+        void turnedAway(int index) {
+            state[index] = kParked;
+            double cellHeight = heights[index];
+            auto first = partition_point(sortedHeights.begin() + step + 1, sortedHeights.end(),
+                                         [&](double level) { return !(cellHeight <= level); });
+            if (first != sortedHeights.end()) {
+                parked[first - sortedHeights.begin()].push_back(index);
+            }
+        }
+
+        /* Moves on to the given level, handing back the cells parked for it. */
+        vector<int> startLevel(int level) {
+            step = level;
+            vector<int> result;
+            result.swap(parked[level]);
+            return result;
+        }
+
+    private:
+        /* What's known about each cell. An enum, since vector's constructor takes these by
+         * reference, and a static constant would then need a definition of its own.
+         */
+        enum : unsigned char { kUnvisited, kFlooded, kParked };
+
+        const double* heights;
+        const vector<double>& sortedHeights;
+        bool* flooded;
+        vector<unsigned char> state;
+        vector<vector<int>> parked;
+        int step = 0;
+    };
+}
+
+/* floodedRegionsForHeights carries one flood forward through the heights from lowest to highest. While flooding at
+ * one height, any neighbour that's too high to flood gets parked in a bucket for the first later height that can
+ * flood it. When the flood moves on to that height, the cells in its bucket get flooded and the flood carries on from
+ * them. Each cell is flooded once and parked at most once, no matter how many heights there are.
+ */
+Vector<Grid<bool>> floodedRegionsForHeights(const Grid<double>& terrain,
+                                            const Vector<GridLocation>& sources,
+                                            const Vector<double>& heights) {
+    int numHeights = heights.size();
+
+    // process the heights from lowest to highest, remembering where each one came from
+    vector<int> order(numHeights);
+    for (int i = 0; i < numHeights; i++) {
+        if (isnan(heights[i])) error("Water heights can't be NaN.");
+        order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(), [&](int lhs, int rhs) {
+        return heights[lhs] < heights[rhs];
+    });
+    vector<double> sortedHeights(numHeights);
+    for (int i = 0; i < numHeights; i++) {
+        sortedHeights[i] = heights[order[i]];
+    }
+
+    Grid<bool> newTerrain(terrain.numRows(), terrain.numCols());
+    Vector<Grid<bool>> result(numHeights);
+    ParkingCells cells(terrain, sortedHeights, newTerrain);
+    FloodQueue queue;
+    NoFloodStats stats;
+
+    for (int step = 0; step < numHeights; step++) {
+        GridTerrain<> level(terrain, sortedHeights[step]);
+
+        // the first flood starts from the sources; later ones start from the cells parked for this height
+        vector<int> parked = cells.startLevel(step);
+        if (step == 0) {
+            seedFlood(level, sources, cells, queue, stats);
+        }
+        for (int index: parked) {
+            cells.set(index);
+            queue.enqueue(index);
+        }
+        spreadFlood<FourConnected>(level, cells, queue, stats);
+
+        result[order[step]] = newTerrain;
+    }
+
+    return result;
+}
+
+
+namespace {
+    /* Terrain-access policy for a PaddedTerrain. Cells are indices into the padded array, so a cell's neighbours
+     * are always at fixed offsets from it, and the ring of border cells means none of them is ever out of bounds.
+     */
+    class PaddedCells {
+    public:
+        PaddedCells(const PaddedTerrain& terrain, double height)
+            : stride(terrain.stride()), heights(terrain.data()), height(height) {}
+
+        int indexOf(int row, int col) const {
+            return (row + 1) * stride + (col + 1);
+        }
+
+        template <typename Neighbourhood, typename Visit>
+        void forEachNeighbour(int index, Visit&& visit) const {
+            Neighbourhood::forEachNeighbour(0, 0, [&](int rowOffset, int colOffset) {
+                visit(index + rowOffset * stride + colOffset);
+            });
+        }
+
+        bool admits(int index) const {
+            return heights[index] <= height;
+        }
+
+    private:
+        int stride;
+        const double* heights;
+        double height;
+    };
 
+    /* Terrain-access policy for a QuantizedTerrain: the codes are read instead of the heights. */
+    class QuantizedCells {
+    public:
+        QuantizedCells(const QuantizedTerrain& terrain, double height)
+            : numRows(terrain.numRows()), numCols(terrain.numCols()),
+              codes(terrain.data()), limit(terrain.codeLimit(height)) {}
+
+        int indexOf(int row, int col) const {
+            return row * numCols + col;
+        }
+
+        template <typename Neighbourhood, typename Visit>
+        void forEachNeighbour(int index, Visit&& visit) const {
+            forEachNeighbourInBounds<Neighbourhood>(numRows, numCols, index, visit);
+        }
+
+        bool admits(int index) const {
+            return codes[index] < limit;
+        }
+
+    private:
+        int numRows, numCols;
+        const uint16_t* codes;
+        uint32_t limit;
+    };
+}
+
+/* This floodedRegionsIn is the same flood as the one at the top of the file, but over a PaddedTerrain. The border
+ * cells are marked flooded before the flood starts so that they never get enqueued, even when the water is
+ * infinitely high.
+ */
+Grid<bool> floodedRegionsIn(const PaddedTerrain& terrain,
+                            const Vector<GridLocation>& sources,
+                            double height) {
+    int numRows = terrain.numRows();
+    int numCols = terrain.numCols();
+    int stride  = terrain.stride();
+
+    // flooded cells, border included
+    vector<unsigned char> flooded(size_t(numRows + 2) * stride, 0);
+    fill(flooded.begin(), flooded.begin() + stride, 1);
+    fill(flooded.end() - stride, flooded.end(), 1);
+    for (int row = 1; row <= numRows; row++) {
+        flooded[size_t(row) * stride] = 1;
+        flooded[size_t(row) * stride + stride - 1] = 1;
+    }
+
+    PaddedCells cells(terrain, height);
+    FloodedCells<unsigned char> floodedCells(flooded.data());
+    FloodQueue queue;
+    NoFloodStats stats;
+    seedFlood(cells, sources, floodedCells, queue, stats);
+    spreadFlood<FourConnected>(cells, floodedCells, queue, stats);
+
+    // copy the interior out row by row
+    Grid<bool> result(numRows, numCols);
+    for (int row = 0; row < numRows && numCols > 0; row++) {
+        const unsigned char* from = flooded.data() + terrain.indexOf(row, 0);
+        bool* to = &result[row][0];
+        for (int col = 0; col < numCols; col++) {
+            to[col] = from[col];
+        }
+    }
+    return result;
+}
+
+/* The quantized flood is the same flood again, writing straight into the result. Its queue only ever holds the
+ * frontier, so besides the 2-byte codes and the result it needs next to no memory.
+ */
+Grid<bool> floodedRegionsIn(const QuantizedTerrain& terrain,
+                            const Vector<GridLocation>& sources,
+                            double height) {
+    Grid<bool> result(terrain.numRows(), terrain.numCols());
+    if (result.isEmpty()) return result;
+
+    QuantizedCells cells(terrain, height);
+    FloodedCells<bool> flooded(&result[0][0]);
+    FloodQueue queue;
+    NoFloodStats stats;
+    seedFlood(cells, sources, flooded, queue, stats);
+    spreadFlood<FourConnected>(cells, flooded, queue, stats);
+    return result;
+}
+
+
+/* Each connectivity gets its own instantiation of the flood kernel. */
+Grid<bool> floodedRegionsIn(const Grid<double>& terrain,
+                            const Vector<GridLocation>& sources,
+                            double height,
+                            Connectivity connectivity) {
+    NoFloodStats stats;
+    switch (connectivity) {
+        case Connectivity::FOUR:  return floodKernel<FourConnected>(terrain, sources, height, SolidTerrain(), stats);
+        case Connectivity::EIGHT: return floodKernel<EightConnected>(terrain, sources, height, SolidTerrain(), stats);
+    }
+    error("Unknown connectivity.");
+}
+
+/* As above, but every cell's height is lowered by its tolerance as far as the water is concerned. */
+Grid<bool> floodedRegionsThroughLevees(const Grid<double>& terrain,
+                                       const Vector<GridLocation>& sources,
+                                       double height,
+                                       const Grid<double>& tolerance,
+                                       Connectivity connectivity) {
+    if (tolerance.numRows() != terrain.numRows() || tolerance.numCols() != terrain.numCols()) {
+        error("Levee tolerances must be the same size as the terrain.");
+    }
+
+    NoFloodStats stats;
+    LeakyLevees levees(tolerance);
+    switch (connectivity) {
+        case Connectivity::FOUR:  return floodKernel<FourConnected>(terrain, sources, height, levees, stats);
+        case Connectivity::EIGHT: return floodKernel<EightConnected>(terrain, sources, height, levees, stats);
+    }
+    error("Unknown connectivity.");
+}
 
 /***** Test Cases Below This Point *****/
 #include "GUI/SimpleTest.h"
+#include "TestTerrains.h"
+#include <random>
+
+namespace {
+    /* Whether two grids of flood heights are the same, counting NaN as equal to NaN. */
+    bool sameFloodHeights(const Grid<double>& lhs, const Grid<double>& rhs) {
+        if (lhs.numRows() != rhs.numRows() || lhs.numCols() != rhs.numCols()) return false;
+        for (int row = 0; row < lhs.numRows(); row++) {
+            for (int col = 0; col < lhs.numCols(); col++) {
+                if (lhs[row][col] != rhs[row][col] && !(isnan(lhs[row][col]) && isnan(rhs[row][col]))) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+}
+
+STUDENT_TEST("floodedRegionsInParallel matches floodedRegionsIn on random terrains.") {
+    for (int seed = 0; seed < 4; seed++) {
+        Grid<double> world = randomTerrain(300, 350, seed);
+        Vector<GridLocation> sources = {
+            { 0, 0 }, { 150, 175 }, { 299, 349 }
+        };
+
+        for (double height: { 0.0, 4.0, 5.0, 6.0, 10.0 }) {
+            Grid<bool> expected = floodedRegionsIn(world, sources, height);
+            EXPECT_EQUAL(floodedRegionsInParallel(world, sources, height, 2), expected);
+            EXPECT_EQUAL(floodedRegionsInParallel(world, sources, height, 5), expected);
+        }
+    }
+}
+
+STUDENT_TEST("floodedRegionsInParallel handles no sources, duplicate sources, and small worlds.") {
+    Grid<double> world = randomTerrain(300, 300, 137);
+    EXPECT_EQUAL(floodedRegionsInParallel(world, {}, 10.0, 4), Grid<bool>(300, 300));
+
+    Vector<GridLocation> sources = { { 10, 10 }, { 10, 10 }, { 10, 10 } };
+    EXPECT_EQUAL(floodedRegionsInParallel(world, sources, 6.0, 4),
+                 floodedRegionsIn(world, sources, 6.0));
+
+    Grid<double> small = randomTerrain(3, 4, 137);
+    EXPECT_EQUAL(floodedRegionsInParallel(small, { { 1, 1 } }, 5.0, 4),
+                 floodedRegionsIn(small, { { 1, 1 } }, 5.0));
+}
+
+STUDENT_TEST("floodedRegionsAt matches floodedRegionsIn at every height.") {
+    for (int seed = 0; seed < 4; seed++) {
+        Grid<double> world = randomTerrain(40, 60, seed);
+        world[10][10] = numeric_limits<double>::quiet_NaN();
+        Vector<GridLocation> sources = {
+            { 0, 0 }, { 20, 30 }
+        };
+
+        Grid<double> floodHeights = floodHeightsIn(world, sources);
+        for (double height = -1.0; height <= 11.0; height += 0.5) {
+            EXPECT_EQUAL(floodedRegionsAt(floodHeights, height), floodedRegionsIn(world, sources, height));
+        }
+    }
+}
+
+STUDENT_TEST("floodHeightsIn handles sources above the water and unreachable cells.") {
+    Grid<double> world = {
+        { 3, 1, 4, 1 },
+        { 5, 9, 2, 6 },
+        { 5, 3, 5, 8 }
+    };
+
+    /* The source is always flooded, and the water then has to climb to 4 to get out. */
+    Grid<double> floodHeights = floodHeightsIn(world, { { 1, 2 } });
+    EXPECT(floodHeights[1][2] == -numeric_limits<double>::infinity());
+    EXPECT_EQUAL(floodHeights[0][2], 4.0);
+    EXPECT_EQUAL(floodHeights[0][0], 4.0);
+    EXPECT_EQUAL(floodHeights[1][1], 9.0);
+    EXPECT_EQUAL(floodedRegionsAt(floodHeights, 0.0), floodedRegionsIn(world, { { 1, 2 } }, 0.0));
+
+    /* With no sources, nothing can ever flood, even at infinite height. */
+    Grid<double> dry = floodHeightsIn(world, {});
+    EXPECT_EQUAL(floodedRegionsAt(dry, numeric_limits<double>::infinity()), Grid<bool>(3, 4));
+}
+
+STUDENT_TEST("floodedMaskIn and floodedMaskAt match floodedRegionsIn.") {
+    for (int seed = 0; seed < 4; seed++) {
+        Grid<double> world = randomTerrain(50, 130, seed);
+        Vector<GridLocation> sources = {
+            { 0, 0 }, { 25, 100 }, { 25, 100 }
+        };
+
+        Grid<double> floodHeights = floodHeightsIn(world, sources);
+        for (double height: { -1.0, 0.0, 4.0, 5.0, 6.0, 10.0 }) {
+            Grid<bool> expected = floodedRegionsIn(world, sources, height);
+            EXPECT_EQUAL(floodedMaskIn(world, sources, height).toGrid(), expected);
+            EXPECT_EQUAL(floodedMaskAt(floodHeights, height), FloodMask(expected));
+        }
+    }
+}
+
+STUDENT_TEST("floodedRegionsByScanline matches floodedRegionsIn.") {
+    for (int seed = 0; seed < 6; seed++) {
+        /* Odd widths so the SIMD comparisons hit their leftover cases. */
+        Grid<double> world = randomTerrain(45, 67 + seed, seed);
+        Vector<GridLocation> sources = {
+            { 0, 0 }, { 22, 33 }, { 44, 66 }
+        };
+
+        for (double height: { -1.0, 0.0, 3.0, 4.0, 5.0, 6.0, 10.0 }) {
+            EXPECT_EQUAL(floodedRegionsByScanline(world, sources, height),
+                         floodedRegionsIn(world, sources, height));
+        }
+    }
+}
+
+STUDENT_TEST("floodedRegionsByScanline handles sources above the water and NaN heights.") {
+    Grid<double> world = {
+        { 0, 0, 9, 0, 0 },
+        { 9, 9, 0, 9, 0 },
+        { 0, 9, 0, 9, 0 },
+        { 0, 0, 0, 9, 0 }
+    };
+    world[3][0] = numeric_limits<double>::quiet_NaN();
+
+    for (GridLocation source: { GridLocation(0, 2), GridLocation(1, 1), GridLocation(3, 4) }) {
+        EXPECT_EQUAL(floodedRegionsByScanline(world, { source }, 1.0),
+                     floodedRegionsIn(world, { source }, 1.0));
+    }
+}
+
+STUDENT_TEST("Every flood engine gives the same answer.") {
+    Grid<double> world = randomTerrain(260, 270, 106);
+    Vector<GridLocation> sources = { { 130, 135 } };
+
+    Grid<bool> expected = floodedRegionsIn(world, sources, 5.0);
+    for (FloodEngine engine: { FloodEngine::BREADTH_FIRST, FloodEngine::PARALLEL, FloodEngine::SCANLINE }) {
+        EXPECT_EQUAL(floodedRegionsIn(world, sources, 5.0, engine), expected);
+    }
+}
+
+STUDENT_TEST("floodedRegionsForHeights matches floodedRegionsIn at each height.") {
+    for (int seed = 0; seed < 4; seed++) {
+        Grid<double> world = randomTerrain(40, 55, seed);
+        world[7][7] = numeric_limits<double>::quiet_NaN();
+        Vector<GridLocation> sources = {
+            { 0, 0 }, { 20, 30 }
+        };
+
+        /* Out of order, with repeats, and with heights below and above the whole terrain. */
+        Vector<double> heights = { 5.0, -3.0, 2.5, 10.0, 5.0, 4.0, 7.5, 0.0, 100.0, 6.0 };
+        Vector<Grid<bool>> floods = floodedRegionsForHeights(world, sources, heights);
+
+        EXPECT_EQUAL(floods.size(), heights.size());
+        for (int i = 0; i < heights.size(); i++) {
+            EXPECT_EQUAL(floods[i], floodedRegionsIn(world, sources, heights[i]));
+        }
+    }
+}
+
+STUDENT_TEST("floodedRegionsForHeights handles no heights and reports NaN heights.") {
+    Grid<double> world = randomTerrain(5, 5, 137);
+    EXPECT(floodedRegionsForHeights(world, { { 0, 0 } }, {}).isEmpty());
+    EXPECT_ERROR(floodedRegionsForHeights(world, { { 0, 0 } }, { 1.0, numeric_limits<double>::quiet_NaN() }));
+}
+
+STUDENT_TEST("floodedRegionsIn on a PaddedTerrain matches floodedRegionsIn.") {
+    for (int seed = 0; seed < 4; seed++) {
+        Grid<double> world = randomTerrain(35, 48 + seed, seed);
+        world[10][10] = numeric_limits<double>::quiet_NaN();
+        PaddedTerrain padded(world);
+        EXPECT_EQUAL(padded.get(10, 11), world[10][11]);
+
+        /* Sources on every edge, so the flood runs into the border in all four directions. */
+        Vector<GridLocation> sources = {
+            { 0, 5 }, { 34, 20 }, { 17, 0 }, { 20, 47 + seed }, { 0, 5 }
+        };
+        for (double height: { -1.0, 0.0, 5.0, 10.0, numeric_limits<double>::infinity() }) {
+            EXPECT_EQUAL(floodedRegionsIn(padded, sources, height),
+                         floodedRegionsIn(world, sources, height));
+        }
+    }
+
+    EXPECT_EQUAL(floodedRegionsIn(PaddedTerrain(Grid<double>(0, 0)), {}, 0.0), Grid<bool>(0, 0));
+}
+
+STUDENT_TEST("floodedRegionsIn fills in FloodStats.") {
+    Grid<double> world = {
+        { 0, 0, 9 },
+        { 0, 9, 0 },
+        { 9, 0, 0 }
+    };
+
+    FloodStats stats;
+    EXPECT_EQUAL(floodedRegionsIn(world, { { 0, 0 } }, 1.0, stats), floodedRegionsIn(world, { { 0, 0 } }, 1.0));
+
+    /* Three cells flood. Besides the two cells the source floods, their neighbours are
+     * four walls and two probes back into the source.
+     */
+    EXPECT_EQUAL(stats.cellsVisited, 3);
+    EXPECT_EQUAL(stats.enqueues, 3);
+    EXPECT_EQUAL(stats.peakQueueLength, 2);
+    EXPECT_EQUAL(stats.rejectedByHeight, 4);
+    EXPECT_EQUAL(stats.rejectedAsFlooded, 2);
+    EXPECT(stats.seedingSeconds >= 0 && stats.expansionSeconds >= 0);
+
+    /* Counters start over on each flood. */
+    floodedRegionsIn(world, {}, 1.0, stats);
+    EXPECT_EQUAL(stats.cellsVisited, 0);
+
+    /* Every neighbour probe is accounted for on a random terrain too. */
+    Grid<double> random = randomTerrain(30, 30, 137);
+    floodedRegionsIn(random, { { 15, 15 } }, 6.0, stats);
+    EXPECT_EQUAL(stats.cellsVisited, stats.enqueues);
+    EXPECT_LESS_THAN_OR_EQUAL_TO(stats.peakQueueLength, stats.enqueues);
+    EXPECT_LESS_THAN_OR_EQUAL_TO(stats.enqueues - 1 + stats.rejectedByHeight + stats.rejectedAsFlooded,
+                                 4 * stats.cellsVisited);
+}
+
+STUDENT_TEST("Four-connected flood kernel matches floodedRegionsIn.") {
+    for (int seed = 0; seed < 4; seed++) {
+        Grid<double> world = randomTerrain(40, 50, seed);
+        Grid<double> noTolerance(40, 50);
+        Vector<GridLocation> sources = {
+            { 0, 0 }, { 20, 25 }, { 20, 25 }
+        };
+
+        for (double height: { -1.0, 0.0, 4.0, 6.0, 10.0 }) {
+            Grid<bool> expected = floodedRegionsIn(world, sources, height);
+            EXPECT_EQUAL(floodedRegionsIn(world, sources, height, Connectivity::FOUR), expected);
+            EXPECT_EQUAL(floodedRegionsThroughLevees(world, sources, height, noTolerance), expected);
+        }
+    }
+}
+
+STUDENT_TEST("Eight-connected flood crosses diagonal levees.") {
+    Grid<double> world = {
+        { 0, 0, 0, 0, 9 },
+        { 0, 0, 0, 9, 0 },
+        { 0, 0, 9, 0, 0 },
+        { 0, 9, 0, 0, 0 },
+        { 9, 0, 0, 0, 0 }
+    };
+
+    Grid<bool> four = floodedRegionsIn(world, { { 0, 0 } }, 1.0, Connectivity::FOUR);
+    EXPECT(!four[4][4]);
+    EXPECT(four[1][2]);
+
+    Grid<bool> eight = floodedRegionsIn(world, { { 0, 0 } }, 1.0, Connectivity::EIGHT);
+    for (int row = 0; row < 5; row++) {
+        for (int col = 0; col < 5; col++) {
+            EXPECT_EQUAL(eight[row][col], world[row][col] == 0.0);
+        }
+    }
+
+    /* Any cell the four-connected flood reaches, the eight-connected one does too. */
+    for (int seed = 0; seed < 4; seed++) {
+        Grid<double> random = randomTerrain(30, 30, seed);
+        Grid<bool> fourFlooded  = floodedRegionsIn(random, { { 15, 15 } }, 5.0, Connectivity::FOUR);
+        Grid<bool> eightFlooded = floodedRegionsIn(random, { { 15, 15 } }, 5.0, Connectivity::EIGHT);
+        for (int row = 0; row < 30; row++) {
+            for (int col = 0; col < 30; col++) {
+                if (fourFlooded[row][col]) EXPECT(eightFlooded[row][col]);
+            }
+        }
+    }
+}
+
+STUDENT_TEST("Leaky levees let water through within their tolerance.") {
+    Grid<double> world = {
+        { 0, 5, 0 },
+        { 0, 5, 0 },
+        { 0, 5, 0 }
+    };
+    Grid<double> tolerance(3, 3);
+    tolerance[1][1] = 2.0;
+
+    EXPECT(!floodedRegionsThroughLevees(world, { { 0, 0 } }, 2.5, tolerance)[1][2]);
+
+    Grid<bool> flooded = floodedRegionsThroughLevees(world, { { 0, 0 } }, 3.0, tolerance);
+    EXPECT(flooded[1][1]);
+    EXPECT(flooded[0][2] && flooded[1][2] && flooded[2][2]);
+    EXPECT(!flooded[0][1] && !flooded[2][1]);
+
+    EXPECT_ERROR(floodedRegionsThroughLevees(world, { { 0, 0 } }, 3.0, Grid<double>(2, 2)));
+}
+
+STUDENT_TEST("RadixHeap returns keys in order, and equal keys first in, first out.") {
+    Vector<double> values = { -numeric_limits<double>::infinity(), -1e300, -2.5, -0.0, 0.0,
+                              1e-300, 2.5, 3.0, 1e300, numeric_limits<double>::infinity() };
+    for (int i = 1; i < values.size(); i++) {
+        EXPECT(radixKeyFor(values[i - 1]) <= radixKeyFor(values[i]));
+    }
+    EXPECT(radixKeyFor(-0.0) == radixKeyFor(0.0));
+
+    RadixHeap<int> heap;
+    mt19937 generator(137);
+    uniform_int_distribution<int> steps(0, 3);
+    uint64_t lastKey = 0;
+    int lastValue = -1;
+    int nextValue = 0;
+    auto check = [&] {
+        auto item = heap.dequeue();
+        EXPECT(item.first >= lastKey);
+        if (item.first == lastKey) EXPECT(item.second > lastValue);
+        lastKey = item.first;
+        lastValue = item.second;
+    };
+
+    /* Values count up as items go in, so equal keys should come out with increasing values. */
+    for (int i = 0; i < 1000; i++) {
+        heap.enqueue(lastKey + steps(generator) * 1000, nextValue++);
+        heap.enqueue(lastKey + steps(generator), nextValue++);
+        if (i % 2 == 0) check();
+    }
+    EXPECT_EQUAL(heap.size(), 1500);
+    EXPECT_ERROR(heap.enqueue(lastKey - 1, 0));
+    while (!heap.isEmpty()) check();
+    EXPECT_ERROR(heap.dequeue());
+}
+
+STUDENT_TEST("floodArrivalsIn orders cells by flood height, then breadth-first.") {
+    /* A flat plain with a ridge of height 3 down the middle, and NaN in one corner. */
+    Grid<double> world(5, 7, 1.0);
+    for (int row = 0; row < 5; row++) {
+        world[row][3] = 3.0;
+    }
+    world[4][6] = numeric_limits<double>::quiet_NaN();
+
+    FloodArrivals arrivals = floodArrivalsIn(world, { { 2, 0 }, { 0, 0 } });
+    EXPECT(sameFloodHeights(arrivals.heights, floodHeightsIn(world, { { 2, 0 }, { 0, 0 } })));
+    EXPECT_EQUAL(arrivals.order[2][0], 0);
+    EXPECT_EQUAL(arrivals.order[0][0], 1);
+    EXPECT_EQUAL(arrivals.order[4][6], -1);
+
+    /* Each cell on the near side of the ridge floods after every cell that's closer
+     * to a source, and the whole ridge floods before anything beyond it.
+     */
+    for (int row = 0; row < 5; row++) {
+        EXPECT(arrivals.order[row][1] < arrivals.order[row][2]);
+        EXPECT(arrivals.order[row][2] < arrivals.order[row][3]);
+        EXPECT(arrivals.order[row][3] < arrivals.order[2][4]);
+    }
+    EXPECT(arrivals.order[2][1] < arrivals.order[4][1]);
+
+    /* The order is a permutation of the reachable cells, consistent with the heights. */
+    for (int seed = 0; seed < 4; seed++) {
+        Grid<double> random = randomTerrain(30, 40, seed);
+        random[7][7] = numeric_limits<double>::quiet_NaN();
+        Vector<GridLocation> sources = { { 0, 0 }, { 15, 20 } };
+        FloodArrivals result = floodArrivalsIn(random, sources);
+        EXPECT(sameFloodHeights(result.heights, floodHeightsIn(random, sources)));
+
+        Vector<GridLocation> byOrder(30 * 40, { -1, -1 });
+        int reached = 0;
+        for (int row = 0; row < 30; row++) {
+            for (int col = 0; col < 40; col++) {
+                if (result.order[row][col] == -1) {
+                    EXPECT(isnan(result.heights[row][col]));
+                } else {
+                    byOrder[result.order[row][col]] = { row, col };
+                    reached++;
+                }
+            }
+        }
+        for (int i = 0; i < reached; i++) {
+            EXPECT_NOT_EQUAL(byOrder[i].row, -1);
+            if (i > 0) {
+                EXPECT(result.heights[byOrder[i - 1].row][byOrder[i - 1].col] <=
+                       result.heights[byOrder[i].row][byOrder[i].col]);
+            }
+        }
+    }
+}
+
+STUDENT_TEST("floodedRegionsIn on a QuantizedTerrain matches floodedRegionsIn exactly.") {
+    for (int seed = 0; seed < 4; seed++) {
+        Grid<double> world = randomTerrain(45, 60, seed);
+        for (int col = 0; col < 60; col++) {
+            world[10][col] = col * 0.1;      // Steps that doubles can't hold exactly.
+        }
+        world[3][3] = numeric_limits<double>::quiet_NaN();
+        world[4][4] = numeric_limits<double>::infinity();
+        world[5][5] = -numeric_limits<double>::infinity();
+        world[6][6] = -0.0;
+        Vector<GridLocation> sources = { { 0, 0 }, { 22, 30 }, { 3, 3 } };
+
+        QuantizedTerrain quantized(world);
+        EXPECT(QuantizedTerrain::fits(world));
+        for (int row = 0; row < world.numRows(); row++) {
+            for (int col = 0; col < world.numCols(); col++) {
+                EXPECT(quantized.get(row, col) == world[row][col] ||
+                       (isnan(quantized.get(row, col)) && isnan(world[row][col])));
+            }
+        }
+
+        /* Every height in the terrain, and every height in between. */
+        Vector<double> heights = { numeric_limits<double>::quiet_NaN(), numeric_limits<double>::infinity(),
+                                   -numeric_limits<double>::infinity(), 0.3, 0.30000000000000004, -0.0 };
+        for (double level: quantized.levels()) {
+            heights.add(level);
+            heights.add(nextafter(level, numeric_limits<double>::infinity()));
+        }
+        for (double height: heights) {
+            EXPECT_EQUAL(floodedRegionsIn(quantized, sources, height), floodedRegionsIn(world, sources, height));
+        }
+    }
+}
+
+STUDENT_TEST("QuantizedTerrain rejects terrains with too many distinct heights.") {
+    Grid<double> world(300, 300);
+    for (int row = 0; row < 300; row++) {
+        for (int col = 0; col < 300; col++) {
+            world[row][col] = row * 300 + col;
+        }
+    }
+    EXPECT(!QuantizedTerrain::fits(world));
+    EXPECT_ERROR(QuantizedTerrain{ world });
+
+    /* One fewer than the NaN code is fine. */
+    Grid<double> justFits(255, 257);
+    for (int row = 0; row < 255; row++) {
+        for (int col = 0; col < 257; col++) {
+            justFits[row][col] = row * 257 + col;
+        }
+    }
+    QuantizedTerrain quantized(justFits);
+    EXPECT_EQUAL(quantized.levels().size(), 65535);
+    EXPECT_EQUAL(quantized.code(254, 256), 65534);
+    EXPECT_EQUAL(quantized.codeLimit(100.5), 101);
+
+    EXPECT(QuantizedTerrain(Grid<double>()).isEmpty());
+}
+
+STUDENT_TEST("Flood analytics match counting them up from the result.") {
+    for (int seed = 0; seed < 6; seed++) {
+        Grid<double> world = randomTerrain(40, 50, seed);
+        world[7][7] = numeric_limits<double>::quiet_NaN();
+        world[20][20] = 100;
+        world[20][21] = 100;
+        Vector<GridLocation> sources = { { 0, 0 }, { 20, 20 }, { 20, 21 }, { 39, 49 }, { 0, 0 }, { 7, 7 } };
+
+        for (double height = -1.0; height <= 11.0; height += 1.5) {
+            FloodAnalytics analytics;
+            Grid<bool> flooded = floodedRegionsIn(world, sources, height, analytics);
+            EXPECT_EQUAL(flooded, floodedRegionsIn(world, sources, height));
+
+            int64_t area = 0, shoreline = 0;
+            int bodies = 0;
+            Grid<bool> labelled(world.numRows(), world.numCols());
+            for (int row = 0; row < world.numRows(); row++) {
+                for (int col = 0; col < world.numCols(); col++) {
+                    if (!flooded[row][col]) continue;
+                    area++;
+
+                    for (GridLocation next: { GridLocation(row, col - 1), GridLocation(row, col + 1),
+                                              GridLocation(row - 1, col), GridLocation(row + 1, col) }) {
+                        if (flooded.inBounds(next) && !flooded[next]) shoreline++;
+                    }
+
+                    /* Label this cell's whole body of water, if that hasn't been done already. */
+                    if (labelled[row][col]) continue;
+                    bodies++;
+                    Queue<GridLocation> toLabel;
+                    toLabel.enqueue({ row, col });
+                    labelled[row][col] = true;
+                    while (!toLabel.isEmpty()) {
+                        GridLocation curr = toLabel.dequeue();
+                        for (GridLocation next: { GridLocation(curr.row, curr.col - 1), GridLocation(curr.row, curr.col + 1),
+                                                  GridLocation(curr.row - 1, curr.col), GridLocation(curr.row + 1, curr.col) }) {
+                            if (flooded.inBounds(next) && flooded[next] && !labelled[next]) {
+                                labelled[next] = true;
+                                toLabel.enqueue(next);
+                            }
+                        }
+                    }
+                }
+            }
+            EXPECT_EQUAL(analytics.floodedArea, area);
+            EXPECT_EQUAL(analytics.shorelineEdges, shoreline);
+            EXPECT_EQUAL(analytics.waterBodies, bodies);
+        }
+    }
+}
+
 PROVIDED_TEST("Nothing gets wet if there are no water sources.") {
     Grid<double> world = {
         { 0, 0, 0 },
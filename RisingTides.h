@@ -3,6 +3,11 @@
 #include "queue.h"
 #include "grid.h"
 #include "vector.h"
+#include "FloodMask.h"
+#include "FloodStats.h"
+#include "PaddedTerrain.h"
+#include "QuantizedTerrain.h"
+#include <cstdint>
 
 /**
  * Given a terrain and an altitude, returns a Grid<bool> indicating whether each cell
@@ -29,3 +34,281 @@
 Grid<bool> floodedRegionsIn(const Grid<double>& terrain,
                             const Vector<GridLocation>& sources,
                             double height);
+
+/**
+ * Same as floodedRegionsIn, but also fills in a FloodStats describing how much work
+ * the flood did: how many cells it visited and enqueued, how long the queue got, why
+ * neighbours were turned away, and how long seeding and expansion took.
+ *
+ * The three-argument version doesn't collect any of this and isn't slowed down by it.
+ *
+ * @param terrain The terrain height map.
+ * @param sources Locations of all the water sources, which you can assume are all in bounds.
+ * @param height The water height, in meters.
+ * @param stats Where to put the counters. Anything already there is overwritten.
+ * @return A Grid indicating which cells are flooded, with true meaning "flooded" and
+ *         false meaning "above water."
+ */
+Grid<bool> floodedRegionsIn(const Grid<double>& terrain,
+                            const Vector<GridLocation>& sources,
+                            double height,
+                            FloodStats& stats);
+
+/* Summary figures for a flood. */
+struct FloodAnalytics {
+    std::int64_t floodedArea    = 0; // Cells under water.
+    std::int64_t shorelineEdges = 0; // Edges between a flooded cell and a dry one.
+    int waterBodies             = 0; // Connected groups of flooded cells.
+};
+
+/**
+ * Same as floodedRegionsIn, but also works out the flooded area, the length of the
+ * shoreline, and how many separate bodies of water there are, all during the flood
+ * itself rather than in extra passes over the result.
+ *
+ * The shoreline is measured in cell edges: each side of a flooded cell that faces a dry
+ * cell counts once. The edges of the map don't count. Sources are flooded one at a time,
+ * each one spreading as far as it can before the next, so a source that's still dry when
+ * its turn comes starts a new body of water.
+ *
+ * @param terrain The terrain height map.
+ * @param sources Locations of all the water sources, which you can assume are all in bounds.
+ * @param height The water height, in meters.
+ * @param analytics Where to put the figures. Anything already there is overwritten.
+ * @return A Grid indicating which cells are flooded, with true meaning "flooded" and
+ *         false meaning "above water."
+ */
+Grid<bool> floodedRegionsIn(const Grid<double>& terrain,
+                            const Vector<GridLocation>& sources,
+                            double height,
+                            FloodAnalytics& analytics);
+
+/**
+ * Parallel version of floodedRegionsIn. The flood is expanded one BFS level at a time,
+ * with the cells of each level split among a group of worker threads. Cells are claimed
+ * through an atomic visited bitmap, so each cell is flooded exactly once no matter which
+ * thread reaches it first.
+ *
+ * The result is identical to what floodedRegionsIn returns. Small terrains are handed
+ * off to floodedRegionsIn directly, since starting threads costs more than flooding them.
+ *
+ * @param terrain The terrain height map.
+ * @param sources Locations of all the water sources, which you can assume are all in bounds.
+ * @param height The water height, in meters.
+ * @param numThreads How many threads to use. Zero means "one per hardware thread."
+ * @return A Grid indicating which cells are flooded, with true meaning "flooded" and
+ *         false meaning "above water."
+ */
+Grid<bool> floodedRegionsInParallel(const Grid<double>& terrain,
+                                    const Vector<GridLocation>& sources,
+                                    double height,
+                                    int numThreads = 0);
+
+/**
+ * Computes, for every cell in the terrain, the lowest water height at which that cell
+ * ends up under water. This is the height of the lowest path from any source to the
+ * cell, where a path's height is the height of the tallest cell along it (not counting
+ * the source itself, which is always flooded).
+ *
+ * Once this has been computed, the flood at any water height h is just the set of cells
+ * whose flood height is at most h; see floodedRegionsAt. Sources have a flood height of
+ * negative infinity, and cells that no water can ever reach have a flood height of NaN.
+ *
+ * @param terrain The terrain height map.
+ * @param sources Locations of all the water sources, which you can assume are all in bounds.
+ * @return A Grid holding the flood height of each cell.
+ */
+Grid<double> floodHeightsIn(const Grid<double>& terrain,
+                            const Vector<GridLocation>& sources);
+
+/* When each cell floods as the water rises from negative infinity. */
+struct FloodArrivals {
+    Grid<double> heights; // Flood height of each cell, as returned by floodHeightsIn.
+    Grid<int>    order;   // 0 for the first cell to flood, 1 for the next, etc.; -1 if never.
+};
+
+/**
+ * Same as floodHeightsIn, but also works out the order in which the cells flood. The
+ * sources come first, in the order given. After that, cells flood in order of their flood
+ * heights, and cells with the same flood height flood in breadth-first order from wherever
+ * the water first reaches that height. On flat ground, then, the order counts outward from
+ * the edge of the water, which makes it a stand-in for how long the water takes to arrive.
+ *
+ * Both this and floodHeightsIn use a RadixHeap rather than a comparison-based priority
+ * queue, which keeps them within a small factor of the cost of floodedRegionsIn.
+ *
+ * @param terrain The terrain height map.
+ * @param sources Locations of all the water sources, which you can assume are all in bounds.
+ * @return The flood height and flood order of each cell.
+ */
+FloodArrivals floodArrivalsIn(const Grid<double>& terrain,
+                              const Vector<GridLocation>& sources);
+
+/**
+ * Given the flood heights computed by floodHeightsIn, returns which cells are under water
+ * at the given water height. The result is identical to calling floodedRegionsIn with the
+ * same terrain, sources, and height, but only costs a single pass over the grid.
+ *
+ * @param floodHeights The flood heights of each cell, as returned by floodHeightsIn.
+ * @param height The water height, in meters.
+ * @return A Grid indicating which cells are flooded, with true meaning "flooded" and
+ *         false meaning "above water."
+ */
+Grid<bool> floodedRegionsAt(const Grid<double>& floodHeights, double height);
+
+/**
+ * Same as floodedRegionsIn, except that the result is returned as a FloodMask, which
+ * uses one bit per cell instead of one byte. The mask doubles as the record of which
+ * cells have already been flooded while the flood runs.
+ *
+ * @param terrain The terrain height map.
+ * @param sources Locations of all the water sources, which you can assume are all in bounds.
+ * @param height The water height, in meters.
+ * @return Which cells are flooded.
+ */
+FloodMask floodedMaskIn(const Grid<double>& terrain,
+                        const Vector<GridLocation>& sources,
+                        double height);
+
+/**
+ * Same as floodedRegionsAt, except that the result is returned as a FloodMask.
+ *
+ * @param floodHeights The flood heights of each cell, as returned by floodHeightsIn.
+ * @param height The water height, in meters.
+ * @return Which cells are flooded.
+ */
+FloodMask floodedMaskAt(const Grid<double>& floodHeights, double height);
+
+/* Which algorithm floodedRegionsIn should use. They all produce the same result. */
+enum class FloodEngine {
+    BREADTH_FIRST, // floodedRegionsIn: one cell at a time.
+    PARALLEL,      // floodedRegionsInParallel: one BFS level at a time, across threads.
+    SCANLINE       // floodedRegionsByScanline: whole horizontal runs of cells at a time.
+};
+
+/**
+ * Scanline (span-filling) version of floodedRegionsIn. Rather than visiting cells one at
+ * a time, this floods an entire horizontal run of cells at or below the water level at
+ * once, and then looks for runs to flood in the rows directly above and below it. Only
+ * one seed per run is ever enqueued. Runs are found by comparing several heights against
+ * the water level at once using SIMD instructions where they're available.
+ *
+ * The result is identical to what floodedRegionsIn returns.
+ *
+ * @param terrain The terrain height map.
+ * @param sources Locations of all the water sources, which you can assume are all in bounds.
+ * @param height The water height, in meters.
+ * @return A Grid indicating which cells are flooded, with true meaning "flooded" and
+ *         false meaning "above water."
+ */
+Grid<bool> floodedRegionsByScanline(const Grid<double>& terrain,
+                                    const Vector<GridLocation>& sources,
+                                    double height);
+
+/**
+ * Runs floodedRegionsIn using the given flood engine.
+ *
+ * @param terrain The terrain height map.
+ * @param sources Locations of all the water sources, which you can assume are all in bounds.
+ * @param height The water height, in meters.
+ * @param engine Which algorithm to use.
+ * @return A Grid indicating which cells are flooded, with true meaning "flooded" and
+ *         false meaning "above water."
+ */
+Grid<bool> floodedRegionsIn(const Grid<double>& terrain,
+                            const Vector<GridLocation>& sources,
+                            double height,
+                            FloodEngine engine);
+
+/**
+ * Floods the terrain at each of the given water heights. This gives the same results as
+ * calling floodedRegionsIn once per height, but does the flooding work only once: the
+ * heights are processed from lowest to highest, and each flood picks up from the shoreline
+ * of the one before it rather than starting over from the sources.
+ *
+ * Building each result still takes one pass over the grid, since each one is a separate
+ * Grid<bool>.
+ *
+ * @param terrain The terrain height map.
+ * @param sources Locations of all the water sources, which you can assume are all in bounds.
+ * @param heights The water heights, in meters, in any order. NaN heights are an error.
+ * @return One Grid per height, in the same order as the heights, indicating which cells
+ *         are flooded at that height.
+ */
+Vector<Grid<bool>> floodedRegionsForHeights(const Grid<double>& terrain,
+                                            const Vector<GridLocation>& sources,
+                                            const Vector<double>& heights);
+
+/**
+ * Same as floodedRegionsIn, but over a PaddedTerrain. The border of infinitely high cells
+ * around a PaddedTerrain means the flood never has to check whether a neighbour is in
+ * bounds, which makes this noticeably faster when flooding the same terrain repeatedly.
+ *
+ * @param terrain The terrain height map, with its border.
+ * @param sources Locations of all the water sources, which you can assume are all in bounds.
+ * @param height The water height, in meters.
+ * @return A Grid indicating which cells are flooded, with true meaning "flooded" and
+ *         false meaning "above water."
+ */
+Grid<bool> floodedRegionsIn(const PaddedTerrain& terrain,
+                            const Vector<GridLocation>& sources,
+                            double height);
+
+/**
+ * Same as floodedRegionsIn, but over a QuantizedTerrain. The water height is turned into
+ * a limit on the codes once, up front, after which the flood only ever compares 16-bit
+ * codes. The result is exactly what floodedRegionsIn gives on the original terrain.
+ *
+ * @param terrain The terrain, with its heights replaced by codes.
+ * @param sources Locations of all the water sources, which you can assume are all in bounds.
+ * @param height The water height, in meters.
+ * @return A Grid indicating which cells are flooded, with true meaning "flooded" and
+ *         false meaning "above water."
+ */
+Grid<bool> floodedRegionsIn(const QuantizedTerrain& terrain,
+                            const Vector<GridLocation>& sources,
+                            double height);
+
+/* Which cells water can flow between. */
+enum class Connectivity {
+    FOUR,  // Up, down, left, and right only.
+    EIGHT  // Diagonally as well.
+};
+
+/**
+ * Same as floodedRegionsIn, but with a choice of whether water can also flow diagonally.
+ * Each choice runs its own copy of the flood, specialized at compile time (see
+ * FloodKernel.h). The four-connected one is the same code floodedRegionsIn runs.
+ *
+ * @param terrain The terrain height map.
+ * @param sources Locations of all the water sources, which you can assume are all in bounds.
+ * @param height The water height, in meters.
+ * @param connectivity Which neighbours water can flow to.
+ * @return A Grid indicating which cells are flooded, with true meaning "flooded" and
+ *         false meaning "above water."
+ */
+Grid<bool> floodedRegionsIn(const Grid<double>& terrain,
+                            const Vector<GridLocation>& sources,
+                            double height,
+                            Connectivity connectivity);
+
+/**
+ * Floods a terrain with leaky levees. Each cell has a tolerance, and water gets into the
+ * cell once it's within that tolerance of the cell's height; a tolerance of zero is an
+ * ordinary cell. This models levees and seawalls that seep or overtop before the water
+ * actually reaches their crest.
+ *
+ * @param terrain The terrain height map.
+ * @param sources Locations of all the water sources, which you can assume are all in bounds.
+ * @param height The water height, in meters.
+ * @param tolerance How far below each cell's height the water can be and still get in.
+ *        Must be the same size as the terrain.
+ * @param connectivity Which neighbours water can flow to.
+ * @return A Grid indicating which cells are flooded, with true meaning "flooded" and
+ *         false meaning "above water."
+ */
+Grid<bool> floodedRegionsThroughLevees(const Grid<double>& terrain,
+                                       const Vector<GridLocation>& sources,
+                                       double height,
+                                       const Grid<double>& tolerance,
+                                       Connectivity connectivity = Connectivity::FOUR);
@@ -0,0 +1,333 @@
+#include "StripedFlood.h"
+#include "RisingTides.h"
+#include "error.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifndef _WIN32
+    #include <cerrno>
+    #include <csignal>
+    #include <sys/socket.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifndef _WIN32
+
+namespace {
+    /* Rows [firstRow, endRow) of the terrain, and the sockets its worker talks over. A
+     * socket is -1 if there's nobody on the other end: the top stripe has no stripe above
+     * it, and so on.
+     */
+    struct Stripe {
+        int firstRow, endRow;
+        int up = -1, down = -1;
+        int coordinator = -1;
+    };
+
+    /* Writes all the bytes, retrying after partial writes. A worker that has died makes
+     * this fail rather than raising SIGPIPE.
+     */
+    bool sendAll(int socket, const void* data, size_t length) {
+        const char* next = static_cast<const char*>(data);
+        while (length > 0) {
+            ssize_t sent = send(socket, next, length, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            next   += sent;
+            length -= sent;
+        }
+        return true;
+    }
+
+    /* Reads exactly that many bytes. Fails if the other end hangs up first. */
+    bool receiveAll(int socket, void* data, size_t length) {
+        char* next = static_cast<char*>(data);
+        while (length > 0) {
+            ssize_t received = recv(socket, next, length, 0);
+            if (received < 0 && errno == EINTR) continue;
+            if (received <= 0) return false;
+            next   += received;
+            length -= received;
+        }
+        return true;
+    }
+
+    /* Frontiers go over the wire as a count followed by that many column numbers. */
+    bool sendColumns(int socket, const vector<uint32_t>& columns) {
+        uint32_t count = columns.size();
+        return sendAll(socket, &count, sizeof(count)) &&
+               sendAll(socket, columns.data(), count * sizeof(uint32_t));
+    }
+
+    bool receiveColumns(int socket, vector<uint32_t>& columns) {
+        uint32_t count;
+        if (!receiveAll(socket, &count, sizeof(count))) return false;
+        columns.resize(count);
+        return receiveAll(socket, columns.data(), count * sizeof(uint32_t));
+    }
+
+    /* What a worker does from the moment it's forked: flood its stripe in rounds until the
+     * coordinator says to stop, then send the stripe back. Returns the exit status.
+     *
+     * The two workers on either end of a socket take turns, with the upper one sending
+     * first. Every worker handles the socket above it before the one below it, so whatever
+     * the size of a frontier, nobody is ever stuck writing to a worker that's also writing.
+     */
+    int runWorker(const Grid<double>& terrain, const Vector<GridLocation>& sources,
+                  double height, const Stripe& stripe) {
+        int numRows = stripe.endRow - stripe.firstRow;
+        int numCols = terrain.numCols();
+        const double* heights = &terrain[stripe.firstRow][0];
+
+        vector<unsigned char> flooded(size_t(numRows) * numCols, false);
+        vector<int> toVisit;
+        vector<uint32_t> toUp, toDown, fromUp, fromDown;
+
+        /* Flooding a cell on the top or bottom row also means telling the stripe next door,
+         * unless that stripe is where the water came from (the socket it came over is
+         * given as cameFrom); it has that cell flooded already.
+         */
+        auto flood = [&](int row, int col, int cameFrom = -1) {
+            flooded[size_t(row) * numCols + col] = true;
+            toVisit.push_back(row * numCols + col);
+            if (row == 0           && stripe.up   != -1 && cameFrom != stripe.up)   toUp.push_back(col);
+            if (row == numRows - 1 && stripe.down != -1 && cameFrom != stripe.down) toDown.push_back(col);
+        };
+        auto admit = [&](int row, int col, int cameFrom = -1) {
+            size_t index = size_t(row) * numCols + col;
+            if (!flooded[index] && heights[index] <= height) flood(row, col, cameFrom);
+        };
+
+        for (GridLocation source: sources) {
+            int row = source.row - stripe.firstRow;
+            if (row >= 0 && row < numRows && !flooded[size_t(row) * numCols + source.col]) {
+                flood(row, source.col);
+            }
+        }
+
+        for (size_t next = 0; ; ) {
+            for (; next < toVisit.size(); next++) {
+                int row = toVisit[next] / numCols;
+                int col = toVisit[next] % numCols;
+                if (row > 0)           admit(row - 1, col);
+                if (row < numRows - 1) admit(row + 1, col);
+                if (col > 0)           admit(row, col - 1);
+                if (col < numCols - 1) admit(row, col + 1);
+            }
+
+            if (stripe.up != -1) {
+                if (!receiveColumns(stripe.up, fromUp) || !sendColumns(stripe.up, toUp)) return 1;
+            }
+            if (stripe.down != -1) {
+                if (!sendColumns(stripe.down, toDown) || !receiveColumns(stripe.down, fromDown)) return 1;
+            }
+
+            uint64_t numSent = toUp.size() + toDown.size();
+            unsigned char keepGoing;
+            if (!sendAll(stripe.coordinator, &numSent, sizeof(numSent)) ||
+                !receiveAll(stripe.coordinator, &keepGoing, sizeof(keepGoing))) {
+                return 1;
+            }
+            if (!keepGoing) break;
+
+            toUp.clear();
+            toDown.clear();
+            if (stripe.up != -1) {
+                for (uint32_t col: fromUp) admit(0, col, stripe.up);
+            }
+            if (stripe.down != -1) {
+                for (uint32_t col: fromDown) admit(numRows - 1, col, stripe.down);
+            }
+        }
+
+        return sendAll(stripe.coordinator, flooded.data(), flooded.size())? 0 : 1;
+    }
+
+    /* Kills whatever workers are still running and waits for all of them. */
+    void stopWorkers(const vector<pid_t>& workers) {
+        for (pid_t worker: workers) {
+            kill(worker, SIGKILL);
+        }
+        for (pid_t worker: workers) {
+            while (waitpid(worker, nullptr, 0) < 0 && errno == EINTR) {}
+        }
+    }
+
+    void closeAll(const vector<int>& sockets) {
+        for (int socket: sockets) {
+            if (socket != -1) close(socket);
+        }
+    }
+}
+
+Grid<bool> floodedRegionsInStripes(const Grid<double>& terrain,
+                                   const Vector<GridLocation>& sources,
+                                   double height,
+                                   int numWorkers) {
+    if (numWorkers < 1) error("A striped flood needs at least one worker.");
+
+    int numRows = terrain.numRows();
+    int numCols = terrain.numCols();
+    if (numWorkers > numRows) numWorkers = numRows;
+    if (numWorkers <= 1) return floodedRegionsIn(terrain, sources, height);
+
+    /* Cut the rows as evenly as possible, and wire up a socket between each pair of
+     * neighbouring stripes and between each stripe and the coordinator. Every socket the
+     * workers use is listed in allSockets, so each worker can close the ones it doesn't.
+     */
+    vector<Stripe> stripes(numWorkers);
+    vector<int> coordinatorEnds(numWorkers, -1);
+    vector<int> allSockets;
+    for (int i = 0; i < numWorkers; i++) {
+        stripes[i].firstRow = int(int64_t(i)     * numRows / numWorkers);
+        stripes[i].endRow   = int(int64_t(i + 1) * numRows / numWorkers);
+
+        int ends[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, ends) != 0) {
+            closeAll(allSockets);
+            error("Couldn't make sockets for the striped flood workers.");
+        }
+        coordinatorEnds[i] = ends[0];
+        stripes[i].coordinator = ends[1];
+        allSockets.insert(allSockets.end(), { ends[0], ends[1] });
+
+        if (i > 0) {
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, ends) != 0) {
+                closeAll(allSockets);
+                error("Couldn't make sockets for the striped flood workers.");
+            }
+            stripes[i - 1].down = ends[0];
+            stripes[i].up       = ends[1];
+            allSockets.insert(allSockets.end(), { ends[0], ends[1] });
+        }
+    }
+
+    vector<pid_t> workers;
+    for (const Stripe& stripe: stripes) {
+        pid_t worker = fork();
+        if (worker < 0) {
+            closeAll(allSockets);
+            stopWorkers(workers);
+            error("Couldn't start a striped flood worker.");
+        }
+        if (worker == 0) {
+            for (int socket: allSockets) {
+                if (socket != stripe.up && socket != stripe.down && socket != stripe.coordinator) {
+                    close(socket);
+                }
+            }
+            /* _exit, so the copy of this process doesn't run its destructors or flush its streams. */
+            _exit(runWorker(terrain, sources, height, stripe));
+        }
+        workers.push_back(worker);
+    }
+
+    /* The coordinator keeps only its own ends; that way, if a worker dies, the sockets
+     * leading to it hang up rather than wait forever.
+     */
+    for (const Stripe& stripe: stripes) {
+        closeAll({ stripe.up, stripe.down, stripe.coordinator });
+    }
+
+    auto fail = [&]() {
+        closeAll(coordinatorEnds);
+        stopWorkers(workers);
+        error("A striped flood worker stopped unexpectedly.");
+    };
+
+    /* Run rounds until none of the workers has anything to tell its neighbours. */
+    for (unsigned char keepGoing = true; keepGoing; ) {
+        uint64_t totalSent = 0;
+        for (int socket: coordinatorEnds) {
+            uint64_t numSent;
+            if (!receiveAll(socket, &numSent, sizeof(numSent))) fail();
+            totalSent += numSent;
+        }
+
+        keepGoing = totalSent > 0;
+        for (int socket: coordinatorEnds) {
+            if (!sendAll(socket, &keepGoing, sizeof(keepGoing))) fail();
+        }
+    }
+
+    Grid<bool> result(numRows, numCols);
+    vector<unsigned char> flooded;
+    for (int i = 0; i < numWorkers; i++) {
+        flooded.resize(size_t(stripes[i].endRow - stripes[i].firstRow) * numCols);
+        if (!receiveAll(coordinatorEnds[i], flooded.data(), flooded.size())) fail();
+
+        bool* cells = &result[stripes[i].firstRow][0];
+        for (size_t j = 0; j < flooded.size(); j++) {
+            cells[j] = flooded[j];
+        }
+    }
+
+    closeAll(coordinatorEnds);
+    bool allExited = true;
+    for (pid_t worker: workers) {
+        int status;
+        while (waitpid(worker, &status, 0) < 0 && errno == EINTR) {}
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) allExited = false;
+    }
+    if (!allExited) error("A striped flood worker stopped unexpectedly.");
+    return result;
+}
+
+#else
+
+Grid<bool> floodedRegionsInStripes(const Grid<double>&, const Vector<GridLocation>&, double, int) {
+    error("Striped floods need a POSIX system.");
+    return {};
+}
+
+#endif
+
+/***** Test Cases Below This Point *****/
+#include "GUI/SimpleTest.h"
+#include "TestTerrains.h"
+
+#ifndef _WIN32
+
+STUDENT_TEST("Striped floods match floodedRegionsIn for any number of workers.") {
+    for (int seed = 0; seed < 3; seed++) {
+        Grid<double> world = randomTerrain(37, 41, seed);
+        Vector<GridLocation> sources = { { 0, 0 }, { 18, 20 }, { 36, 40 } };
+
+        for (double height = -1.0; height <= 11.0; height += 2.5) {
+            Grid<bool> expected = floodedRegionsIn(world, sources, height);
+            for (int numWorkers: { 1, 2, 3, 7 }) {
+                EXPECT_EQUAL(floodedRegionsInStripes(world, sources, height, numWorkers), expected);
+            }
+        }
+    }
+}
+
+STUDENT_TEST("Striped floods carry water back and forth across stripes.") {
+    /* A channel that snakes down and back up through every stripe, so the flood has to
+     * cross each boundary many times before it's done. Stripes are one row tall, the
+     * worst case for the number of rounds.
+     */
+    Grid<double> world(8, 9, 10.0);
+    for (int row = 0; row < 8; row++) {
+        for (int col = 0; col < 9; col += 2) {
+            world[row][col] = 0.0;
+        }
+    }
+    for (int col = 1; col < 9; col += 4) world[7][col] = 0.0;
+    for (int col = 3; col < 9; col += 4) world[0][col] = 0.0;
+
+    Vector<GridLocation> sources = { { 0, 0 } };
+    EXPECT_EQUAL(floodedRegionsInStripes(world, sources, 1.0, 8), floodedRegionsIn(world, sources, 1.0));
+    EXPECT_EQUAL(floodedRegionsInStripes(world, sources, 1.0, 100), floodedRegionsIn(world, sources, 1.0));
+}
+
+STUDENT_TEST("Striped floods need at least one worker.") {
+    Grid<double> world(4, 4, 0.0);
+    EXPECT_ERROR(floodedRegionsInStripes(world, { { 0, 0 } }, 1.0, 0));
+}
+
+#endif
@@ -0,0 +1,43 @@
+/***************************************************************
+ * File: StripedFlood.h
+ *
+ * A flood split across several worker processes, each of which
+ * owns a horizontal stripe of the terrain and trades the edges of
+ * its flood with the stripes above and below it.
+ */
+#pragma once
+
+#include "grid.h"
+#include "vector.h"
+
+/**
+ * Same as floodedRegionsIn, but run by numWorkers processes forked from this one. Each
+ * worker owns a band of whole rows. The flood goes in rounds: every worker floods as far
+ * as it can inside its own stripe, then sends the columns it flooded along its top and
+ * bottom rows to the workers above and below, over a pair of connected local sockets.
+ * Those columns become the next round's sources in the neighbouring stripes. A
+ * coordinator (the calling process) adds up how many columns went out each round, and
+ * when a whole round goes by without any, every stripe is finished and is sent back to
+ * the coordinator to be stitched into the result.
+ *
+ * Workers get the terrain by inheriting the caller's memory, so nothing but frontiers and
+ * results ever crosses a socket, and the whole thing can be run and tested on one machine.
+ * Since the workers are forked, this is best called from a program that isn't running
+ * other threads at the time.
+ *
+ * Only available on POSIX systems; elsewhere, and if a worker can't be started or dies
+ * partway through, it's reported with error(). With one worker, or a terrain with fewer
+ * rows than workers, there are fewer stripes to go around, and one worker just calls
+ * floodedRegionsIn.
+ *
+ * @param terrain The terrain height map.
+ * @param sources Locations of all the water sources, which you can assume are all in bounds.
+ * @param height The water height, in meters.
+ * @param numWorkers How many worker processes to split the terrain between.
+ * @return A Grid indicating which cells are flooded, with true meaning "flooded" and
+ *         false meaning "above water."
+ */
+Grid<bool> floodedRegionsInStripes(const Grid<double>& terrain,
+                                   const Vector<GridLocation>& sources,
+                                   double height,
+                                   int numWorkers);
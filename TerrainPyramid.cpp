@@ -0,0 +1,330 @@
+#include "TerrainPyramid.h"
+#include "RisingTides.h"
+#include "error.h"
+#include <algorithm>
+#include <cmath>
+using namespace std;
+
+/* Each level is built from the one below it, taking up to four tiles at a time. fmin skips over NaN,
+ * which is what the lowest heights want; the highest heights check for NaN by hand so that it sticks.
+ */
+TerrainPyramid::TerrainPyramid(const Grid<double>& terrain) {
+    if (terrain.isEmpty()) return;
+
+    this->terrain = &terrain[0][0];
+    levels.push_back({ terrain.numRows(), terrain.numCols(), {}, {} });
+
+    while (levels.back().rows > 1 || levels.back().cols > 1) {
+        const Level& below = levels.back();
+        const double* belowLows  = lowsAt(levels.size() - 1);
+        const double* belowHighs = highsAt(levels.size() - 1);
+
+        Level above = { (below.rows + 1) / 2, (below.cols + 1) / 2, {}, {} };
+        above.lows.resize(size_t(above.rows) * above.cols);
+        above.highs.resize(size_t(above.rows) * above.cols);
+
+        for (int row = 0; row < above.rows; row++) {
+            for (int col = 0; col < above.cols; col++) {
+                double low  = numeric_limits<double>::quiet_NaN();
+                double high = -numeric_limits<double>::infinity();
+                for (int belowRow = 2 * row; belowRow < min(2 * row + 2, below.rows); belowRow++) {
+                    for (int belowCol = 2 * col; belowCol < min(2 * col + 2, below.cols); belowCol++) {
+                        size_t index = size_t(belowRow) * below.cols + belowCol;
+                        low = fmin(low, belowLows[index]);
+                        if (isnan(belowHighs[index]) || isnan(high)) {
+                            high = numeric_limits<double>::quiet_NaN();
+                        } else {
+                            high = max(high, belowHighs[index]);
+                        }
+                    }
+                }
+                above.lows[size_t(row) * above.cols + col]  = low;
+                above.highs[size_t(row) * above.cols + col] = high;
+            }
+        }
+        levels.push_back(move(above));
+    }
+}
+
+int TerrainPyramid::numLevels() const {
+    return levels.size();
+}
+
+bool TerrainPyramid::isEmpty() const {
+    return levels.empty();
+}
+
+int TerrainPyramid::numRows(int level) const {
+    return levels[level].rows;
+}
+
+int TerrainPyramid::numCols(int level) const {
+    return levels[level].cols;
+}
+
+double TerrainPyramid::lowest(int level, int row, int col) const {
+    return lowsAt(level)[size_t(row) * levels[level].cols + col];
+}
+
+double TerrainPyramid::highest(int level, int row, int col) const {
+    return highsAt(level)[size_t(row) * levels[level].cols + col];
+}
+
+/* At level 0 each tile is one cell, so its lowest and highest heights are both its height. */
+const double* TerrainPyramid::lowsAt(int level) const {
+    return level == 0? terrain : levels[level].lows.data();
+}
+
+const double* TerrainPyramid::highsAt(int level) const {
+    return level == 0? terrain : levels[level].highs.data();
+}
+
+namespace {
+    /* Flags used while refining a level. */
+    const unsigned char kUndecided = 1; // Under a MIXED tile, so still to be worked out.
+    const unsigned char kMaybeWet  = 2; // Some cell in it might flood.
+    const unsigned char kSurelyWet = 4; // Every cell in it floods.
+
+    /* Works out the tiles at one level, given the tiles at the level above (empty at the top) and
+     * which of those are MIXED. On return, mixed holds the MIXED tiles at this level.
+     *
+     * Only the undecided tiles are looked at, with two floods over them. Water can't get through a DRY
+     * tile, and gets everywhere in a WET one, so both floods start from the undecided tiles that contain
+     * a source or that border a WET tile.
+     *
+     *   - The "maybe" flood lets water into a tile if its lowest cell is under water. Every flooded
+     *     cell's path to a source runs through tiles like that, so tiles this misses are DRY.
+     *   - The "surely" flood only lets water into a tile if its highest cell is under water. A tile is
+     *     a connected block of cells, so water that gets into any cell of one of those fills all of it;
+     *     tiles this reaches are WET. (At level 0 a tile is a cell, and sources always flood.)
+     *
+     * Whatever is in the first flood but not the second is still MIXED.
+     */
+    Grid<TileStatus> refineLevel(const TerrainPyramid& pyramid, int level,
+                                 const Grid<TileStatus>& above,
+                                 vector<int>& mixed,
+                                 const Vector<GridLocation>& sources,
+                                 double height) {
+        int numRows = pyramid.numRows(level);
+        int numCols = pyramid.numCols(level);
+        Grid<TileStatus> result(numRows, numCols, TileStatus::MIXED);
+        TileStatus* tiles = &result[0][0];
+
+        /* Every tile inherits the status of the tile above it. The grids are read through raw
+         * pointers, since this is the one loop here that touches every tile.
+         */
+        if (!above.isEmpty()) {
+            for (int row = 0; row < numRows; row++) {
+                const TileStatus* aboveRow = &above[row / 2][0];
+                for (int col = 0; col < numCols; col++) {
+                    tiles[row * numCols + col] = aboveRow[col / 2];
+                }
+            }
+        }
+
+        /* The undecided tiles are the ones under the MIXED tiles above. */
+        vector<unsigned char> flags(size_t(numRows) * numCols, 0);
+        vector<int> undecided;
+        if (above.isEmpty()) {
+            undecided.push_back(0);
+        } else {
+            for (int index: mixed) {
+                int aboveRow = index / above.numCols();
+                int aboveCol = index % above.numCols();
+                for (int row = 2 * aboveRow; row < min(2 * aboveRow + 2, numRows); row++) {
+                    for (int col = 2 * aboveCol; col < min(2 * aboveCol + 2, numCols); col++) {
+                        undecided.push_back(row * numCols + col);
+                    }
+                }
+            }
+        }
+        for (int index: undecided) {
+            flags[index] = kUndecided;
+        }
+
+        const int rowOffsets[] = {  0, 0, -1, 1 };
+        const int colOffsets[] = { -1, 1,  0, 0 };
+
+        /* Flood through the undecided tiles from the given seeds, marking them with the given flag. */
+        auto spread = [&](vector<int>& toVisit, unsigned char flag, bool useHighest) {
+            for (size_t next = 0; next < toVisit.size(); next++) {
+                int row = toVisit[next] / numCols;
+                int col = toVisit[next] % numCols;
+                for (int i = 0; i < 4; i++) {
+                    int newRow = row + rowOffsets[i];
+                    int newCol = col + colOffsets[i];
+                    if (!result.inBounds(newRow, newCol)) continue;
+
+                    int index = newRow * numCols + newCol;
+                    if ((flags[index] & kUndecided) && !(flags[index] & flag) &&
+                        (useHighest? pyramid.highest(level, newRow, newCol)
+                                   : pyramid.lowest(level, newRow, newCol)) <= height) {
+                        flags[index] |= flag;
+                        toVisit.push_back(index);
+                    }
+                }
+            }
+        };
+
+        vector<int> maybe, surely;
+        auto seed = [&](int index, unsigned char flag, vector<int>& toVisit) {
+            if (!(flags[index] & flag)) {
+                flags[index] |= flag;
+                toVisit.push_back(index);
+            }
+        };
+
+        for (GridLocation source: sources) {
+            int index = (source.row >> level) * numCols + (source.col >> level);
+            if (!(flags[index] & kUndecided)) continue;
+
+            seed(index, kMaybeWet, maybe);
+            if (level == 0 || pyramid.highest(level, source.row >> level, source.col >> level) <= height) {
+                seed(index, kSurelyWet, surely);
+            }
+        }
+        for (int index: undecided) {
+            int row = index / numCols;
+            int col = index % numCols;
+
+            bool bordersWater = false;
+            for (int i = 0; i < 4; i++) {
+                int newRow = row + rowOffsets[i];
+                int newCol = col + colOffsets[i];
+                if (result.inBounds(newRow, newCol) && tiles[newRow * numCols + newCol] == TileStatus::WET) {
+                    bordersWater = true;
+                }
+            }
+            if (!bordersWater) continue;
+
+            if (pyramid.lowest(level, row, col) <= height)  seed(index, kMaybeWet, maybe);
+            if (pyramid.highest(level, row, col) <= height) seed(index, kSurelyWet, surely);
+        }
+        spread(maybe,  kMaybeWet,  false);
+        spread(surely, kSurelyWet, true);
+
+        mixed.clear();
+        for (int index: undecided) {
+            if (flags[index] & kSurelyWet) {
+                tiles[index] = TileStatus::WET;
+            } else if (flags[index] & kMaybeWet) {
+                mixed.push_back(index);
+            } else {
+                tiles[index] = TileStatus::DRY;
+            }
+        }
+        return result;
+    }
+}
+
+Grid<TileStatus> progressiveFlood(const TerrainPyramid& pyramid,
+                                  const Vector<GridLocation>& sources,
+                                  double height,
+                                  PyramidLevelCallback onLevel,
+                                  int finestLevel) {
+    if (pyramid.isEmpty()) return {};
+    if (finestLevel < 0 || finestLevel >= pyramid.numLevels()) {
+        error("Pyramid level out of range.");
+    }
+    for (GridLocation source: sources) {
+        if (source.row < 0 || source.row >= pyramid.numRows(0) ||
+            source.col < 0 || source.col >= pyramid.numCols(0)) {
+            error("Source location out of bounds.");
+        }
+    }
+
+    Grid<TileStatus> tiles;
+    vector<int> mixed;
+    for (int level = pyramid.numLevels() - 1; level >= finestLevel; level--) {
+        tiles = refineLevel(pyramid, level, tiles, mixed, sources, height);
+        if (onLevel) onLevel(level, tiles);
+    }
+    return tiles;
+}
+
+
+/***** Test Cases Below This Point *****/
+#include "GUI/SimpleTest.h"
+#include "TestTerrains.h"
+
+STUDENT_TEST("TerrainPyramid records the lowest and highest cell in each tile.") {
+    Grid<double> world = {
+        { 3, 1, 4, 1, 5 },
+        { 9, 2, 6, 5, 3 },
+        { 5, 8, 9, 7, 9 }
+    };
+    world[0][4] = numeric_limits<double>::quiet_NaN();
+
+    TerrainPyramid pyramid(world);
+    EXPECT_EQUAL(pyramid.numLevels(), 4);
+    EXPECT_EQUAL(pyramid.numRows(1), 2);
+    EXPECT_EQUAL(pyramid.numCols(1), 3);
+    EXPECT_EQUAL(pyramid.numRows(3), 1);
+    EXPECT_EQUAL(pyramid.numCols(3), 1);
+
+    EXPECT_EQUAL(pyramid.lowest(0, 1, 2), 6.0);
+    EXPECT_EQUAL(pyramid.highest(0, 1, 2), 6.0);
+    EXPECT_EQUAL(pyramid.lowest(1, 0, 0), 1.0);
+    EXPECT_EQUAL(pyramid.highest(1, 0, 0), 9.0);
+    EXPECT_EQUAL(pyramid.lowest(1, 1, 2), 9.0);
+    EXPECT_EQUAL(pyramid.highest(1, 1, 2), 9.0);
+
+    /* NaN is skipped for the lowest height, but sticks for the highest. */
+    EXPECT_EQUAL(pyramid.lowest(1, 0, 2), 3.0);
+    EXPECT(isnan(pyramid.highest(1, 0, 2)));
+    EXPECT_EQUAL(pyramid.lowest(3, 0, 0), 1.0);
+    EXPECT(isnan(pyramid.highest(3, 0, 0)));
+
+    EXPECT(TerrainPyramid(Grid<double>()).isEmpty());
+}
+
+STUDENT_TEST("progressiveFlood is conservative at every level and exact at level 0.") {
+    for (int seed = 0; seed < 6; seed++) {
+        Grid<double> world = randomTerrain(37, 58, seed);
+        world[20][20] = numeric_limits<double>::quiet_NaN();
+        world[0][57]  = numeric_limits<double>::quiet_NaN();
+        Vector<GridLocation> sources = { { 0, 0 }, { 18, 30 }, { 0, 57 } };
+        TerrainPyramid pyramid(world);
+
+        for (double height = -1.0; height <= 11.0; height += 1.5) {
+            Grid<bool> expected = floodedRegionsIn(world, sources, height);
+
+            int levelsSeen = 0;
+            Grid<TileStatus> finest = progressiveFlood(pyramid, sources, height,
+                                                       [&](int level, const Grid<TileStatus>& tiles) {
+                EXPECT_EQUAL(level, pyramid.numLevels() - 1 - levelsSeen);
+                levelsSeen++;
+                for (int row = 0; row < world.numRows(); row++) {
+                    for (int col = 0; col < world.numCols(); col++) {
+                        TileStatus status = tiles[row >> level][col >> level];
+                        if (status == TileStatus::WET) EXPECT(expected[row][col]);
+                        if (status == TileStatus::DRY) EXPECT(!expected[row][col]);
+                    }
+                }
+            });
+            EXPECT_EQUAL(levelsSeen, pyramid.numLevels());
+
+            for (int row = 0; row < world.numRows(); row++) {
+                for (int col = 0; col < world.numCols(); col++) {
+                    EXPECT(finest[row][col] == (expected[row][col]? TileStatus::WET : TileStatus::DRY));
+                }
+            }
+        }
+    }
+}
+
+STUDENT_TEST("progressiveFlood can stop at a coarser level.") {
+    /* A flat plain that's entirely under water is settled at the very first level. */
+    Grid<double> world(100, 60, 1.0);
+    TerrainPyramid pyramid(world);
+
+    Grid<TileStatus> tiles = progressiveFlood(pyramid, { { 50, 30 } }, 2.0, nullptr, 3);
+    EXPECT_EQUAL(tiles.numRows(), 13);
+    EXPECT_EQUAL(tiles.numCols(), 8);
+    for (TileStatus status: tiles) {
+        EXPECT(status == TileStatus::WET);
+    }
+
+    EXPECT_ERROR(progressiveFlood(pyramid, { { 50, 30 } }, 2.0, nullptr, pyramid.numLevels()));
+    EXPECT_ERROR(progressiveFlood(pyramid, { { 100, 30 } }, 2.0));
+}
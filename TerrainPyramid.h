@@ -0,0 +1,83 @@
+/***************************************************************
+ * File: TerrainPyramid.h
+ *
+ * Coarse summaries of a terrain at a series of resolutions, and a
+ * flood that uses them to give a rough answer right away and then
+ * sharpen it one resolution at a time.
+ */
+#pragma once
+
+#include "grid.h"
+#include "vector.h"
+#include <functional>
+#include <vector>
+
+/* Type representing a terrain summarized at every power-of-two resolution. At level k,
+ * each tile covers a 2^k x 2^k block of cells (less on the bottom and right edges) and
+ * records the lowest and highest cell in it. Level 0 is the terrain itself, read straight
+ * from the caller's grid, which has to outlive the pyramid. The top level is a single tile
+ * covering everything.
+ *
+ * NaN cells never flood, so they're left out of a tile's lowest height, but make its
+ * highest height NaN: a tile with a NaN cell in it can never be entirely under water.
+ */
+class TerrainPyramid {
+public:
+    /* Creates an empty pyramid, with no levels. */
+    TerrainPyramid() = default;
+
+    /* Builds the pyramid for the given terrain. Takes O(n) time and about 5n bytes for
+     * a terrain of n cells, all of it for the lowest and highest heights at the coarser
+     * levels.
+     */
+    explicit TerrainPyramid(const Grid<double>& terrain);
+
+    int numLevels() const;
+    bool isEmpty() const;
+
+    /* Number of tiles down and across at the given level. */
+    int numRows(int level) const;
+    int numCols(int level) const;
+
+    /* Lowest and highest cells in the given tile. These don't check bounds. */
+    double lowest(int level, int row, int col) const;
+    double highest(int level, int row, int col) const;
+
+private:
+    struct Level {
+        int rows, cols;
+        std::vector<double> lows;  // Both empty at level 0, which is read from terrain.
+        std::vector<double> highs;
+    };
+    std::vector<Level> levels;
+    const double* terrain = nullptr;
+
+    const double* lowsAt(int level) const;
+    const double* highsAt(int level) const;
+};
+
+/* What a tile looks like in a flood: completely dry, completely flooded, or not known
+ * at this resolution (some cells might flood and others might not).
+ */
+enum class TileStatus : unsigned char {
+    DRY, MIXED, WET
+};
+
+/* Called with the tiles of each level of a progressive flood as they're worked out. */
+using PyramidLevelCallback = std::function<void(int level, const Grid<TileStatus>& tiles)>;
+
+/* Floods the terrain a level at a time, starting from the top of the pyramid and working
+ * down to finestLevel, and returns the tiles at finestLevel. The status at every level is
+ * conservative: WET tiles are entirely flooded in floodedRegionsIn, and DRY tiles don't
+ * have a single flooded cell. Going down a level, the four tiles under a WET or DRY tile
+ * inherit its status, and only the tiles under MIXED tiles are looked at again. There
+ * are no MIXED tiles at level 0, where the result is the same as floodedRegionsIn.
+ *
+ * If onLevel is given, it's called with each level's tiles as soon as they're ready.
+ * Out-of-range levels are reported with error().
+ */
+Grid<TileStatus> progressiveFlood(const TerrainPyramid& pyramid,
+                                  const Vector<GridLocation>& sources,
+                                  double height,
+                                  PyramidLevelCallback onLevel = nullptr,
+                                  int finestLevel = 0);
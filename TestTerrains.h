@@ -0,0 +1,27 @@
+/***************************************************************
+ * File: TestTerrains.h
+ *
+ * Terrains shared by the test cases at the bottom of the flood
+ * engines' source files.
+ */
+#pragma once
+
+#include "grid.h"
+#include <random>
+
+/* Makes a rows x cols terrain of random heights between 0 and 10, so that a water level
+ * of about 5 leaves a maze of connected and disconnected pools. The same seed always
+ * gives the same terrain.
+ */
+inline Grid<double> randomTerrain(int rows, int cols, int seed) {
+    std::mt19937 generator(seed);
+    std::uniform_int_distribution<int> heights(0, 10);
+
+    Grid<double> result(rows, cols);
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            result[row][col] = heights(generator);
+        }
+    }
+    return result;
+}
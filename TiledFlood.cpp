@@ -0,0 +1,560 @@
+#include "TiledFlood.h"
+#include "error.h"
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <stdexcept>
+#include <vector>
+using namespace std;
+
+namespace {
+    /* Tiled terrain files start with a header padded out to 4KB, the usual page size.
+     * Where pages are bigger (16KB on Apple Silicon, say), tiles don't start on page
+     * boundaries, and release() only drops the whole pages inside each tile. The terrain
+     * format doesn't depend on the machine, so it isn't padded any further. Mask files are
+     * made fresh for each flood, so theirs is rounded up to whatever the page size is.
+     */
+    const size_t kHeaderBytes = 4096;
+    const char kTerrainMagic[8] = { 'T', 'I', 'L', 'E', 'T', 'E', 'R', 'R' };
+    const char kMaskMagic[8]    = { 'T', 'I', 'L', 'E', 'M', 'A', 'S', 'K' };
+
+    struct TileHeader {
+        char magic[8];
+        int32_t numRows;
+        int32_t numCols;
+        int32_t tileSize;
+    };
+
+    /* Number of tiles needed to cover the given number of cells. */
+    int tilesFor(int cells, int tileSize) {
+        return (cells + tileSize - 1) / tileSize;
+    }
+
+    /* Rounds the given size up to a whole number of pages. */
+    size_t toWholePages(size_t bytes) {
+        size_t page = MappedFile::pageSize();
+        return (bytes + page - 1) / page * page;
+    }
+
+    /* Space one tile of a flood mask takes up in the mask file. */
+    size_t maskStrideFor(int tileSize) {
+        return toWholePages((size_t(tileSize) * tileSize + 7) / 8);
+    }
+
+    /* Maps a file, reporting errors through error() like the rest of the flood code. */
+    MappedFile mapOrError(const string& filename) {
+        try {
+            return MappedFile(filename);
+        } catch (const runtime_error& e) {
+            error(e.what());
+        }
+    }
+
+    MappedFile createOrError(const string& filename, size_t size) {
+        try {
+            return MappedFile::create(filename, size);
+        } catch (const runtime_error& e) {
+            error(e.what());
+        }
+    }
+}
+
+TiledTerrain::TiledTerrain(const string& filename) : file(mapOrError(filename)) {
+    TileHeader header;
+    if (file.size() < kHeaderBytes) {
+        error("Not a tiled terrain file: " + filename);
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, kTerrainMagic, sizeof(kTerrainMagic)) != 0 ||
+        header.numRows < 0 || header.numCols < 0 || header.tileSize <= 0) {
+        error("Not a tiled terrain file: " + filename);
+    }
+
+    rows = header.numRows;
+    cols = header.numCols;
+    size = header.tileSize;
+
+    size_t expected = kHeaderBytes + size_t(numTileRows()) * numTileCols() * size * size * sizeof(double);
+    if (file.size() != expected) {
+        error("Tiled terrain file is the wrong size: " + filename);
+    }
+}
+
+void TiledTerrain::write(const string& filename, const Grid<double>& terrain, int tileSize) {
+    write(filename, terrain.numRows(), terrain.numCols(), [&](int row, double* heights) {
+        for (int col = 0; col < terrain.numCols(); col++) {
+            heights[col] = terrain[row][col];
+        }
+    }, tileSize);
+}
+
+/* Rows come in one at a time, but tiles cover tileSize rows, so we collect a full band of
+ * rows before scattering them into the tiles. Only one band is ever held in memory.
+ */
+void TiledTerrain::write(const string& filename, int numRows, int numCols,
+                         const function<void (int, double*)>& readRow,
+                         int tileSize) {
+    if (numRows < 0 || numCols < 0 || tileSize <= 0) {
+        error("Invalid tiled terrain dimensions.");
+    }
+
+    int tileRows = tilesFor(numRows, tileSize);
+    int tileCols = tilesFor(numCols, tileSize);
+    size_t tileBytes = size_t(tileSize) * tileSize * sizeof(double);
+    MappedFile output = createOrError(filename, kHeaderBytes + size_t(tileRows) * tileCols * tileBytes);
+
+    TileHeader header;
+    memcpy(header.magic, kTerrainMagic, sizeof(kTerrainMagic));
+    header.numRows  = numRows;
+    header.numCols  = numCols;
+    header.tileSize = tileSize;
+    memcpy(output.data(), &header, sizeof(header));
+
+    vector<double> band(size_t(tileSize) * numCols);
+    for (int tileRow = 0; tileRow < tileRows; tileRow++) {
+        int bandRows = min(tileSize, numRows - tileRow * tileSize);
+        for (int row = 0; row < bandRows; row++) {
+            readRow(tileRow * tileSize + row, band.data() + size_t(row) * numCols);
+        }
+
+        /* Copy each tile's slice of the band into place. The padding was zero-filled when
+         * the file was created.
+         */
+        size_t bandOffset = kHeaderBytes + size_t(tileRow) * tileCols * tileBytes;
+        for (int tileCol = 0; tileCol < tileCols; tileCol++) {
+            auto* tile = reinterpret_cast<double*>(output.data() + bandOffset + tileCol * tileBytes);
+            int tileWidth = min(tileSize, numCols - tileCol * tileSize);
+            for (int row = 0; row < bandRows; row++) {
+                memcpy(tile + size_t(row) * tileSize,
+                       band.data() + size_t(row) * numCols + size_t(tileCol) * tileSize,
+                       tileWidth * sizeof(double));
+            }
+        }
+
+        /* Done with this band; don't let it pile up in memory. */
+        output.discard(bandOffset, tileCols * tileBytes);
+    }
+}
+
+int TiledTerrain::numRows() const {
+    return rows;
+}
+
+int TiledTerrain::numCols() const {
+    return cols;
+}
+
+int TiledTerrain::tileSize() const {
+    return size;
+}
+
+int TiledTerrain::numTileRows() const {
+    return tilesFor(rows, size);
+}
+
+int TiledTerrain::numTileCols() const {
+    return tilesFor(cols, size);
+}
+
+const double* TiledTerrain::tile(int tileRow, int tileCol) const {
+    size_t tileBytes = size_t(size) * size * sizeof(double);
+    size_t index = size_t(tileRow) * numTileCols() + tileCol;
+    return reinterpret_cast<const double*>(file.data() + kHeaderBytes + index * tileBytes);
+}
+
+void TiledTerrain::release(int tileRow, int tileCol) {
+    size_t tileBytes = size_t(size) * size * sizeof(double);
+    size_t index = size_t(tileRow) * numTileCols() + tileCol;
+    file.discard(kHeaderBytes + index * tileBytes, tileBytes);
+}
+
+TiledFloodMask::TiledFloodMask(const string& filename, const TiledTerrain& terrain)
+    : file(createOrError(filename, toWholePages(kHeaderBytes) + size_t(terrain.numTileRows()) *
+                                   terrain.numTileCols() * maskStrideFor(terrain.tileSize()))),
+      rows(terrain.numRows()), cols(terrain.numCols()), size(terrain.tileSize()), tileCols(terrain.numTileCols()),
+      headerBytes(toWholePages(kHeaderBytes)), tileStride(maskStrideFor(size)) {
+    TileHeader header;
+    memcpy(header.magic, kMaskMagic, sizeof(kMaskMagic));
+    header.numRows  = rows;
+    header.numCols  = cols;
+    header.tileSize = size;
+    memcpy(file.data(), &header, sizeof(header));
+}
+
+int TiledFloodMask::numRows() const {
+    return rows;
+}
+
+int TiledFloodMask::numCols() const {
+    return cols;
+}
+
+unsigned char* TiledFloodMask::tileBits(int tileRow, int tileCol) {
+    size_t index = size_t(tileRow) * tileCols + tileCol;
+    return reinterpret_cast<unsigned char*>(file.data() + headerBytes + index * tileStride);
+}
+
+const unsigned char* TiledFloodMask::tileBits(int tileRow, int tileCol) const {
+    size_t index = size_t(tileRow) * tileCols + tileCol;
+    return reinterpret_cast<const unsigned char*>(file.data() + headerBytes + index * tileStride);
+}
+
+void TiledFloodMask::release(int tileRow, int tileCol) {
+    size_t index = size_t(tileRow) * tileCols + tileCol;
+    file.discard(headerBytes + index * tileStride, tileStride);
+}
+
+bool TiledFloodMask::isFlooded(int row, int col) const {
+    if (row < 0 || col < 0 || row >= rows || col >= cols) {
+        error("Location out of bounds.");
+    }
+    int local = (row % size) * size + (col % size);
+    return (tileBits(row / size, col / size)[local / 8] >> (local % 8)) & 1;
+}
+
+Grid<bool> TiledFloodMask::toGrid() const {
+    Grid<bool> result(rows, cols);
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            result[row][col] = isFlooded(row, col);
+        }
+    }
+    return result;
+}
+
+/* The engine that actually runs the tiled flood. Each tile keeps a list of seeds: cells in
+ * that tile that water has reached from a neighbouring tile (or from a source). Tiles with
+ * seeds wait in a work queue. Flooding a tile is an ordinary BFS that stays inside the
+ * tile; whenever it would step over the edge of the tile, it adds a seed to the tile on
+ * the other side instead. The flood is done once no tile has seeds left.
+ *
+ * Without some care, water would echo back and forth across tile edges: a tile floods a
+ * cell on its edge and seeds its neighbour, which floods and seeds the first tile right
+ * back, paging it in again just to find the cell already flooded. So each tile also has an
+ * in-memory bitmap of its edge cells, with a bit set once seeding that cell can't change
+ * anything: it's already been seeded, or a visit to the tile found it flooded or above the
+ * water. Seeds for those cells are dropped on the spot.
+ */
+class TiledFloodEngine {
+public:
+    TiledFloodEngine(TiledTerrain& terrain, TiledFloodMask& mask, double height, size_t memoryBudget)
+        : terrain(terrain), mask(mask), height(height), size(terrain.tileSize()),
+          tileCols(terrain.numTileCols()),
+          seeds(size_t(terrain.numTileRows()) * terrain.numTileCols()),
+          isQueued(seeds.size(), false),
+          lruPosition(seeds.size()),
+          isResident(seeds.size(), false),
+          memoryBudget(memoryBudget),
+          edgeWordsPerTile((4 * size_t(size) + 63) / 64),
+          edgeBits(seeds.size() * edgeWordsPerTile, 0) {
+        /* Each resident tile costs its heights, its pages of the result, and its node in
+         * the LRU list.
+         */
+        tileBytes = size_t(size) * size * sizeof(double) + mask.tileStride
+                  + sizeof(int) + 2 * sizeof(void*);
+
+        /* Every tile, resident or not, has a seed list, an LRU position, an edge bitmap, a
+         * slot in the work queue and two flags; the BFS queue can hold a whole tile.
+         */
+        fixedBytes = seeds.size() * (sizeof(vector<int>) + sizeof(list<int>::iterator) +
+                                     edgeWordsPerTile * sizeof(uint64_t) + sizeof(int) + 1)
+                   + size_t(size) * size * sizeof(int);
+    }
+
+    /* Adds a seed. Sources are flooded no matter their height; other seeds only flood if
+     * they're at or below the water level, and are always on the edge of their tile.
+     */
+    void addSeed(int row, int col, bool isSource) {
+        int tile = (row / size) * tileCols + (col / size);
+        int local = (row % size) * size + (col % size);
+        if (!isSource && markEdge(tile, edgeSlot(tile, row % size, col % size))) return;
+
+        size_t oldCapacity = seeds[tile].capacity();
+        seeds[tile].push_back(isSource? ~local : local);
+        seedBytes += (seeds[tile].capacity() - oldCapacity) * sizeof(int);
+        if (!isQueued[tile]) {
+            isQueued[tile] = true;
+            workQueue.push_back(tile);
+        }
+
+        /* Growing seed lists squeeze out tiles, though never the one being flooded, which
+         * is always at the front.
+         */
+        while (lru.size() > 1 && lru.size() > maxResident()) {
+            evict();
+        }
+    }
+
+    void run() {
+        while (!workQueue.empty()) {
+            int tile = workQueue.front();
+            workQueue.pop_front();
+            isQueued[tile] = false;
+            floodTile(tile);
+        }
+
+        /* Push everything still resident out to the mask file. */
+        while (!lru.empty()) {
+            evict();
+        }
+    }
+
+private:
+    TiledTerrain& terrain;
+    TiledFloodMask& mask;
+    double height;
+    int size;
+    int tileCols;
+
+    /* Pending seeds per tile, and which tiles are waiting in the work queue. Seeds are
+     * cell indices within the tile, bitwise-negated for sources.
+     */
+    vector<vector<int>> seeds;
+    vector<bool> isQueued;
+    deque<int> workQueue;
+
+    /* Resident tiles, most recently used first. */
+    list<int> lru;
+    vector<list<int>::iterator> lruPosition;
+    vector<bool> isResident;
+
+    /* The budget, and how much of it goes to each resident tile, to the bookkeeping
+     * above, and to seed lists.
+     */
+    size_t memoryBudget;
+    size_t tileBytes;
+    size_t fixedBytes;
+    size_t seedBytes = 0;
+
+    /* Edge bitmaps, edgeWordsPerTile words per tile. See edgeSlot for the layout. */
+    size_t edgeWordsPerTile;
+    vector<uint64_t> edgeBits;
+
+    /* Scratch BFS queue, reused across tiles. */
+    vector<int> toVisit;
+
+    /* Size of the real (unpadded) part of the given tile. */
+    int heightOf(int tile) const {
+        return min(size, terrain.numRows() - (tile / tileCols) * size);
+    }
+    int widthOf(int tile) const {
+        return min(size, terrain.numCols() - (tile % tileCols) * size);
+    }
+
+    /* Where the given cell's bit is in its tile's edge bitmap: the top row, then the bottom
+     * row, then the left and right columns, size bits each. Corners go with their row.
+     * Cells that aren't on the edge have no bit, and get -1.
+     */
+    int edgeSlot(int tile, int row, int col) const {
+        if (row == 0)                return col;
+        if (row == heightOf(tile) - 1) return size + col;
+        if (col == 0)                return 2 * size + row;
+        if (col == widthOf(tile) - 1)  return 3 * size + row;
+        return -1;
+    }
+
+    /* Sets the given bit of the tile's edge bitmap, returning whether it was set already. */
+    bool markEdge(int tile, int slot) {
+        uint64_t& word = edgeBits[tile * edgeWordsPerTile + slot / 64];
+        uint64_t bit = uint64_t(1) << (slot % 64);
+        bool wasSet = word & bit;
+        word |= bit;
+        return wasSet;
+    }
+
+    /* How many tiles fit in whatever the bookkeeping and seeds leave of the budget. */
+    size_t maxResident() const {
+        size_t used = fixedBytes + seedBytes;
+        return max(size_t(1), used < memoryBudget? (memoryBudget - used) / tileBytes : 0);
+    }
+
+    /* Marks the tile as most recently used, evicting least recently used tiles if that
+     * takes us over budget.
+     */
+    void touch(int tile) {
+        if (isResident[tile]) {
+            lru.erase(lruPosition[tile]);
+        } else {
+            while (!lru.empty() && lru.size() >= maxResident()) evict();
+            isResident[tile] = true;
+        }
+        lru.push_front(tile);
+        lruPosition[tile] = lru.begin();
+    }
+
+    void evict() {
+        int tile = lru.back();
+        lru.pop_back();
+        isResident[tile] = false;
+        terrain.release(tile / tileCols, tile % tileCols);
+        mask.release(tile / tileCols, tile % tileCols);
+    }
+
+    void floodTile(int tile) {
+        touch(tile);
+
+        int tileRow = tile / tileCols;
+        int tileCol = tile % tileCols;
+        const double* heights = terrain.tile(tileRow, tileCol);
+        unsigned char* bits = mask.tileBits(tileRow, tileCol);
+
+        int tileHeight = heightOf(tile);
+        int tileWidth  = widthOf(tile);
+
+        auto isFlooded = [&](int local) {
+            return (bits[local / 8] >> (local % 8)) & 1;
+        };
+        auto flood = [&](int local) {
+            bits[local / 8] |= (1 << (local % 8));
+            toVisit.push_back(local);
+        };
+
+        /* Seeds become the starting points of the BFS. */
+        toVisit.clear();
+        vector<int> tileSeeds;
+        tileSeeds.swap(seeds[tile]);
+        for (int seed: tileSeeds) {
+            bool isSource = seed < 0;
+            int local = isSource? ~seed : seed;
+            if (!isFlooded(local) && (isSource || heights[local] <= height)) {
+                flood(local);
+            }
+        }
+
+        /* Ordinary BFS, except stepping off the tile seeds the neighbouring tile. */
+        for (size_t next = 0; next < toVisit.size(); next++) {
+            int local = toVisit[next];
+            int row = local / size;
+            int col = local % size;
+
+            const int rowOffsets[] = {  0, 0, -1, 1 };
+            const int colOffsets[] = { -1, 1,  0, 0 };
+            for (int i = 0; i < 4; i++) {
+                int newRow = row + rowOffsets[i];
+                int newCol = col + colOffsets[i];
+
+                if (newRow >= 0 && newRow < tileHeight && newCol >= 0 && newCol < tileWidth) {
+                    int newLocal = newRow * size + newCol;
+                    if (!isFlooded(newLocal) && heights[newLocal] <= height) {
+                        flood(newLocal);
+                    }
+                } else {
+                    int globalRow = tileRow * size + newRow;
+                    int globalCol = tileCol * size + newCol;
+                    if (globalRow >= 0 && globalRow < terrain.numRows() &&
+                        globalCol >= 0 && globalCol < terrain.numCols()) {
+                        addSeed(globalRow, globalCol, false);
+                    }
+                }
+            }
+        }
+
+        /* Every cell on the edge that's flooded or above the water is settled for good. */
+        auto settle = [&](int row, int col) {
+            int local = row * size + col;
+            if (isFlooded(local) || !(heights[local] <= height)) {
+                markEdge(tile, edgeSlot(tile, row, col));
+            }
+        };
+        for (int col = 0; col < tileWidth; col++) {
+            settle(0, col);
+            settle(tileHeight - 1, col);
+        }
+        for (int row = 1; row < tileHeight - 1; row++) {
+            settle(row, 0);
+            settle(row, tileWidth - 1);
+        }
+
+        seedBytes -= tileSeeds.capacity() * sizeof(int);
+    }
+};
+
+TiledFloodMask floodedRegionsIn(TiledTerrain& terrain,
+                                const Vector<GridLocation>& sources,
+                                double height,
+                                const string& maskFile,
+                                size_t memoryBudget) {
+    TiledFloodMask result(maskFile, terrain);
+    TiledFloodEngine engine(terrain, result, height, memoryBudget);
+    for (GridLocation source: sources) {
+        engine.addSeed(source.row, source.col, true);
+    }
+    engine.run();
+    return result;
+}
+
+
+/***** Test Cases Below This Point *****/
+#include "GUI/SimpleTest.h"
+#include "RisingTides.h"
+#include "TestTerrains.h"
+#include <cstdio>
+
+namespace {
+    const string kTestTerrainFile = "TiledFloodTest.tiles";
+    const string kTestMaskFile    = "TiledFloodTest.mask";
+}
+
+STUDENT_TEST("Tiled flood matches floodedRegionsIn, even when only one tile fits in memory.") {
+    Grid<double> world = randomTerrain(100, 75, 137);
+    Vector<GridLocation> sources = {
+        { 0, 0 }, { 50, 40 }, { 99, 74 }
+    };
+
+    /* 16 doesn't divide 100 or 75, so there are partial tiles on the edges. */
+    TiledTerrain::write(kTestTerrainFile, world, 16);
+    {
+        TiledTerrain tiled(kTestTerrainFile);
+        EXPECT_EQUAL(tiled.numTileRows(), 7);
+        EXPECT_EQUAL(tiled.numTileCols(), 5);
+
+        for (double height: { 0.0, 5.0, 6.0, 10.0 }) {
+            Grid<bool> expected = floodedRegionsIn(world, sources, height);
+            EXPECT_EQUAL(floodedRegionsIn(tiled, sources, height, kTestMaskFile, 1).toGrid(), expected);
+            EXPECT_EQUAL(floodedRegionsIn(tiled, sources, height, kTestMaskFile, 4 << 10).toGrid(), expected);
+            EXPECT_EQUAL(floodedRegionsIn(tiled, sources, height, kTestMaskFile).toGrid(), expected);
+        }
+    }
+
+    remove(kTestTerrainFile.c_str());
+    remove(kTestMaskFile.c_str());
+}
+
+STUDENT_TEST("Tiled flood matches floodedRegionsIn with tiles only a few cells across.") {
+    /* With tiles this small, almost every step of the flood crosses a tile edge. */
+    Grid<double> world = randomTerrain(23, 17, 271);
+    Vector<GridLocation> sources = {
+        { 0, 0 }, { 11, 8 }, { 22, 16 }
+    };
+
+    for (int tileSize: { 1, 2, 3 }) {
+        TiledTerrain::write(kTestTerrainFile, world, tileSize);
+        {
+            TiledTerrain tiled(kTestTerrainFile);
+            for (double height: { 0.0, 4.0, 6.0, 10.0 }) {
+                Grid<bool> expected = floodedRegionsIn(world, sources, height);
+                EXPECT_EQUAL(floodedRegionsIn(tiled, sources, height, kTestMaskFile, 1).toGrid(), expected);
+                EXPECT_EQUAL(floodedRegionsIn(tiled, sources, height, kTestMaskFile).toGrid(), expected);
+            }
+        }
+    }
+
+    remove(kTestTerrainFile.c_str());
+    remove(kTestMaskFile.c_str());
+}
+
+STUDENT_TEST("Tiled flood floods sources above the water but nothing else.") {
+    Grid<double> world(20, 20, 5.0);
+    TiledTerrain::write(kTestTerrainFile, world, 8);
+    {
+        TiledTerrain tiled(kTestTerrainFile);
+        TiledFloodMask mask = floodedRegionsIn(tiled, { { 9, 9 } }, 1.0, kTestMaskFile);
+        EXPECT(mask.isFlooded(9, 9));
+        EXPECT(!mask.isFlooded(9, 8));
+        EXPECT_ERROR(mask.isFlooded(20, 0));
+    }
+
+    remove(kTestTerrainFile.c_str());
+    remove(kTestMaskFile.c_str());
+}
@@ -0,0 +1,119 @@
+/***************************************************************
+ * File: TiledFlood.h
+ *
+ * Out-of-core flooding for terrains that are too large to hold in
+ * memory as a Grid<double>. The terrain lives in a file on disk,
+ * split into square tiles, and the flood streams tiles in and out
+ * of memory while staying within a fixed memory budget.
+ */
+#pragma once
+
+#include "MappedFile.h"
+#include "grid.h"
+#include "vector.h"
+#include <cstddef>
+#include <functional>
+#include <string>
+
+/* Default amount of memory the tiled flood may keep resident, in bytes. */
+const std::size_t kDefaultFloodMemoryBudget = std::size_t(256) << 20;
+
+/* Type representing a terrain stored on disk as a grid of square tiles. Each tile is
+ * stored contiguously, so flooding a tile only touches that tile's pages of the file.
+ * Tiles on the bottom and right edges are padded out to the full tile size.
+ */
+class TiledTerrain {
+public:
+    /* Maps an existing tiled terrain file. */
+    explicit TiledTerrain(const std::string& filename);
+
+    /* Writes a tiled terrain file from a terrain that fits in memory. */
+    static void write(const std::string& filename, const Grid<double>& terrain, int tileSize = 256);
+
+    /* Writes a tiled terrain file one row at a time, for terrains that don't fit in
+     * memory. The callback is invoked once per row, in order, and must fill in the
+     * numCols heights for that row.
+     */
+    static void write(const std::string& filename, int numRows, int numCols,
+                      const std::function<void (int row, double* heights)>& readRow,
+                      int tileSize = 256);
+
+    int numRows() const;
+    int numCols() const;
+    int tileSize() const;
+
+    /* Number of tiles down and across. */
+    int numTileRows() const;
+    int numTileCols() const;
+
+    /* Heights in the given tile, stored row by row with tileSize() entries per row. */
+    const double* tile(int tileRow, int tileCol) const;
+
+    /* Drops the given tile from memory until it's next accessed. Tiles are stored back to
+     * back, so only the pages lying entirely within the tile are dropped: a tile smaller
+     * than a page (2KB for tileSize 16) stays in memory, and larger tiles keep the pages
+     * they share with their neighbours.
+     */
+    void release(int tileRow, int tileCol);
+
+private:
+    MappedFile file;
+    int rows, cols, size;
+};
+
+/* Type representing the result of a tiled flood: one bit per cell, stored tile by tile
+ * in a file alongside the terrain so that it doesn't need to fit in memory either.
+ */
+class TiledFloodMask {
+public:
+    /* Creates an all-dry mask for the given terrain, backed by the given file. */
+    TiledFloodMask(const std::string& filename, const TiledTerrain& terrain);
+
+    int numRows() const;
+    int numCols() const;
+
+    /* Whether the given cell is under water. */
+    bool isFlooded(int row, int col) const;
+
+    /* Copies the result into a Grid<bool>, for terrains small enough to allow that. */
+    Grid<bool> toGrid() const;
+
+private:
+    friend class TiledFloodEngine;
+
+    MappedFile file;
+    int rows, cols, size, tileCols;
+
+    /* The header and each tile are padded to whole pages, so that release can drop
+     * any tile, however small, on its own.
+     */
+    std::size_t headerBytes, tileStride;
+
+    /* Bits for the given tile, tileSize * tileSize of them. */
+    unsigned char* tileBits(int tileRow, int tileCol);
+    const unsigned char* tileBits(int tileRow, int tileCol) const;
+    void release(int tileRow, int tileCol);
+};
+
+/**
+ * Floods a tiled terrain. The flood runs one tile at a time: flooding a tile produces
+ * seeds for the neighbouring tiles along its edges, and tiles are revisited until no tile
+ * has any seeds left. The tiles kept resident, the seeds waiting for each tile, and the
+ * flood's per-tile bookkeeping together stay within memoryBudget bytes; when the budget
+ * is full, the least recently used tile is dropped.
+ *
+ * The result is identical to calling floodedRegionsIn on the same terrain.
+ *
+ * @param terrain The tiled terrain.
+ * @param sources Locations of all the water sources, which you can assume are all in bounds.
+ * @param height The water height, in meters.
+ * @param maskFile Where to store the result.
+ * @param memoryBudget How many bytes the flood may use at once. At least one tile is
+ *        always kept, however small the budget.
+ * @return Which cells are flooded.
+ */
+TiledFloodMask floodedRegionsIn(TiledTerrain& terrain,
+                                const Vector<GridLocation>& sources,
+                                double height,
+                                const std::string& maskFile,
+                                std::size_t memoryBudget = kDefaultFloodMemoryBudget);
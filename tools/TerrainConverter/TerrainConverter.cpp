@@ -0,0 +1,90 @@
+/* Command-line converter from text .terrain files to binary .terrainb files.
+ *
+ * Usage: TerrainConverter input.terrain [output.terrainb]
+ *
+ * The output defaults to the input's name with a .terrainb suffix. This only reads
+ * local terrains; a .terrain file that just names a URL needs to be downloaded and
+ * saved as a local terrain first.
+ *
+ * This is a plain C++ program that doesn't use the course library, so it's built from
+ * its own project file (TerrainConverter.pro) and left out of the main one.
+ */
+#include "TerrainFormat.h"
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+using namespace std;
+
+namespace {
+    const string kTextSuffix = ".terrain";
+
+    /* Reads a local .terrain file in the same format the demos' loadTerrain accepts. */
+    void readTextTerrain(const string& filename, int& numRows, int& numCols,
+                         vector<int32_t>& sources, vector<double>& heights) {
+        ifstream input(filename);
+        if (!input) throw runtime_error("Cannot open file " + filename);
+
+        string firstLine;
+        getline(input, firstLine);
+        if (firstLine != "local") {
+            throw runtime_error(filename + " names a terrain to download, not a local terrain.");
+        }
+
+        int numSources;
+        if (!(input >> numRows >> numCols >> numSources) || numRows < 0 || numCols < 0 || numSources < 0) {
+            throw runtime_error(filename + " has a malformed header.");
+        }
+
+        sources.resize(2 * size_t(numSources));
+        for (int32_t& coordinate: sources) {
+            if (!(input >> coordinate)) throw runtime_error(filename + " has a malformed water source.");
+        }
+
+        heights.resize(size_t(numRows) * numCols);
+        for (double& height: heights) {
+            if (!(input >> height)) throw runtime_error(filename + " has a malformed height.");
+        }
+
+        char leftover;
+        if (input >> leftover) throw runtime_error(filename + " has extra data after the heights.");
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2 && argc != 3) {
+        cerr << "Usage: " << argv[0] << " input" << kTextSuffix << " [output" << kBinaryTerrainSuffix << "]" << endl;
+        return 1;
+    }
+
+    string input  = argv[1];
+    string output = argc == 3? argv[2] : input;
+    if (argc == 2) {
+        if (output.size() >= kTextSuffix.size() &&
+            output.compare(output.size() - kTextSuffix.size(), kTextSuffix.size(), kTextSuffix) == 0) {
+            output.erase(output.size() - kTextSuffix.size());
+        }
+        output += kBinaryTerrainSuffix;
+    }
+
+    try {
+        int numRows, numCols;
+        vector<int32_t> sources;
+        vector<double> heights;
+        readTextTerrain(input, numRows, numCols, sources, heights);
+        writeBinaryTerrain(output, numRows, numCols, sources, heights.data());
+
+        /* Read it back, which checks the header and the checksum. */
+        BinaryTerrainFile check(output);
+        cout << "Wrote " << output << ": " << check.numRows() << " x " << check.numCols()
+             << ", " << check.numSources() << " water source(s), heights "
+             << check.lowestHeight() << " to " << check.highestHeight() << " m." << endl;
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
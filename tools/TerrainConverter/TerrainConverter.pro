@@ -0,0 +1,24 @@
+###############################################################################
+# Project file for the .terrain to .terrainb converter
+#
+# A console program using only the standard library, built separately from
+# the main project (which skips everything under tools/).
+###############################################################################
+
+TEMPLATE    =   app
+CONFIG      +=  console c++11
+CONFIG      -=  app_bundle qt
+
+ROOT_DIR    =   $$PWD/../..
+INCLUDEPATH +=  $$ROOT_DIR $$ROOT_DIR/Demos
+
+SOURCES     +=  TerrainConverter.cpp \
+                $$ROOT_DIR/Demos/TerrainFormat.cpp \
+                $$ROOT_DIR/MappedFile.cpp
+HEADERS     +=  $$ROOT_DIR/Demos/TerrainFormat.h \
+                $$ROOT_DIR/MappedFile.h
+
+DESTDIR     =   $$PWD
+
+# Leaves out the test cases in the shared sources, which need the rest of the project.
+DEFINES     +=  TERRAIN_CONVERTER